@@ -0,0 +1,50 @@
+// core/asyncwriter.cpp*
+#include "asyncwriter.h"
+
+namespace pbrt {
+
+// AsyncWriter Method Definitions
+AsyncWriter::~AsyncWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shutdown = true;
+    }
+    condition.notify_all();
+    if (thread.joinable()) thread.join();
+}
+
+void AsyncWriter::Enqueue(const std::string &filename,
+                          std::function<void()> write) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!thread.joinable()) thread = std::thread([this]() { Run(); });
+    for (Job &job : queue)
+        if (job.filename == filename) {
+            job.write = std::move(write);
+            return;
+        }
+    queue.push_back(Job{filename, std::move(write)});
+    condition.notify_all();
+}
+
+void AsyncWriter::Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]() { return queue.empty() && !writing; });
+}
+
+void AsyncWriter::Run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [this]() { return !queue.empty() || shutdown; });
+        if (queue.empty()) return;
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        writing = true;
+        lock.unlock();
+        job.write();
+        lock.lock();
+        writing = false;
+        condition.notify_all();
+    }
+}
+
+}  // namespace pbrt
@@ -0,0 +1,51 @@
+#ifndef ASYNCWRITER_H
+#define ASYNCWRITER_H
+
+// core/asyncwriter.h*
+#include "pbrt.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace pbrt {
+
+// AsyncWriter Declarations
+// Writes files on a thread of its own, in the order they were queued, so
+// that rendering can go on meanwhile. The thread is started by the first
+// write. Writes must not depend on the thread pool: programs call Wait()
+// before they exit, but whatever is left is written by the destructor,
+// which may run after ParallelCleanup().
+class AsyncWriter {
+  public:
+    // AsyncWriter Public Methods
+    ~AsyncWriter();
+    // Queues _write_, which writes _filename_. Progressive renders write
+    // the same file repeatedly, so if a write of _filename_ is queued and
+    // hasn't started yet, _write_ replaces it.
+    void Enqueue(const std::string &filename, std::function<void()> write);
+    // Blocks until all queued writes have finished
+    void Wait();
+
+  private:
+    // AsyncWriter Private Declarations
+    struct Job {
+        std::string filename;
+        std::function<void()> write;
+    };
+
+    // AsyncWriter Private Methods
+    void Run();
+
+    // AsyncWriter Private Data
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Job> queue;
+    bool writing = false, shutdown = false;
+    std::thread thread;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_ASYNCWRITER_H
@@ -1,4 +1,5 @@
 #include "bvh.h"
+#include "heatmap.h"
 #include "interaction.h"
 #include "paramset.h"
 #include "stats.h"
@@ -188,6 +189,7 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
     int offset = 0;
     flattenBVHTree(root, &offset);
     CHECK_EQ(totalNodes, offset);
+    InterleaveMemory(nodes, totalNodes * sizeof(LinearBVHNode));
 }
 
 Bounds3f BVHAccel::WorldBound() const {
@@ -634,12 +636,16 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     // Follow ray through BVH nodes to find primitive intersections
     int toVisitOffset = 0, currentNodeIndex = 0;
     int nodesToVisit[64];
+    // Count the work locally and add it to the thread's total once
+    int64_t nodesVisited = 0, primitivesTested = 0;
     while (true) {
         const LinearBVHNode *node = &nodes[currentNodeIndex];
+        ++nodesVisited;
         // Check ray against BVH node
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
+                primitivesTested += node->nPrimitives;
                 for (int i = 0; i < node->nPrimitives; ++i)
                     if (primitives[node->primitivesOffset + i]->Intersect(
                             ray, isect))
@@ -662,6 +668,8 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+    ThreadRayWork.nodesVisited += nodesVisited;
+    ThreadRayWork.primitivesTested += primitivesTested;
     return hit;
 }
 
@@ -671,14 +679,19 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
     int nodesToVisit[64];
     int toVisitOffset = 0, currentNodeIndex = 0;
+    int64_t nodesVisited = 0, primitivesTested = 0;
     while (true) {
         const LinearBVHNode *node = &nodes[currentNodeIndex];
+        ++nodesVisited;
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             // Process BVH node _node_ for traversal
             if (node->nPrimitives > 0) {
                 for (int i = 0; i < node->nPrimitives; ++i) {
+                    ++primitivesTested;
                     if (primitives[node->primitivesOffset + i]->IntersectP(
                             ray)) {
+                        ThreadRayWork.nodesVisited += nodesVisited;
+                        ThreadRayWork.primitivesTested += primitivesTested;
                         return true;
                     }
                 }
@@ -699,6 +712,8 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+    ThreadRayWork.nodesVisited += nodesVisited;
+    ThreadRayWork.primitivesTested += primitivesTested;
     return false;
 }
 
@@ -36,6 +36,9 @@ struct CameraSample {
     Point2f pFilm;
     Point2f pLens;
     float time;
+    // Weight of the sample's reconstruction filter value, when pFilm was
+    // importance sampled from the filter; see FilterSampler
+    float filterWeight = 1;
 };
 
 inline std::ostream &operator<<(std::ostream &os, const CameraSample &cs) {
@@ -0,0 +1,93 @@
+// core/checkpoint.cpp*
+#include "checkpoint.h"
+#include "asyncwriter.h"
+#include "paramset.h"
+#include "stats.h"
+#include <cstdio>
+#include <unistd.h>
+
+namespace pbrt {
+
+STAT_COUNTER("Checkpoint/Checkpoints written", nCheckpointsWritten);
+STAT_MEMORY_COUNTER("Memory/Checkpoint data written", checkpointBytes);
+
+// Checkpoint Local Definitions
+static const char checkpointMagic[8] = {'T', 'W', 'R', 'C', 'K', 'P', 'T', '1'};
+
+// Checkpoint Method Definitions
+bool Checkpoint::Write(const std::string &filename) const {
+    std::string tempName = filename + ".tmp";
+    FILE *f = fopen(tempName.c_str(), "wb");
+    if (!f) {
+        Error("Unable to create checkpoint \"%s\"", tempName.c_str());
+        return false;
+    }
+    uint64_t nSections = sections.size();
+    bool ok = fwrite(checkpointMagic, sizeof(checkpointMagic), 1, f) == 1 &&
+              fwrite(&nSections, sizeof(nSections), 1, f) == 1;
+    for (const auto &section : sections) {
+        uint64_t sizes[2] = {section.first.size(), section.second.size()};
+        ok = ok && fwrite(sizes, sizeof(sizes), 1, f) == 1 &&
+             fwrite(section.first.data(), 1, sizes[0], f) == sizes[0] &&
+             fwrite(section.second.data(), 1, sizes[1], f) == sizes[1];
+        checkpointBytes += sizes[1];
+    }
+    // Make sure the data is on disk before it replaces the old checkpoint
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tempName.c_str(), filename.c_str()) != 0) {
+        Error("Unable to write checkpoint \"%s\"", filename.c_str());
+        remove(tempName.c_str());
+        return false;
+    }
+    ++nCheckpointsWritten;
+    return true;
+}
+
+bool Checkpoint::Read(const std::string &filename) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return false;
+    char magic[sizeof(checkpointMagic)];
+    uint64_t nSections;
+    bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+              memcmp(magic, checkpointMagic, sizeof(magic)) == 0 &&
+              fread(&nSections, sizeof(nSections), 1, f) == 1;
+    sections.clear();
+    for (uint64_t i = 0; ok && i < nSections; ++i) {
+        uint64_t sizes[2];
+        ok = fread(sizes, sizeof(sizes), 1, f) == 1;
+        if (!ok) break;
+        std::string name(sizes[0], '\0'), data(sizes[1], '\0');
+        ok = fread(&name[0], 1, sizes[0], f) == sizes[0] &&
+             fread(&data[0], 1, sizes[1], f) == sizes[1];
+        sections[name] = std::move(data);
+    }
+    fclose(f);
+    if (!ok) {
+        Error("\"%s\" isn't a valid checkpoint", filename.c_str());
+        sections.clear();
+    }
+    return ok;
+}
+
+CheckpointSettings GetCheckpointSettings(const ParamSet &params) {
+    CheckpointSettings settings;
+    settings.filename = params.FindOneString("checkpoint", "");
+    settings.interval =
+        params.FindOneFloat("checkpointinterval", settings.interval);
+    settings.resume = params.FindOneBool("resume", false);
+    return settings;
+}
+
+// Background Checkpoint Writer Definitions
+static AsyncWriter checkpointWriter;
+
+void WriteCheckpointAsync(const std::string &filename,
+                          std::unique_ptr<Checkpoint> checkpoint) {
+    std::shared_ptr<Checkpoint> state(std::move(checkpoint));
+    checkpointWriter.Enqueue(filename, [=]() { state->Write(filename); });
+}
+
+void WaitForCheckpointWrites() { checkpointWriter.Wait(); }
+
+}  // namespace pbrt
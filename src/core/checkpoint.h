@@ -0,0 +1,84 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// core/checkpoint.h*
+#include "pbrt.h"
+#include <chrono>
+#include <cstring>
+#include <map>
+
+namespace pbrt {
+
+// Checkpoint Declarations
+
+// A snapshot of a render's state as named sections of binary data, e.g.
+// the film's pixel accumulators, integrator specific per-pixel state and
+// how many samples have been taken. Checkpoints are only read back by
+// the same build on the same platform, so sections hold raw values.
+class Checkpoint {
+  public:
+    // Checkpoint Public Methods
+    template <typename T>
+    void Add(const std::string &name, const T *values, size_t count) {
+        sections[name].assign((const char *)values, count * sizeof(T));
+    }
+    template <typename T>
+    void Add(const std::string &name, const std::vector<T> &values) {
+        Add(name, values.data(), values.size());
+    }
+    // Returns false if there's no section _name_ or if its size isn't a
+    // multiple of the size of _T_
+    template <typename T>
+    bool Get(const std::string &name, std::vector<T> *values) const {
+        auto iter = sections.find(name);
+        if (iter == sections.end() || iter->second.size() % sizeof(T) != 0)
+            return false;
+        values->resize(iter->second.size() / sizeof(T));
+        memcpy(values->data(), iter->second.data(), iter->second.size());
+        return true;
+    }
+    // The file is written under a temporary name and then renamed, so that
+    // a crash while writing leaves the previous checkpoint intact.
+    bool Write(const std::string &filename) const;
+    bool Read(const std::string &filename);
+
+  private:
+    // Checkpoint Private Data
+    std::map<std::string, std::string> sections;
+};
+
+// How an integrator checkpoints; read from the "checkpoint" (filename),
+// "checkpointinterval" (seconds) and "resume" parameters
+struct CheckpointSettings {
+    // Checkpointing is disabled if the filename is empty
+    std::string filename;
+    float interval = 300;
+    // Start from the checkpoint in _filename_ if there is one
+    bool resume = false;
+    // Returns true if checkpointing is enabled and _interval_ seconds have
+    // passed since _*lastCheckpoint_, which is then set to now
+    bool Due(std::chrono::steady_clock::time_point *lastCheckpoint) const {
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        if (filename.empty() ||
+            std::chrono::duration<float>(now - *lastCheckpoint).count() <
+                interval)
+            return false;
+        *lastCheckpoint = now;
+        return true;
+    }
+};
+CheckpointSettings GetCheckpointSettings(const ParamSet &params);
+
+// Writes _checkpoint_ on a background I/O thread, so that rendering can
+// continue. If an earlier checkpoint for the same file is still waiting to
+// be written, it is replaced.
+void WriteCheckpointAsync(const std::string &filename,
+                          std::unique_ptr<Checkpoint> checkpoint);
+// Blocks until all checkpoints passed to WriteCheckpointAsync() have been
+// written
+void WaitForCheckpointWrites();
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_CHECKPOINT_H
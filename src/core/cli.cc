@@ -0,0 +1,296 @@
+#include "camera.h"
+#include "checkpoint.h"
+#include "distributed.h"
+#include "fileutil.h"
+#include "film.h"
+#include "imageio.h"
+#include "parallel.h"
+#include "scenes.h"
+#include "session.h"
+#include "stats.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using namespace pbrt;
+
+// Headless front end: renders one of the built-in scenes with the given
+// settings, writes the image and prints timing statistics. Nothing here
+// depends on Qt.
+
+static void Usage(const char *msg = nullptr) {
+    if (msg) fprintf(stderr, "twray_cli: %s\n\n", msg);
+    fprintf(stderr, R"(usage: twray_cli [<options>]
+Rendering options:
+  --scene <name>         Built-in scene to render (default: wineglass).
+  --list-scenes          Print the names of the built-in scenes and exit.
+  --width <n>            Image width (default: 500).
+  --height <n>           Image height (default: 500).
+  --spp <n>              Samples per pixel (default: 4).
+  --maxdepth <n>         Maximum path depth (default: 5).
+  --integrator <name>    path, volpath, directlighting, bdpt, sppm, vcm or
+                         mlt (default: path).
+  --guiding              Enable path guiding in the path integrator.
+  --param <type:name=value>
+                         Set an integrator parameter, e.g.
+                         --param string:lightsamplestrategy=restir.
+  --outfile <filename>   Image to write (default: twray.png).
+  --filter <name>        Reconstruction filter: box, gaussian, mitchell or
+                         sinc (default: box).
+  --filter-sampling      Importance sample the filter when generating camera
+                         samples instead of splatting each sample over the
+                         filter's footprint.
+  --aovs                 Also record albedo, normal, depth and primitive id
+                         (path and volpath only); they're written as layers
+                         of the output image, which must be an EXR file.
+  --denoise              Denoise the output image, guided by albedo, normal
+                         and depth with the path and volpath integrators.
+  --streaming            Write rows of the image to disk as they're finished
+                         instead of keeping the whole image in memory, for
+                         very large images (path, volpath and
+                         directlighting only; EXR output, no --aovs,
+                         --denoise or progressive passes).
+  --searchdir <dir>      Directory that scene assets are loaded from.
+Checkpoints (bdpt and sppm integrators):
+  --checkpoint <file>    Periodically save the render's state to <file>.
+  --checkpoint-interval <s>
+                         Seconds between checkpoints (default: 300).
+  --resume               Continue the render saved in the checkpoint file.
+  --merge <file>         Instead of rendering, add up the films of bdpt
+                         checkpoints of renders that took different sample
+                         ranges (--param int:samplestart=<n> and
+                         int:sampleend=<n>) and write the image; repeatable.
+Cost heatmaps (path, volpath, directlighting and bdpt integrators):
+  --heatmap <base>       Record the time, rays, BVH nodes and primitive
+                         tests spent on each pixel and tile, and write them
+                         to <base>_time.png, <base>_rays.png,
+                         <base>_nodes.png, <base>_primitives.png and
+                         <base>_tiles.csv.
+  --tile-costs <file>    Start the tiles that were slowest in the
+                         <base>_tiles.csv <file> of an earlier render first.
+Distributed rendering (path, volpath and directlighting integrators):
+  --coordinator <port>   Farm the image's tiles out to worker processes
+                         that connect on <port>.
+  --workers <n>          Number of workers to wait for before starting
+                         (default: 1).
+  --worker <host:port>   Render tiles for the coordinator at <host:port>;
+                         the render settings come from the coordinator.
+System options:
+  --nthreads <n>         Number of render threads (default: one per core).
+  --numa                 Pin threads to NUMA nodes and interleave scene data.
+  --stats                Print rendering statistics and profile.
+  --help                 Print this help text.
+)");
+    exit(msg ? 1 : 0);
+}
+
+int main(int argc, char *argv[]) {
+    RenderSettings settings;
+    std::string sceneName = "wineglass";
+    std::string searchDir;
+    bool printStats = false, heatmap = false;
+    int coordinatorPort = 0, nWorkers = 1;
+    std::vector<std::string> mergeFiles;
+    std::string workerAddress;
+
+    // Process command-line arguments
+    for (int i = 1; i < argc; ++i) {
+        auto value = [&]() -> const char * {
+            if (i + 1 == argc)
+                Usage(StringPrintf("missing value after %s", argv[i]).c_str());
+            return argv[++i];
+        };
+        if (!strcmp(argv[i], "--scene"))
+            sceneName = value();
+        else if (!strcmp(argv[i], "--list-scenes")) {
+            for (const BuiltinScene &scene : BuiltinScenes())
+                printf("%s\n", scene.name.c_str());
+            return 0;
+        } else if (!strcmp(argv[i], "--width"))
+            settings.width = atoi(value());
+        else if (!strcmp(argv[i], "--height"))
+            settings.height = atoi(value());
+        else if (!strcmp(argv[i], "--spp"))
+            settings.samplesPerPixel = atoi(value());
+        else if (!strcmp(argv[i], "--maxdepth"))
+            settings.maxDepth = atoi(value());
+        else if (!strcmp(argv[i], "--integrator"))
+            settings.integrator = value();
+        else if (!strcmp(argv[i], "--guiding"))
+            settings.pathGuiding = true;
+        else if (!strcmp(argv[i], "--param"))
+            settings.integratorParams.push_back(value());
+        else if (!strcmp(argv[i], "--outfile"))
+            settings.outputFile = value();
+        else if (!strcmp(argv[i], "--filter"))
+            settings.filter = value();
+        else if (!strcmp(argv[i], "--filter-sampling"))
+            settings.filterImportanceSampling = true;
+        else if (!strcmp(argv[i], "--aovs"))
+            settings.aovs = true;
+        else if (!strcmp(argv[i], "--denoise"))
+            settings.denoise = true;
+        else if (!strcmp(argv[i], "--streaming"))
+            settings.streaming = true;
+        else if (!strcmp(argv[i], "--searchdir"))
+            searchDir = value();
+        else if (!strcmp(argv[i], "--checkpoint"))
+            settings.integratorParams.push_back(
+                std::string("string:checkpoint=") + value());
+        else if (!strcmp(argv[i], "--checkpoint-interval"))
+            settings.integratorParams.push_back(
+                std::string("float:checkpointinterval=") + value());
+        else if (!strcmp(argv[i], "--resume"))
+            settings.integratorParams.push_back("bool:resume=true");
+        else if (!strcmp(argv[i], "--heatmap")) {
+            heatmap = true;
+            settings.integratorParams.push_back(std::string("string:heatmap=") +
+                                                value());
+        } else if (!strcmp(argv[i], "--tile-costs"))
+            settings.integratorParams.push_back(
+                std::string("string:tilecosts=") + value());
+        else if (!strcmp(argv[i], "--merge"))
+            mergeFiles.push_back(value());
+        else if (!strcmp(argv[i], "--coordinator"))
+            coordinatorPort = atoi(value());
+        else if (!strcmp(argv[i], "--workers"))
+            nWorkers = atoi(value());
+        else if (!strcmp(argv[i], "--worker"))
+            workerAddress = value();
+        else if (!strcmp(argv[i], "--nthreads"))
+            PbrtOptions.nThreads = atoi(value());
+        else if (!strcmp(argv[i], "--numa"))
+            PbrtOptions.numa = true;
+        else if (!strcmp(argv[i], "--stats"))
+            printStats = true;
+        else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+            Usage();
+        else
+            Usage(StringPrintf("argument \"%s\" unknown", argv[i]).c_str());
+    }
+    ParallelInit();
+    InitProfiler();
+    if (!searchDir.empty()) SetSearchDirectory(searchDir);
+
+    // A worker takes its settings from the coordinator
+    TileWorker worker;
+    if (!workerAddress.empty()) {
+        size_t colon = workerAddress.rfind(':');
+        if (colon == std::string::npos)
+            Usage("--worker expects <host>:<port>");
+        std::string jobLine, error;
+        if (!worker.Connect(workerAddress.substr(0, colon),
+                            atoi(workerAddress.c_str() + colon + 1),
+                            &jobLine))
+            return 1;
+        if (!ParseRenderSettings(jobLine, &settings, &sceneName, &error)) {
+            Error("Coordinator sent bad settings: %s", error.c_str());
+            return 1;
+        }
+    }
+
+    std::string settingsError;
+    if (!ValidateRenderSettings(settings, &settingsError))
+        Usage(settingsError.c_str());
+    const BuiltinScene *scene = FindBuiltinScene(sceneName);
+    if (!scene)
+        Usage(StringPrintf("scene \"%s\" unknown; see --list-scenes",
+                           sceneName.c_str()).c_str());
+    bool distributed = coordinatorPort > 0 || !workerAddress.empty();
+    if (distributed && !UsesSamplerTiles(settings))
+        Usage("distributed rendering needs a path, volpath or directlighting "
+              "integrator, without the restir strategy");
+    // The guiding structure is trained from all of a pass's samples
+    if (distributed && settings.pathGuiding)
+        Usage("path guiding isn't supported with distributed rendering");
+    // Workers only send back the tiles' image pixels
+    if (distributed && settings.aovs)
+        Usage("AOVs aren't supported with distributed rendering");
+    // The denoiser is guided by the AOVs, which remote tiles don't carry
+    if (distributed && settings.denoise)
+        Usage("--denoise isn't supported with distributed rendering");
+    if (settings.streaming && !mergeFiles.empty())
+        Usage("--streaming can't be combined with --merge");
+    // Workers don't report what their tiles cost
+    if (distributed && heatmap)
+        Usage("--heatmap isn't supported with distributed rendering");
+
+    if (!mergeFiles.empty()) {
+        // Sum the checkpointed films; the scene isn't needed
+        RenderSession session(scene->build, BuiltinSceneCamera(*scene));
+        Film *film = session.Prepare(settings)->film;
+        int64_t samplesTaken = 0;
+        for (const std::string &filename : mergeFiles) {
+            Checkpoint checkpoint;
+            std::vector<int64_t> samples;
+            if (!checkpoint.Read(filename) ||
+                !checkpoint.Get("samples", &samples) || samples.size() != 2 ||
+                !film->LoadCheckpoint(checkpoint, true)) {
+                Error("Unable to merge checkpoint \"%s\"", filename.c_str());
+                return 1;
+            }
+            samplesTaken += samples[1];
+        }
+        film->WriteImage(1.f / std::max<int64_t>(samplesTaken, 1));
+        WaitForImageWrites();
+        printf("Merged %d checkpoints with %lld samples per pixel into %s\n",
+               (int)mergeFiles.size(), (long long)samplesTaken,
+               settings.outputFile.c_str());
+        CleanupProfiler();
+        ParallelCleanup();
+        return 0;
+    }
+
+    // Build the scene and render it
+    typedef std::chrono::steady_clock Clock;
+    auto seconds = [](Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+    RenderSession session(scene->build, BuiltinSceneCamera(*scene));
+    session.Prepare(settings);
+    Clock::time_point start = Clock::now();
+    session.LoadScene();
+    double sceneSeconds = seconds(start);
+    std::shared_ptr<RenderControl> control = std::make_shared<RenderControl>();
+    if (!workerAddress.empty()) {
+        // Render tiles until the coordinator is done
+        if (!worker.Ready(MaxThreadIndex())) return 1;
+        control->tileWorker = &worker;
+        session.Render(control);
+        WaitForImageWrites();
+        WaitForCheckpointWrites();
+        CleanupProfiler();
+        ParallelCleanup();
+        return 0;
+    }
+    std::unique_ptr<TileCoordinator> coordinator;
+    if (coordinatorPort > 0) {
+        coordinator.reset(new TileCoordinator(
+            coordinatorPort, FormatRenderSettings(settings, sceneName)));
+        if (!coordinator->Listening()) return 1;
+        coordinator->WaitForWorkers(nWorkers);
+        control->tileCoordinator = coordinator.get();
+    }
+    start = Clock::now();
+    session.Render(control);
+    WaitForImageWrites();
+    WaitForCheckpointWrites();
+    double renderSeconds = seconds(start);
+
+    printf("Scene \"%s\": %dx%d, %d spp, %s integrator, %d threads\n",
+           scene->name.c_str(), settings.width, settings.height,
+           settings.samplesPerPixel, settings.integrator.c_str(),
+           MaxThreadIndex());
+    printf("Scene construction: %.3f s\n", sceneSeconds);
+    printf("Rendering:          %.3f s\n", renderSeconds);
+    printf("Wrote %s\n", settings.outputFile.c_str());
+    if (printStats) {
+        MergeWorkerThreadStats();
+        ReportThreadStats();
+        PrintStats(stdout);
+        ReportProfilerResults(stdout);
+    }
+    CleanupProfiler();
+    ParallelCleanup();
+    return 0;
+}
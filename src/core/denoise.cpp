@@ -0,0 +1,111 @@
+// core/denoise.cpp*
+#include "denoise.h"
+#include "parallel.h"
+#include "stats.h"
+
+namespace pbrt {
+
+STAT_COUNTER("Denoiser/Images denoised", nDenoisedImages);
+
+// Denoiser Local Definitions
+static constexpr int denoiseTileSize = 32;
+
+static float Distance2(const float *a, const float *b) {
+    float d0 = a[0] - b[0], d1 = a[1] - b[1], d2 = a[2] - b[2];
+    return d0 * d0 + d1 * d1 + d2 * d2;
+}
+
+// Denoiser Function Definitions
+void DenoiseImage(const float *rgb, const float *albedo, const float *normal,
+                  const float *depth, int width, int height,
+                  const DenoiseSettings &settings, float *result) {
+    ProfilePhase _(Prof::Denoise);
+    int nPixels = width * height;
+    if (nPixels == 0) return;
+
+    // Divide out the albedo, where there is one, and find the image's mean
+    // luminance to scale the color sigma by
+    std::vector<float> color(3 * nPixels), modulation(3 * nPixels);
+    double luminanceSum = 0;
+    for (int i = 0; i < nPixels; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            float a = albedo[3 * i + c];
+            modulation[3 * i + c] = a > 1e-3f ? a : 1;
+            color[3 * i + c] = rgb[3 * i + c] / modulation[3 * i + c];
+        }
+        luminanceSum += 0.2126f * color[3 * i] + 0.7152f * color[3 * i + 1] +
+                        0.0722f * color[3 * i + 2];
+    }
+    float meanLuminance = luminanceSum / nPixels;
+    if (!(meanLuminance > 0)) meanLuminance = 1;
+
+    // Apply the a-trous iterations, each reading _color_ and writing
+    // _filtered_
+    static const float kernel[5] = {1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4,
+                                    1.f / 16};
+    std::vector<float> filtered(3 * nPixels);
+    Point2i nTiles((width + denoiseTileSize - 1) / denoiseTileSize,
+                   (height + denoiseTileSize - 1) / denoiseTileSize);
+    for (int iter = 0; iter < settings.iterations; ++iter) {
+        int step = 1 << iter;
+        float sigmaColor =
+            settings.sigmaColor * meanLuminance / (float)step;
+        float invColor2 = 1 / (sigmaColor * sigmaColor);
+        float invNormal2 = 1 / (settings.sigmaNormal * settings.sigmaNormal);
+        float invAlbedo2 = 1 / (settings.sigmaAlbedo * settings.sigmaAlbedo);
+        ParallelFor2D([&](Point2i tile) {
+            int x0 = tile.x * denoiseTileSize, y0 = tile.y * denoiseTileSize;
+            int x1 = std::min(x0 + denoiseTileSize, width);
+            int y1 = std::min(y0 + denoiseTileSize, height);
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x) {
+                    int p = y * width + x;
+                    float zp = depth[p];
+                    float sum[3] = {0, 0, 0}, weightSum = 0;
+                    for (int dy = -2; dy <= 2; ++dy) {
+                        int qy = y + dy * step;
+                        if (qy < 0 || qy >= height) continue;
+                        for (int dx = -2; dx <= 2; ++dx) {
+                            int qx = x + dx * step;
+                            if (qx < 0 || qx >= width) continue;
+                            int q = qy * width + qx;
+                            // Pixels where nothing was hit only mix with
+                            // each other
+                            float zq = depth[q];
+                            float depthTerm;
+                            if (std::isinf(zp) || std::isinf(zq)) {
+                                if (std::isinf(zp) != std::isinf(zq)) continue;
+                                depthTerm = 0;
+                            } else
+                                depthTerm = std::abs(zp - zq) /
+                                            (settings.sigmaDepth *
+                                             std::max(zp, 1e-4f) * step);
+                            float w =
+                                kernel[dx + 2] * kernel[dy + 2] *
+                                std::exp(
+                                    -Distance2(&color[3 * p], &color[3 * q]) *
+                                        invColor2 -
+                                    Distance2(&normal[3 * p], &normal[3 * q]) *
+                                        invNormal2 -
+                                    Distance2(&albedo[3 * p], &albedo[3 * q]) *
+                                        invAlbedo2 -
+                                    depthTerm);
+                            for (int c = 0; c < 3; ++c)
+                                sum[c] += w * color[3 * q + c];
+                            weightSum += w;
+                        }
+                    }
+                    // The center pixel always has a positive weight
+                    for (int c = 0; c < 3; ++c)
+                        filtered[3 * p + c] = sum[c] / weightSum;
+                }
+        }, nTiles);
+        std::swap(color, filtered);
+    }
+
+    // Put the albedo back
+    for (int i = 0; i < 3 * nPixels; ++i) result[i] = color[i] * modulation[i];
+    ++nDenoisedImages;
+}
+
+}  // namespace pbrt
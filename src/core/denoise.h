@@ -0,0 +1,39 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+// core/denoise.h*
+#include "pbrt.h"
+
+namespace pbrt {
+
+// Denoiser Declarations
+
+// Parameters of DenoiseImage(). The sigmas set how quickly a neighbor's
+// weight falls off as its features differ from the center pixel's.
+struct DenoiseSettings {
+    // Each iteration doubles the filter's footprint; five iterations cover
+    // a 125x125 pixel neighborhood
+    int iterations = 5;
+    // Relative to the image's mean luminance; halved with every iteration,
+    // since each one leaves less noise to remove
+    float sigmaColor = 1.f;
+    float sigmaNormal = 0.3f;
+    // Relative to the center pixel's depth
+    float sigmaDepth = 0.05f;
+    float sigmaAlbedo = 0.1f;
+};
+
+// Denoises an RGB image with the edge-avoiding a-trous wavelet filter of
+// Dammertz et al. (2010), guided by albedo and normal images (3 channels
+// per pixel) and a depth image (1 channel). Pixels where nothing was hit
+// have zero albedo and normal and infinite depth. The color is divided by
+// the albedo before filtering and multiplied back afterwards, so that
+// texture detail isn't blurred. Each iteration is run in parallel over
+// tiles of the image. _rgb_ may be the same as _result_.
+void DenoiseImage(const float *rgb, const float *albedo, const float *normal,
+                  const float *depth, int width, int height,
+                  const DenoiseSettings &settings, float *result);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_DENOISE_H
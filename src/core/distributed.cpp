@@ -0,0 +1,312 @@
+// core/distributed.cpp*
+#include "distributed.h"
+#include "netutil.h"
+#include "stats.h"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <type_traits>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace pbrt {
+
+STAT_COUNTER("Distributed/Tiles rendered remotely", nRemoteTiles);
+STAT_COUNTER("Distributed/Tiles reassigned", nReassignedTiles);
+STAT_COUNTER("Distributed/Workers lost", nLostWorkers);
+
+// Distributed Local Definitions
+// How a FilmTilePixel is sent: its spectrum's samples followed by its
+// filter weight sum. FilmTilePixel itself isn't trivially copyable, so it
+// is converted to and from this field by field.
+struct WireTilePixel {
+    float contribSum[Spectrum::nSamples];
+    float filterWeightSum;
+};
+static_assert(std::is_trivially_copyable<WireTilePixel>::value,
+              "WireTilePixel must be trivially copyable");
+
+// Distributed Rendering Local Definitions
+static void DisableNagle(int fd) {
+    // Tile assignments are small and latency sensitive
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// TileCoordinator Method Definitions
+TileCoordinator::TileCoordinator(int port, const std::string &jobLine)
+    : jobLine(jobLine) {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        Error("Unable to create socket: %s", strerror(errno));
+        return;
+    }
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd, 64) != 0) {
+        Error("Unable to listen on port %d: %s", port, strerror(errno));
+        close(listenFd);
+        listenFd = -1;
+        return;
+    }
+    LOG(INFO) << "Waiting for tile workers on port " << port;
+}
+
+TileCoordinator::~TileCoordinator() {
+    // Closing the connections tells the workers that the render is over
+    for (Worker &worker : workers) close(worker.fd);
+    if (listenFd >= 0) close(listenFd);
+}
+
+int TileCoordinator::ReadyWorkers() const {
+    int n = 0;
+    for (const Worker &worker : workers) n += worker.nThreads > 0;
+    return n;
+}
+
+void TileCoordinator::WaitForWorkers(int nWorkers) {
+    while (ReadyWorkers() < nWorkers) Poll(1000, nullptr, nullptr);
+}
+
+std::vector<TileJob> TileCoordinator::RenderTiles(
+    std::vector<TileJob> jobs, Film *film,
+    const std::function<void(const TileJob &, std::unique_ptr<FilmTile>)>
+        &tileDone,
+    const std::atomic<bool> &cancelled) {
+    pending.assign(jobs.begin(), jobs.end());
+    size_t remaining = jobs.size();
+    auto jobDone = [&](const TileJob &job, std::unique_ptr<FilmTile> tile) {
+        --remaining;
+        ++nRemoteTiles;
+        tileDone(job, std::move(tile));
+    };
+    while (remaining > 0 && !workers.empty() && !cancelled) {
+        // Keep two tiles per thread in flight on each ready worker; a
+        // failed send is noticed by _Poll()_ as a disconnect
+        for (Worker &worker : workers)
+            while (worker.nThreads > 0 && !pending.empty() &&
+                   (int)worker.inFlight.size() < 2 * worker.nThreads) {
+                TileJob job = pending.front();
+                job.serial = nextSerial++;
+                const Bounds2i &b = job.tile.bounds;
+                if (!SendLine(worker.fd,
+                              StringPrintf("tile %llu %d %d %d %d %d %lld %lld",
+                                           (unsigned long long)job.serial,
+                                           job.seed, b.pMin.x, b.pMin.y,
+                                           b.pMax.x, b.pMax.y,
+                                           (long long)job.sampleStart,
+                                           (long long)job.sampleEnd)))
+                    break;
+                pending.pop_front();
+                worker.inFlight[job.serial] = job;
+            }
+        Poll(100, film, jobDone);
+    }
+
+    // Hand back whatever is left; results for tiles still in flight will
+    // be ignored when they arrive
+    for (Worker &worker : workers) worker.inFlight.clear();
+    std::vector<TileJob> unfinished(pending.begin(), pending.end());
+    pending.clear();
+    return unfinished;
+}
+
+void TileCoordinator::Poll(
+    int timeoutMs, Film *film,
+    const std::function<void(const TileJob &, std::unique_ptr<FilmTile>)>
+        &tileDone) {
+    std::vector<pollfd> fds(workers.size() + 1);
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        fds[i + 1].fd = workers[i].fd;
+        fds[i + 1].events = POLLIN;
+    }
+    if (poll(fds.data(), fds.size(), timeoutMs) <= 0) return;
+
+    // Go backwards, since _Disconnect()_ removes the worker
+    for (size_t i = workers.size(); i-- > 0;)
+        if (fds[i + 1].revents != 0 &&
+            !ReceiveMessages(workers[i], film, tileDone))
+            Disconnect(i);
+
+    if (fds[0].revents & POLLIN) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) return;
+        DisableNagle(fd);
+        if (!SendLine(fd, jobLine)) {
+            close(fd);
+            return;
+        }
+        LOG(INFO) << "Tile worker connected";
+        workers.push_back(Worker{fd});
+    }
+}
+
+bool TileCoordinator::ReceiveMessages(
+    Worker &worker, Film *film,
+    const std::function<void(const TileJob &, std::unique_ptr<FilmTile>)>
+        &tileDone) {
+    char data[65536];
+    ssize_t n = recv(worker.fd, data, sizeof(data), 0);
+    if (n < 0 && errno == EINTR) return true;
+    if (n <= 0) return false;
+    worker.buffer.append(data, n);
+
+    // Handle all complete messages in the buffer
+    while (true) {
+        size_t eol = worker.buffer.find('\n');
+        if (eol == std::string::npos) return true;
+        std::istringstream header(worker.buffer.substr(0, eol));
+        std::string type;
+        header >> type;
+        if (type == "ready") {
+            header >> worker.nThreads;
+            worker.buffer.erase(0, eol + 1);
+            if (worker.nThreads <= 0) return false;
+            LOG(INFO) << "Tile worker ready with " << worker.nThreads
+                      << " threads";
+            continue;
+        }
+        uint64_t serial;
+        size_t bytes;
+        header >> serial >> bytes;
+        if (type != "tile" || !header) {
+            Warning("Malformed message from tile worker");
+            return false;
+        }
+        if (worker.buffer.size() < eol + 1 + bytes) return true;
+
+        // Results for jobs that are no longer in flight are dropped
+        auto iter = worker.inFlight.find(serial);
+        if (iter != worker.inFlight.end()) {
+            TileJob job = iter->second;
+            worker.inFlight.erase(iter);
+            std::unique_ptr<FilmTile> tile = film->GetFilmTile(job.tile.bounds);
+            std::vector<FilmTilePixel> &pixels = tile->GetPixels();
+            if (bytes != pixels.size() * sizeof(WireTilePixel)) {
+                Warning("Tile worker sent %zu bytes for a tile of %zu pixels",
+                        bytes, pixels.size());
+                pending.push_front(job);
+                return false;
+            }
+            const char *data = worker.buffer.data() + eol + 1;
+            for (size_t i = 0; i < pixels.size(); ++i) {
+                WireTilePixel wire;
+                memcpy(&wire, data + i * sizeof(WireTilePixel),
+                       sizeof(WireTilePixel));
+                for (int c = 0; c < Spectrum::nSamples; ++c)
+                    pixels[i].contribSum[c] = wire.contribSum[c];
+                pixels[i].filterWeightSum = wire.filterWeightSum;
+            }
+            tileDone(job, std::move(tile));
+        }
+        worker.buffer.erase(0, eol + 1 + bytes);
+    }
+}
+
+void TileCoordinator::Disconnect(size_t index) {
+    Worker &worker = workers[index];
+    if (!worker.inFlight.empty())
+        Warning("Tile worker lost; reassigning its %zu tiles",
+                worker.inFlight.size());
+    // Reassigned tiles are the oldest ones, so they go first
+    for (auto iter = worker.inFlight.rbegin(); iter != worker.inFlight.rend();
+         ++iter) {
+        pending.push_front(iter->second);
+        ++nReassignedTiles;
+    }
+    ++nLostWorkers;
+    close(worker.fd);
+    workers.erase(workers.begin() + index);
+}
+
+// TileWorker Method Definitions
+TileWorker::~TileWorker() {
+    if (fd >= 0) close(fd);
+}
+
+bool TileWorker::Connect(const std::string &host, int port,
+                         std::string *jobLine) {
+    addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                          &addresses);
+    if (err != 0) {
+        Error("Unable to resolve \"%s\": %s", host.c_str(),
+              gai_strerror(err));
+        return false;
+    }
+    for (addrinfo *a = addresses; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        Error("Unable to connect to %s:%d: %s", host.c_str(), port,
+              strerror(errno));
+        return false;
+    }
+    DisableNagle(fd);
+    return ReceiveLine(fd, jobLine);
+}
+
+bool TileWorker::Ready(int nThreads) {
+    return SendLine(fd, StringPrintf("ready %d", nThreads));
+}
+
+bool TileWorker::NextTile(TileJob *job) {
+    std::string line;
+    {
+        std::lock_guard<std::mutex> lock(receiveMutex);
+        if (!ReceiveLine(fd, &line)) return false;
+    }
+    std::istringstream tokens(line);
+    std::string type;
+    unsigned long long serial;
+    long long sampleStart, sampleEnd;
+    Bounds2i &b = job->tile.bounds;
+    tokens >> type >> serial >> job->seed >> b.pMin.x >> b.pMin.y >> b.pMax.x >>
+        b.pMax.y >> sampleStart >> sampleEnd;
+    if (type != "tile" || !tokens) {
+        Error("Malformed tile assignment \"%s\"", line.c_str());
+        return false;
+    }
+    job->tile.id = 0;
+    job->serial = serial;
+    job->sampleStart = sampleStart;
+    job->sampleEnd = sampleEnd;
+    return true;
+}
+
+bool TileWorker::SendTile(const TileJob &job, FilmTile &tile) {
+    const std::vector<FilmTilePixel> &pixels = tile.GetPixels();
+    std::vector<WireTilePixel> wire(pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        for (int c = 0; c < Spectrum::nSamples; ++c)
+            wire[i].contribSum[c] = pixels[i].contribSum[c];
+        wire[i].filterWeightSum = pixels[i].filterWeightSum;
+    }
+    size_t bytes = wire.size() * sizeof(WireTilePixel);
+    std::lock_guard<std::mutex> lock(sendMutex);
+    return SendLine(fd, StringPrintf("tile %llu %zu",
+                                     (unsigned long long)job.serial, bytes)) &&
+           SendAll(fd, wire.data(), bytes);
+}
+
+}  // namespace pbrt
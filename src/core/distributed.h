@@ -0,0 +1,119 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+// core/distributed.h*
+#include "pbrt.h"
+#include "film.h"
+#include "tilescheduler.h"
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+
+namespace pbrt {
+
+// Distributed Rendering Declarations
+
+// One tile of one pass, as sent to a worker process
+struct TileJob {
+    ScheduledTile tile;
+    // Seed for the tile's sampler; unique across the passes of a render
+    int seed;
+    // Range of sample indices to take in each pixel
+    int64_t sampleStart, sampleEnd;
+    // Identifies the assignment on the wire, so that results that arrive
+    // after a job was reassigned or cancelled can be told apart
+    uint64_t serial;
+};
+
+// Farms the tiles of a SamplerIntegrator render out to worker processes
+// over TCP. Each worker is sent the render settings when it connects,
+// builds the scene and then renders the tiles it is assigned, returning
+// their FilmTile pixels. Tiles are handed out on demand, keeping two per
+// worker thread in flight, so faster workers take more of the image.
+// Workers may join at any time; the tiles of a worker that disconnects
+// are given to the others.
+//
+// The protocol is line based; the coordinator sends
+//
+//   <job line>                         once, see ParseRenderSettings()
+//   tile <serial> <seed> <x0> <y0> <x1> <y1> <sample start> <sample end>
+//
+// and a worker replies
+//
+//   ready <threads>                    once its scene has been built
+//   tile <serial> <bytes>              followed by the tile's pixels,
+//                                      each as its spectrum's samples and
+//                                      filter weight sum (native floats)
+class TileCoordinator {
+  public:
+    // TileCoordinator Public Methods
+    TileCoordinator(int port, const std::string &jobLine);
+    ~TileCoordinator();
+    bool Listening() const { return listenFd >= 0; }
+    // Blocks until _nWorkers_ workers are ready to render
+    void WaitForWorkers(int nWorkers);
+    // Renders _jobs_ on the workers, calling _tileDone_ for each finished
+    // tile. Returns the jobs that couldn't be rendered because every
+    // worker went away, or that weren't started because _cancelled_ was
+    // set.
+    std::vector<TileJob> RenderTiles(
+        std::vector<TileJob> jobs, Film *film,
+        const std::function<void(const TileJob &,
+                                 std::unique_ptr<FilmTile>)> &tileDone,
+        const std::atomic<bool> &cancelled);
+
+  private:
+    // TileCoordinator Private Declarations
+    struct Worker {
+        int fd;
+        int nThreads = 0;
+        // Bytes received but not yet parsed
+        std::string buffer;
+        std::map<uint64_t, TileJob> inFlight;
+    };
+
+    // TileCoordinator Private Methods
+    void Poll(int timeoutMs, Film *film,
+              const std::function<void(const TileJob &,
+                                       std::unique_ptr<FilmTile>)> &tileDone);
+    bool ReceiveMessages(Worker &worker, Film *film,
+                         const std::function<void(
+                             const TileJob &, std::unique_ptr<FilmTile>)>
+                             &tileDone);
+    void Disconnect(size_t index);
+    int ReadyWorkers() const;
+
+    // TileCoordinator Private Data
+    int listenFd = -1;
+    const std::string jobLine;
+    std::vector<Worker> workers;
+    // Jobs waiting for a worker; reassigned jobs go to the front
+    std::deque<TileJob> pending;
+    uint64_t nextSerial = 0;
+};
+
+// The worker side of TileCoordinator. Several render threads call
+// NextTile() and SendTile() concurrently.
+class TileWorker {
+  public:
+    // TileWorker Public Methods
+    ~TileWorker();
+    // Connects to the coordinator and receives the job line
+    bool Connect(const std::string &host, int port, std::string *jobLine);
+    // Tells the coordinator that tiles can be sent
+    bool Ready(int nThreads);
+    // Blocks until the next tile arrives; returns false once the
+    // coordinator has closed the connection
+    bool NextTile(TileJob *job);
+    bool SendTile(const TileJob &job, FilmTile &tile);
+
+  private:
+    // TileWorker Private Data
+    int fd = -1;
+    std::mutex receiveMutex, sendMutex;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_DISTRIBUTED_H
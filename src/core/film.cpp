@@ -1,5 +1,8 @@
 // core/film.cpp*
 #include "film.h"
+#include "checkpoint.h"
+#include "denoise.h"
+#include "fileutil.h"
 #include "paramset.h"
 #include "imageio.h"
 #include "stats.h"
@@ -7,17 +10,27 @@
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Film pixels", filmPixelMemory);
+STAT_MEMORY_COUNTER("Memory/Film AOV pixels", aovPixelMemory);
+STAT_COUNTER("Film/Rows streamed to disk", nStreamedRows);
+STAT_INT_DISTRIBUTION("Film/Resident rows while streaming", residentRows);
+STAT_COUNTER("Film/Splat blocks allocated", nSplatBlocksAllocated);
+STAT_COUNTER("Film/Splats added directly to pixels", nDirectSplats);
 
 // Film Method Definitions
 Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
            std::unique_ptr<Filter> filt, float diagonal,
-           const std::string &filename, float scale, float maxSampleLuminance)
+           const std::string &filename, float scale, float maxSampleLuminance,
+           bool filterImportanceSampling, bool aovs, bool denoise,
+           bool streaming)
     : fullResolution(resolution),
       diagonal(diagonal * .001),
       filter(std::move(filt)),
       filename(filename),
       scale(scale),
-      maxSampleLuminance(maxSampleLuminance) {
+      maxSampleLuminance(maxSampleLuminance),
+      writeAOVs(aovs),
+      denoise(denoise),
+      streaming(streaming) {
     // Compute film image bounds
     croppedPixelBounds =
         Bounds2i(Point2i(std::ceil(fullResolution.x * cropWindow.pMin.x),
@@ -28,9 +41,32 @@ Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
         ". Crop window of " << cropWindow << " -> croppedPixelBounds " <<
         croppedPixelBounds;
 
-    // Allocate film image storage
-    pixels = std::unique_ptr<Pixel[]>(new Pixel[croppedPixelBounds.Area()]);
-    filmPixelMemory += croppedPixelBounds.Area() * sizeof(Pixel);
+    // Allocate film image storage; streaming films allocate rows as tiles
+    // reach them
+    if (streaming) {
+        CHECK(!aovs && !denoise);
+        rows.resize(croppedPixelBounds.pMax.y - croppedPixelBounds.pMin.y);
+    } else {
+        pixels.reset(new Pixel[croppedPixelBounds.Area()]);
+        filmPixelMemory += croppedPixelBounds.Area() * sizeof(Pixel);
+    }
+    if (aovs || denoise) {
+        aovPixels.reset(new AOVPixel[croppedPixelBounds.Area()]);
+        aovPixelMemory += croppedPixelBounds.Area() * sizeof(AOVPixel);
+    }
+    Vector2i extent = croppedPixelBounds.Diagonal();
+    nSplatBlocks = Vector2i((extent.x + splatBlockSize - 1) / splatBlockSize,
+                            (extent.y + splatBlockSize - 1) / splatBlockSize);
+    nLockBlocks = Vector2i((extent.x + lockBlockSize - 1) / lockBlockSize,
+                           (extent.y + lockBlockSize - 1) / lockBlockSize);
+    blockMutexes.reset(new std::mutex[nLockBlocks.x * nLockBlocks.y]);
+    threadSplatBlocks.resize(MaxThreadIndex());
+    for (auto &blocks : threadSplatBlocks)
+        blocks.resize(nSplatBlocks.x * nSplatBlocks.y);
+    maxSplatBlocks = 4 * nSplatBlocks.x * nSplatBlocks.y;
+
+    if (filterImportanceSampling)
+        filterSampler.reset(new FilterSampler(*filter));
 
     // Precompute filter weight table
     int offset = 0;
@@ -45,6 +81,10 @@ Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
 }
 
 Bounds2i Film::GetSampleBounds() const {
+    // Importance sampled filters take samples for the film's pixels only;
+    // otherwise pixels outside the film receive samples too, so that those
+    // near the edges get their share of the filter's footprint.
+    if (filterSampler) return croppedPixelBounds;
     Bounds2f floatBounds(Floor(Point2f(croppedPixelBounds.pMin) +
                                Vector2f(0.5f, 0.5f) - filter->radius),
                          Ceil(Point2f(croppedPixelBounds.pMax) -
@@ -59,55 +99,210 @@ Bounds2f Film::GetPhysicalExtent() const {
     return Bounds2f(Point2f(-x / 2, -y / 2), Point2f(x / 2, y / 2));
 }
 
-std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds) {
+Bounds2i Film::TilePixelBounds(const Bounds2i &sampleBounds) const {
+    // Samples of an importance sampled filter only touch their own pixel,
+    // so tiles don't overlap
+    if (filterSampler) return Intersect(sampleBounds, croppedPixelBounds);
     // Bound image pixels that samples in _sampleBounds_ contribute to
     Vector2f halfPixel = Vector2f(0.5f, 0.5f);
     Bounds2f floatBounds = (Bounds2f)sampleBounds;
     Point2i p0 = (Point2i)Ceil(floatBounds.pMin - halfPixel - filter->radius);
     Point2i p1 = (Point2i)Floor(floatBounds.pMax - halfPixel + filter->radius) +
                  Point2i(1, 1);
-    Bounds2i tilePixelBounds = Intersect(Bounds2i(p0, p1), croppedPixelBounds);
+    return Intersect(Bounds2i(p0, p1), croppedPixelBounds);
+}
+
+std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds) {
     return std::unique_ptr<FilmTile>(new FilmTile(
-        tilePixelBounds, filter->radius, filterTable, filterTableWidth,
-        maxSampleLuminance));
+        TilePixelBounds(sampleBounds), filter->radius, filterTable,
+        filterTableWidth, maxSampleLuminance, filterSampler != nullptr,
+        HasAOVs()));
+}
+
+void Film::BeginStreaming(const std::vector<Bounds2i> &tileSampleBounds) {
+    CHECK(streaming);
+    std::lock_guard<std::mutex> lock(streamMutex);
+    int nRows = rows.size();
+    pendingTiles.assign(nRows, 0);
+    for (const Bounds2i &sampleBounds : tileSampleBounds) {
+        Bounds2i b = TilePixelBounds(sampleBounds);
+        if (b.pMin.x >= b.pMax.x) continue;
+        for (int y = b.pMin.y; y < b.pMax.y; ++y)
+            ++pendingTiles[y - croppedPixelBounds.pMin.y];
+    }
+    nextStreamRow = 0;
+    LOG(INFO) << "Streaming image " << filename << " with bounds " <<
+        croppedPixelBounds;
+    streamWriter.reset(new StreamingImageWriter(filename, croppedPixelBounds,
+                                                fullResolution));
+    // Rows that no tile touches can be written right away
+    FlushStreamRows(false);
+}
+
+void Film::FlushStreamRows(bool finish) {
+    int nRows = rows.size();
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    std::vector<float> rgb;
+    while (nextStreamRow < nRows &&
+           (finish || pendingTiles[nextStreamRow] == 0)) {
+        // Rows that no tile reached are black
+        std::unique_ptr<Pixel[]> &row = rows[nextStreamRow];
+        rgb.resize(3 * width);
+        if (row)
+            ResolvePixels(row.get(), width, 1, rgb.data());
+        else
+            std::fill(rgb.begin(), rgb.end(), 0.f);
+        if (streamWriter) streamWriter->WriteRows(rgb.data(), 1);
+        row.reset();
+        ++nextStreamRow;
+        ++nStreamedRows;
+    }
 }
 
 void Film::Clear() {
+    if (streaming) {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        for (std::unique_ptr<Pixel[]> &row : rows) row.reset();
+        pendingTiles.clear();
+        nextStreamRow = 0;
+        streamWriter.reset();
+        return;
+    }
     for (Point2i p : croppedPixelBounds) {
         Pixel &pixel = GetPixel(p);
         for (int c = 0; c < 3; ++c)
             pixel.splatXYZ[c] = pixel.xyz[c] = 0;
         pixel.filterWeightSum = 0;
     }
+    if (aovPixels)
+        std::fill(aovPixels.get(), aovPixels.get() + croppedPixelBounds.Area(),
+                  AOVPixel());
+    ClearSplatBlocks();
+}
+
+void Film::ClearSplatBlocks() {
+    for (auto &blocks : threadSplatBlocks)
+        for (auto &block : blocks) block.reset();
+    nSplatBlocksInUse = 0;
+    splatBlocks0Owner = std::thread::id();
+}
+
+Film::SplatBlock *Film::ThreadSplatBlock(int blockIndex) {
+    // The pool may have been restarted with more threads since the film
+    // was created
+    if (ThreadIndex >= (int)threadSplatBlocks.size()) return nullptr;
+    if (ThreadIndex == 0) {
+        // Claim thread 0's blocks unless another thread already has
+        std::thread::id self = std::this_thread::get_id();
+        std::thread::id owner = splatBlocks0Owner.load();
+        if (owner != self &&
+            (owner != std::thread::id() ||
+             !splatBlocks0Owner.compare_exchange_strong(owner, self)))
+            return nullptr;
+    }
+    std::unique_ptr<SplatBlock> &block =
+        threadSplatBlocks[ThreadIndex][blockIndex];
+    if (!block) {
+        if (nSplatBlocksInUse++ >= maxSplatBlocks) {
+            --nSplatBlocksInUse;
+            return nullptr;
+        }
+        block.reset(new SplatBlock());
+        ++nSplatBlocksAllocated;
+    }
+    return block.get();
+}
+
+template <typename Func>
+void Film::ForEachLockedBlock(const Bounds2i &bounds, Func func) {
+    // Visit the lock blocks overlapping _bounds_ one at a time, holding
+    // only the current block's lock while _func_ runs on its pixels
+    Bounds2i b = Intersect(bounds, croppedPixelBounds);
+    if (b.pMin.x >= b.pMax.x || b.pMin.y >= b.pMax.y) return;
+    Point2i pMin = croppedPixelBounds.pMin;
+    Point2i b0((b.pMin.x - pMin.x) / lockBlockSize,
+               (b.pMin.y - pMin.y) / lockBlockSize);
+    Point2i b1((b.pMax.x - 1 - pMin.x) / lockBlockSize,
+               (b.pMax.y - 1 - pMin.y) / lockBlockSize);
+    for (int by = b0.y; by <= b1.y; ++by)
+        for (int bx = b0.x; bx <= b1.x; ++bx) {
+            Point2i pBlock =
+                pMin + Vector2i(bx * lockBlockSize, by * lockBlockSize);
+            Bounds2i blockBounds = Intersect(
+                Bounds2i(pBlock,
+                         pBlock + Vector2i(lockBlockSize, lockBlockSize)),
+                b);
+            std::lock_guard<std::mutex> lock(
+                blockMutexes[by * nLockBlocks.x + bx]);
+            func(blockBounds);
+        }
 }
 
 void Film::MergeFilmTile(std::unique_ptr<FilmTile> tile) {
     ProfilePhase p(Prof::MergeFilmTile);
     VLOG(1) << "Merging film tile " << tile->pixelBounds;
-    std::lock_guard<std::mutex> lock(mutex);
-    for (Point2i pixel : tile->GetPixelBounds()) {
-        // Merge _pixel_ into _Film::pixels_
-        const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
-        Pixel &mergePixel = GetPixel(pixel);
-        float xyz[3];
-        tilePixel.contribSum.ToXYZ(xyz);
-        for (int i = 0; i < 3; ++i) mergePixel.xyz[i] += xyz[i];
-        mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+    const Bounds2i &tileBounds = tile->GetPixelBounds();
+    if (streaming && tileBounds.pMin.x < tileBounds.pMax.x) {
+        // Allocate the rows the tile touches that no other tile has yet
+        std::lock_guard<std::mutex> lock(streamMutex);
+        int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+        for (int y = tileBounds.pMin.y; y < tileBounds.pMax.y; ++y) {
+            std::unique_ptr<Pixel[]> &row = rows[y - croppedPixelBounds.pMin.y];
+            if (!row) {
+                row.reset(new Pixel[width]);
+                filmPixelMemory += width * sizeof(Pixel);
+            }
+        }
     }
-}
+    ForEachLockedBlock(tile->GetPixelBounds(), [&](const Bounds2i &bounds) {
+        for (Point2i pixel : bounds) {
+            // Merge _pixel_ into _Film::pixels_
+            const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
+            Pixel &mergePixel = GetPixel(pixel);
+            float xyz[3];
+            tilePixel.contribSum.ToXYZ(xyz);
+            for (int i = 0; i < 3; ++i) mergePixel.xyz[i] += xyz[i];
+            mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+            if (aovPixels && !tile->aovPixels.empty())
+                aovPixels[&mergePixel - pixels.get()].Merge(
+                    tile->aovPixels[tile->PixelOffset(pixel)]);
+        }
+    });
 
-void Film::SetImage(const Spectrum *img) const {
-    int nPixels = croppedPixelBounds.Area();
-    for (int i = 0; i < nPixels; ++i) {
-        Pixel &p = pixels[i];
-        img[i].ToXYZ(p.xyz);
-        p.filterWeightSum = 1;
-        p.splatXYZ[0] = p.splatXYZ[1] = p.splatXYZ[2] = 0;
+    if (streaming && tileBounds.pMin.x < tileBounds.pMax.x) {
+        // Write the rows that this was the last tile to touch, as long as
+        // all the rows above them have been written
+        std::lock_guard<std::mutex> lock(streamMutex);
+        if (pendingTiles.empty()) return;
+        for (int y = tileBounds.pMin.y; y < tileBounds.pMax.y; ++y)
+            --pendingTiles[y - croppedPixelBounds.pMin.y];
+        FlushStreamRows(false);
+        int nResident = 0;
+        for (const std::unique_ptr<Pixel[]> &row : rows)
+            if (row) ++nResident;
+        ReportValue(residentRows, nResident);
     }
 }
 
+void Film::SetImage(const Spectrum *img) {
+    CHECK(!streaming);
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    ForEachLockedBlock(croppedPixelBounds, [&](const Bounds2i &bounds) {
+        for (Point2i pixel : bounds) {
+            int offset = (pixel.x - croppedPixelBounds.pMin.x) +
+                         (pixel.y - croppedPixelBounds.pMin.y) * width;
+            Pixel &p = GetPixel(pixel);
+            img[offset].ToXYZ(p.xyz);
+            p.filterWeightSum = 1;
+            p.splatXYZ[0] = p.splatXYZ[1] = p.splatXYZ[2] = 0;
+        }
+    });
+    ClearSplatBlocks();
+}
+
 void Film::AddSplat(const Point2f &p, Spectrum v) {
     ProfilePhase pp(Prof::SplatFilm);
+    CHECK(!streaming);
 
     if (v.HasNaNs()) {
         LOG(ERROR) << StringPrintf("Ignoring splatted spectrum with NaN values "
@@ -129,52 +324,251 @@ void Film::AddSplat(const Point2f &p, Spectrum v) {
         v *= maxSampleLuminance / v.y();
     float xyz[3];
     v.ToXYZ(xyz);
-    Pixel &pixel = GetPixel(pi);
-    for (int i = 0; i < 3; ++i) pixel.splatXYZ[i].Add(xyz[i]);
+
+    // Add splat to this thread's block containing _pi_
+    Vector2i offset = pi - croppedPixelBounds.pMin;
+    int blockIndex = (offset.y / splatBlockSize) * nSplatBlocks.x +
+                     offset.x / splatBlockSize;
+    SplatBlock *block = ThreadSplatBlock(blockIndex);
+    if (!block) {
+        Pixel &pixel = GetPixel(pi);
+        for (int i = 0; i < 3; ++i) pixel.splatXYZ[i].Add(xyz[i]);
+        ++nDirectSplats;
+        return;
+    }
+    float *blockXYZ = block->xyz[(offset.y % splatBlockSize) * splatBlockSize +
+                                 offset.x % splatBlockSize];
+    for (int i = 0; i < 3; ++i) blockXYZ[i] += xyz[i];
 }
 
-void Film::WriteImage(float splatScale) {
-    // Convert image to RGB and compute final pixel values
-    LOG(INFO) <<
-        "Converting image to RGB and computing final weighted pixel values";
-    std::unique_ptr<float[]> rgb(new float[3 * croppedPixelBounds.Area()]);
-    int offset = 0;
-    for (Point2i p : croppedPixelBounds) {
-        // Convert pixel XYZ color to RGB
-        Pixel &pixel = GetPixel(p);
-        XYZToRGB(pixel.xyz, &rgb[3 * offset]);
+void Film::ResolveSplats() {
+    ProfilePhase pp(Prof::SplatFilm);
+    if (streaming) return;
+    // Each block of pixels is only written by the task resolving it, so
+    // the threads' buffered splats can be summed without contention
+    ParallelFor([&](int64_t blockIndex) {
+        Point2i pBlock = croppedPixelBounds.pMin +
+                         Vector2i(blockIndex % nSplatBlocks.x,
+                                  blockIndex / nSplatBlocks.x) *
+                             splatBlockSize;
+        Bounds2i blockBounds =
+            Intersect(Bounds2i(pBlock, pBlock + Vector2i(splatBlockSize,
+                                                         splatBlockSize)),
+                      croppedPixelBounds);
+        for (auto &blocks : threadSplatBlocks) {
+            std::unique_ptr<SplatBlock> &block = blocks[blockIndex];
+            if (!block) continue;
+            for (Point2i p : blockBounds) {
+                Vector2i offset = p - pBlock;
+                const float *blockXYZ =
+                    block->xyz[offset.y * splatBlockSize + offset.x];
+                Pixel &pixel = GetPixel(p);
+                for (int i = 0; i < 3; ++i)
+                    if (blockXYZ[i] != 0) pixel.splatXYZ[i].Add(blockXYZ[i]);
+            }
+            block.reset();
+            --nSplatBlocksInUse;
+        }
+    }, nSplatBlocks.x * nSplatBlocks.y, 1);
+    splatBlocks0Owner = std::thread::id();
+}
 
-        // Normalize pixel with weight sum
-        float filterWeightSum = pixel.filterWeightSum;
-        if (filterWeightSum != 0) {
-            float invWt = (float)1 / filterWeightSum;
-            rgb[3 * offset] = std::max((float)0, rgb[3 * offset] * invWt);
-            rgb[3 * offset + 1] =
-                std::max((float)0, rgb[3 * offset + 1] * invWt);
-            rgb[3 * offset + 2] =
-                std::max((float)0, rgb[3 * offset + 2] * invWt);
+void Film::GetRGB(float *rgb, float splatScale) {
+    // Convert image to RGB and compute final pixel values. The block locks
+    // keep snapshots taken while rendering from seeing a half-merged lock
+    // block, but not a half-merged tile: a tile spanning several blocks
+    // may already be merged into some of them and not yet into others,
+    // which at worst makes a preview show part of a tile one pass behind.
+    // Each lock block is resolved independently, so the blocks are
+    // converted in parallel.
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    if (streaming) {
+        // The rows that have been written are gone
+        static bool warned = false;
+        if (!warned) {
+            Warning("The image of a streaming film can't be read back");
+            warned = true;
         }
+        std::fill(rgb, rgb + 3 * croppedPixelBounds.Area(), 0.f);
+        return;
+    }
+    ParallelFor([&](int64_t blockIndex) {
+        Point2i pBlock = croppedPixelBounds.pMin +
+                         Vector2i(blockIndex % nLockBlocks.x,
+                                  blockIndex / nLockBlocks.x) *
+                             lockBlockSize;
+        Bounds2i blockBounds(pBlock,
+                             pBlock + Vector2i(lockBlockSize, lockBlockSize));
+        ForEachLockedBlock(blockBounds, [&](const Bounds2i &bounds) {
+            for (int y = bounds.pMin.y; y < bounds.pMax.y; ++y) {
+                int rowOffset = (bounds.pMin.x - croppedPixelBounds.pMin.x) +
+                                (y - croppedPixelBounds.pMin.y) * width;
+                const Pixel *row = &GetPixel(Point2i(bounds.pMin.x, y));
+                ResolvePixels(row, bounds.pMax.x - bounds.pMin.x, splatScale,
+                              &rgb[3 * rowOffset]);
+            }
+        });
+    }, nLockBlocks.x * nLockBlocks.y, 4);
+}
 
-        // Add splat value at pixel
-        float splatRGB[3];
-        float splatXYZ[3] = {pixel.splatXYZ[0], pixel.splatXYZ[1],
-                             pixel.splatXYZ[2]};
+void Film::ResolvePixels(const Pixel *pixels, int n, float splatScale,
+                         float *rgb) const {
+    // Convert a run of pixels to RGB without branches, so that the
+    // compiler can vectorize the loop
+    for (int i = 0; i < n; ++i) {
+        const Pixel &pixel = pixels[i];
+        float xyz[3], splatXYZ[3];
+        for (int c = 0; c < 3; ++c) {
+            xyz[c] = pixel.xyz[c];
+            splatXYZ[c] = pixel.splatXYZ[c];
+        }
+        float pixelRGB[3], splatRGB[3];
+        XYZToRGB(xyz, pixelRGB);
         XYZToRGB(splatXYZ, splatRGB);
-        rgb[3 * offset] += splatScale * splatRGB[0];
-        rgb[3 * offset + 1] += splatScale * splatRGB[1];
-        rgb[3 * offset + 2] += splatScale * splatRGB[2];
 
-        // Scale pixel value by _scale_
-        rgb[3 * offset] *= scale;
-        rgb[3 * offset + 1] *= scale;
-        rgb[3 * offset + 2] *= scale;
-        ++offset;
+        // Normalize pixel with weight sum, add splat value at pixel and
+        // scale by _scale_
+        float filterWeightSum = pixel.filterWeightSum;
+        float invWt = filterWeightSum != 0 ? (float)1 / filterWeightSum : 1;
+        float maxRGB = filterWeightSum != 0 ? 0 : -Infinity;
+        for (int c = 0; c < 3; ++c)
+            rgb[3 * i + c] =
+                scale * (std::max(maxRGB, pixelRGB[c] * invWt) +
+                         splatScale * splatRGB[c]);
     }
+}
+
+std::vector<ImageLayer> Film::GetAOVLayers() {
+    std::vector<ImageLayer> layers;
+    if (!aovPixels) return layers;
+    int nPixels = croppedPixelBounds.Area();
+    layers.push_back(ImageLayer{"albedo", {"R", "G", "B"}});
+    layers.push_back(ImageLayer{"normal", {"X", "Y", "Z"}});
+    layers.push_back(ImageLayer{"depth", {"Z"}});
+    layers.push_back(ImageLayer{"primitive", {"id"}});
+    for (ImageLayer &layer : layers)
+        layer.values.resize(layer.channels.size() * nPixels);
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    ParallelFor([&](int64_t blockIndex) {
+        Point2i pBlock = croppedPixelBounds.pMin +
+                         Vector2i(blockIndex % nLockBlocks.x,
+                                  blockIndex / nLockBlocks.x) *
+                             lockBlockSize;
+        Bounds2i blockBounds(pBlock,
+                             pBlock + Vector2i(lockBlockSize, lockBlockSize));
+        ForEachLockedBlock(blockBounds, [&](const Bounds2i &bounds) {
+            for (Point2i p : bounds) {
+                int offset = (p.x - croppedPixelBounds.pMin.x) +
+                             (p.y - croppedPixelBounds.pMin.y) * width;
+                const AOVPixel &aov = aovPixels[offset];
+                float weightSum = pixels[offset].filterWeightSum;
+                float invWt = weightSum != 0 ? 1 / weightSum : 0;
+                Spectrum albedo = aov.albedoSum * invWt;
+                albedo.ToRGB(&layers[0].values[3 * offset]);
+                for (int c = 0; c < 3; ++c)
+                    layers[1].values[3 * offset + c] = aov.nSum[c] * invWt;
+                layers[2].values[offset] =
+                    aov.hitWeightSum > 0 ? aov.depthSum / aov.hitWeightSum
+                                         : Infinity;
+                layers[3].values[offset] = aov.primitiveId;
+            }
+        });
+    }, nLockBlocks.x * nLockBlocks.y, 4);
+    return layers;
+}
 
-    // Write RGB image
+void Film::Denoise(float *rgb) {
+    Vector2i res = croppedPixelBounds.Diagonal();
+    // Denoising films always record the AOVs that guide the filter
+    CHECK(HasAOVs());
+    std::vector<ImageLayer> layers = GetAOVLayers();
+    DenoiseImage(rgb, layers[0].values.data(), layers[1].values.data(),
+                 layers[2].values.data(), res.x, res.y, DenoiseSettings(),
+                 rgb);
+}
+
+void Film::WriteImage(float splatScale) {
+    // Convert image to RGB and compute final pixel values
+    if (streaming) {
+        // Write the rows that are left, e.g. because rendering was
+        // cancelled, and close the file
+        std::lock_guard<std::mutex> lock(streamMutex);
+        if (!streamWriter) {
+            Error("Streaming film \"%s\" was never started",
+                  filename.c_str());
+            return;
+        }
+        FlushStreamRows(true);
+        streamWriter.reset();
+        pendingTiles.clear();
+        return;
+    }
+    LOG(INFO) <<
+        "Converting image to RGB and computing final weighted pixel values";
+    ResolveSplats();
+    std::unique_ptr<float[]> rgb(new float[3 * croppedPixelBounds.Area()]);
+    GetRGB(rgb.get(), splatScale);
+    if (denoise) Denoise(rgb.get());
+
+    // Write RGB image; rendering can continue while it's being encoded
     LOG(INFO) << "Writing image " << filename << " with bounds " <<
         croppedPixelBounds;
-    pbrt::WriteImage(filename, &rgb[0], croppedPixelBounds, fullResolution);
+    WriteImageAsync(filename, std::move(rgb), croppedPixelBounds,
+                    fullResolution,
+                    writeAOVs ? GetAOVLayers() : std::vector<ImageLayer>());
+}
+
+void Film::SaveCheckpoint(Checkpoint *checkpoint) {
+    CHECK(!streaming);
+    ResolveSplats();
+    int nPixels = croppedPixelBounds.Area();
+    std::vector<float> values(7 * nPixels);
+    ParallelFor([&](int64_t i) {
+        const Pixel &p = pixels[i];
+        float *v = &values[7 * i];
+        for (int c = 0; c < 3; ++c) {
+            v[c] = p.xyz[c];
+            v[4 + c] = p.splatXYZ[c];
+        }
+        v[3] = p.filterWeightSum;
+    }, nPixels, 4096);
+    const Bounds2i &b = croppedPixelBounds;
+    int bounds[4] = {b.pMin.x, b.pMin.y, b.pMax.x, b.pMax.y};
+    checkpoint->Add("film.bounds", bounds, 4);
+    checkpoint->Add("film.pixels", values);
+}
+
+bool Film::LoadCheckpoint(const Checkpoint &checkpoint, bool accumulate) {
+    CHECK(!streaming);
+    std::vector<int> bounds;
+    std::vector<float> values;
+    const Bounds2i &b = croppedPixelBounds;
+    if (!checkpoint.Get("film.bounds", &bounds) || bounds.size() != 4 ||
+        !checkpoint.Get("film.pixels", &values) ||
+        values.size() != 7 * size_t(b.Area())) {
+        Error("Checkpoint doesn't contain a film");
+        return false;
+    }
+    if (bounds[0] != b.pMin.x || bounds[1] != b.pMin.y ||
+        bounds[2] != b.pMax.x || bounds[3] != b.pMax.y) {
+        Error("Checkpoint film bounds don't match the film's");
+        return false;
+    }
+    ClearSplatBlocks();
+    ParallelFor([&](int64_t i) {
+        Pixel &p = pixels[i];
+        const float *v = &values[7 * i];
+        if (!accumulate) {
+            for (int c = 0; c < 3; ++c) p.xyz[c] = p.splatXYZ[c] = 0;
+            p.filterWeightSum = 0;
+        }
+        for (int c = 0; c < 3; ++c) {
+            p.xyz[c] += v[c];
+            p.splatXYZ[c].Add(v[4 + c]);
+        }
+        p.filterWeightSum += v[3];
+    }, b.Area(), 4096);
+    return true;
 }
 
 Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter) {
@@ -210,8 +604,25 @@ Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter) {
     float diagonal = params.FindOneFloat("diagonal", 35.);
     float maxSampleLuminance = params.FindOneFloat("maxsampleluminance",
                                                    Infinity);
+    bool filterImportanceSampling =
+        params.FindOneBool("filterimportancesampling", false);
+    bool aovs = params.FindOneBool("aovs", false);
+    bool denoise = params.FindOneBool("denoise", false);
+    // Streaming writes rows as they're finished, which needs a scanline
+    // format and rules out anything that uses the whole image at the end
+    bool streaming = params.FindOneBool("streaming", false);
+    if (streaming && !HasExtension(filename, ".exr")) {
+        Warning("Streaming films can only write EXR images; rendering "
+                "\"%s\" in memory", filename.c_str());
+        streaming = false;
+    } else if (streaming && (aovs || denoise)) {
+        Warning("AOVs and denoising need the whole image; not streaming "
+                "\"%s\"", filename.c_str());
+        streaming = false;
+    }
     return new Film(Point2i(xres, yres), crop, std::move(filter), diagonal,
-                    filename, scale, maxSampleLuminance);
+                    filename, scale, maxSampleLuminance,
+                    filterImportanceSampling, aovs, denoise, streaming);
 }
 
 }  // namespace pbrt
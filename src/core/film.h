@@ -9,6 +9,8 @@
 #include "stats.h"
 #include "parallel.h"
 #include "paramset.h"
+#include "imageio.h"
+#include <thread>
 
 namespace pbrt {
 
@@ -18,6 +20,54 @@ struct FilmTilePixel {
     float filterWeightSum = 0.f;
 };
 
+// AOVSample Declarations
+// Auxiliary outputs (AOVs) of a camera sample, recorded at the first
+// non-specular surface its path hits. _hit_ is false if there's no such
+// surface, in which case the sample only adds to the pixels' coverage.
+struct AOVSample {
+    bool hit = false;
+    // Directional albedo of the surface, times the throughput of any
+    // specular bounces before it
+    Spectrum albedo = 0.f;
+    Normal3f n;
+    // Distance from the camera ray's origin
+    float depth = 0;
+    int primitiveId = -1;
+};
+
+// Filtered sums of the AOVs of the samples that reached a pixel; they are
+// normalized by the pixel's filter weight sum, except for the depth, which
+// is averaged over the samples that hit something. The primitive id can't
+// be filtered and is that of the sample with the largest filter weight.
+struct AOVPixel {
+    Spectrum albedoSum = 0.f;
+    Vector3f nSum;
+    float depthSum = 0, hitWeightSum = 0;
+    int primitiveId = -1;
+    float primitiveIdWeight = 0;
+    void Add(const AOVSample &aov, float filterWeight) {
+        if (!aov.hit) return;
+        albedoSum += aov.albedo * filterWeight;
+        nSum += Vector3f(aov.n) * filterWeight;
+        depthSum += aov.depth * filterWeight;
+        hitWeightSum += filterWeight;
+        if (filterWeight > primitiveIdWeight) {
+            primitiveId = aov.primitiveId;
+            primitiveIdWeight = filterWeight;
+        }
+    }
+    void Merge(const AOVPixel &p) {
+        albedoSum += p.albedoSum;
+        nSum += p.nSum;
+        depthSum += p.depthSum;
+        hitWeightSum += p.hitWeightSum;
+        if (p.primitiveIdWeight > primitiveIdWeight) {
+            primitiveId = p.primitiveId;
+            primitiveIdWeight = p.primitiveIdWeight;
+        }
+    }
+};
+
 // Film Declarations
 class Film {
   public:
@@ -25,20 +75,63 @@ class Film {
     Film(const Point2i &resolution, const Bounds2f &cropWindow,
          std::unique_ptr<Filter> filter, float diagonal,
          const std::string &filename, float scale,
-         float maxSampleLuminance = Infinity);
+         float maxSampleLuminance = Infinity,
+         bool filterImportanceSampling = false, bool aovs = false,
+         bool denoise = false, bool streaming = false);
     Bounds2i GetSampleBounds() const;
     Bounds2f GetPhysicalExtent() const;
     std::unique_ptr<FilmTile> GetFilmTile(const Bounds2i &sampleBounds);
+    // Non-null if camera samples should be drawn from the filter's
+    // distribution, in which case each sample only contributes to the
+    // pixel it was taken for; see FilmTile::AddPixelSample().
+    const FilterSampler *GetFilterSampler() const {
+        return filterSampler.get();
+    }
+    // True if the film accumulates AOVs alongside the image, either to
+    // write them as extra layers of EXR images or to guide the denoiser
+    bool HasAOVs() const { return aovPixels != nullptr; }
+    // True if WriteImage() denoises the image; see core/denoise.h
+    bool Denoising() const { return denoise; }
+    // True if the film keeps only the rows that tiles are still being
+    // merged into and writes the others to disk as soon as they're done.
+    // Only tile merges are supported then: splats, SetImage(), GetRGB()
+    // and checkpoints need the whole image.
+    bool Streaming() const { return streaming; }
+    // Starts writing the image; every tile in _tileSampleBounds_ must then
+    // be merged exactly once, and each row is written once the last tile
+    // touching it has been merged. WriteImage() writes whatever is left.
+    void BeginStreaming(const std::vector<Bounds2i> &tileSampleBounds);
     void MergeFilmTile(std::unique_ptr<FilmTile> tile);
-    void SetImage(const Spectrum *img) const;
+    void SetImage(const Spectrum *img);
+    // Splats are buffered per thread; ResolveSplats() adds the buffered
+    // values to the image and must not run concurrently with AddSplat().
+    // WriteImage() resolves splats itself, while progressive integrators
+    // resolve them at the end of each pass so that they can be displayed.
     void AddSplat(const Point2f &p, Spectrum v);
+    void ResolveSplats();
+    void GetRGB(float *rgb, float splatScale = 1);
+    // Returns the normalized AOVs as image layers: "albedo" (R, G, B),
+    // "normal" (X, Y, Z), "depth" (Z; infinite where nothing was hit) and
+    // "primitive" (id; -1 where nothing was hit). Empty without AOVs.
+    std::vector<ImageLayer> GetAOVLayers();
+    // Denoises _rgb_, an image returned by GetRGB(), using the AOVs as
+    // features; only valid if Denoising(), which implies HasAOVs().
+    void Denoise(float *rgb);
     void WriteImage(float splatScale = 1);
     void Clear();
+    // Stores the pixel accumulators, with splats resolved, in
+    // _checkpoint_; like ResolveSplats(), this must not run concurrently
+    // with AddSplat(). The accumulators are sums over samples, so loading
+    // checkpoints of renders that took different samples with
+    // _accumulate_ set merges them.
+    void SaveCheckpoint(Checkpoint *checkpoint);
+    bool LoadCheckpoint(const Checkpoint &checkpoint, bool accumulate = false);
 
     // Film Public Data
     const Point2i fullResolution;
     const float diagonal;
     std::unique_ptr<Filter> filter;
+    std::unique_ptr<FilterSampler> filterSampler;
     const std::string filename;
     Bounds2i croppedPixelBounds;
 
@@ -52,20 +145,74 @@ class Film {
         float pad;
     };
     std::unique_ptr<Pixel[]> pixels;
+    std::unique_ptr<AOVPixel[]> aovPixels;
+    // Each thread accumulates its splats in square blocks of pixels that
+    // are allocated the first time it splats into them, so that threads
+    // splatting into the same bright region don't contend for the same
+    // cache lines. A block takes 12KB; ResolveSplats() frees them all, and
+    // while _maxSplatBlocks_ (enough to cover the image four times) are in
+    // use, further splats go straight to the pixels' atomic sums.
+    static constexpr int splatBlockSize = 32;
+    struct SplatBlock {
+        float xyz[splatBlockSize * splatBlockSize][3];
+    };
+    Vector2i nSplatBlocks;
+    std::vector<std::vector<std::unique_ptr<SplatBlock>>> threadSplatBlocks;
+    int maxSplatBlocks;
+    std::atomic<int> nSplatBlocksInUse{0};
+    // ThreadIndex is 0 both for the thread that called ParallelInit() and
+    // for threads outside the pool, such as a viewer's render thread, so
+    // the blocks of thread 0 belong to whichever of them splats first after
+    // the splats were last resolved.
+    std::atomic<std::thread::id> splatBlocks0Owner;
     static constexpr int filterTableWidth = 16;
     float filterTable[filterTableWidth * filterTableWidth];
-    std::mutex mutex;
+    // Tile merges and readers lock only the blocks of pixels they touch,
+    // so tiles whose filter footprints don't overlap never wait on each
+    // other.
+    static constexpr int lockBlockSize = 16;
+    Vector2i nLockBlocks;
+    std::unique_ptr<std::mutex[]> blockMutexes;
     const float scale;
     const float maxSampleLuminance;
+    const bool writeAOVs, denoise, streaming;
+    // When streaming, _pixels_ is unused and each row of the image is
+    // allocated when the first tile touching it is merged; _streamMutex_
+    // guards the rows' allocation and the rest of the streaming state.
+    std::mutex streamMutex;
+    std::vector<std::unique_ptr<Pixel[]>> rows;
+    // Tiles yet to be merged into each row
+    std::vector<int> pendingTiles;
+    // First row that hasn't been written
+    int nextStreamRow = 0;
+    std::unique_ptr<StreamingImageWriter> streamWriter;
 
     // Film Private Methods
     Pixel &GetPixel(const Point2i &p) {
         CHECK(InsideExclusive(p, croppedPixelBounds));
         int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+        if (streaming)
+            return rows[p.y - croppedPixelBounds.pMin.y]
+                       [p.x - croppedPixelBounds.pMin.x];
         int offset = (p.x - croppedPixelBounds.pMin.x) +
                      (p.y - croppedPixelBounds.pMin.y) * width;
         return pixels[offset];
     }
+    // Image pixels that samples in _sampleBounds_ contribute to
+    Bounds2i TilePixelBounds(const Bounds2i &sampleBounds) const;
+    // Writes the rows from _nextStreamRow_ up to, but not including, the
+    // first one with pending tiles, or all remaining rows if _finish_ is
+    // true; called with _streamMutex_ held
+    void FlushStreamRows(bool finish);
+    // Returns the calling thread's splat block with index _blockIndex_,
+    // allocating it if needed, or null if the splat has to be added to the
+    // pixel directly
+    SplatBlock *ThreadSplatBlock(int blockIndex);
+    void ClearSplatBlocks();
+    void ResolvePixels(const Pixel *pixels, int n, float splatScale,
+                       float *rgb) const;
+    template <typename Func>
+    void ForEachLockedBlock(const Bounds2i &bounds, Func func);
 };
 
 class FilmTile {
@@ -73,17 +220,21 @@ class FilmTile {
     // FilmTile Public Methods
     FilmTile(const Bounds2i &pixelBounds, const Vector2f &filterRadius,
              const float *filterTable, int filterTableSize,
-             float maxSampleLuminance)
+             float maxSampleLuminance, bool filterSampled = false,
+             bool aovs = false)
         : pixelBounds(pixelBounds),
           filterRadius(filterRadius),
           invFilterRadius(1 / filterRadius.x, 1 / filterRadius.y),
           filterTable(filterTable),
           filterTableSize(filterTableSize),
-          maxSampleLuminance(maxSampleLuminance) {
+          maxSampleLuminance(maxSampleLuminance),
+          filterSampled(filterSampled) {
         pixels = std::vector<FilmTilePixel>(std::max(0, pixelBounds.Area()));
+        if (aovs) aovPixels.resize(pixels.size());
     }
+    // _aov_ is ignored unless the film has AOVs
     void AddSample(const Point2f &pFilm, Spectrum L,
-                   float sampleWeight = 1.) {
+                   float sampleWeight = 1., const AOVSample *aov = nullptr) {
         ProfilePhase _(Prof::AddFilmSample);
         if (L.y() > maxSampleLuminance)
             L *= maxSampleLuminance / L.y();
@@ -122,6 +273,30 @@ class FilmTile {
                 pixel.filterWeightSum += filterWeight;
             }
         }
+        if (aov && !aovPixels.empty()) AddAOVs(*aov, p0, p1, ifx, ify);
+    }
+    // Adds a sample taken for pixel _pPixel_ at _pFilm_. If the film's
+    // filter is importance sampled, the sample only contributes to
+    // _pPixel_, weighted by the _filterWeight_ it was drawn with; otherwise
+    // this is the same as AddSample().
+    void AddPixelSample(const Point2i &pPixel, const Point2f &pFilm,
+                        float filterWeight, Spectrum L,
+                        float sampleWeight = 1.,
+                        const AOVSample *aov = nullptr) {
+        if (!filterSampled) {
+            AddSample(pFilm, L, sampleWeight, aov);
+            return;
+        }
+        ProfilePhase _(Prof::AddFilmSample);
+        if (L.y() > maxSampleLuminance)
+            L *= maxSampleLuminance / L.y();
+        FilmTilePixel &pixel = GetPixel(pPixel);
+        pixel.contribSum += L * sampleWeight * filterWeight;
+        pixel.filterWeightSum += filterWeight;
+        if (aov && !aovPixels.empty()) {
+            ProfilePhase _(Prof::AddFilmAOVs);
+            aovPixels[PixelOffset(pPixel)].Add(*aov, filterWeight);
+        }
     }
     FilmTilePixel &GetPixel(const Point2i &p) {
         CHECK(InsideExclusive(p, pixelBounds));
@@ -138,15 +313,38 @@ class FilmTile {
         return pixels[offset];
     }
     Bounds2i GetPixelBounds() const { return pixelBounds; }
+    // The tile's pixels in scanline order, e.g. for sending them to
+    // another process
+    std::vector<FilmTilePixel> &GetPixels() { return pixels; }
 
   private:
+    // FilmTile Private Methods
+    int PixelOffset(const Point2i &p) const {
+        int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+        return (p.x - pixelBounds.pMin.x) + (p.y - pixelBounds.pMin.y) * width;
+    }
+    void AddAOVs(const AOVSample &aov, const Point2i &p0, const Point2i &p1,
+                 const int *ifx, const int *ify) {
+        // Use the same filter weights as the sample's radiance
+        ProfilePhase _(Prof::AddFilmAOVs);
+        for (int y = p0.y; y < p1.y; ++y)
+            for (int x = p0.x; x < p1.x; ++x) {
+                int offset = ify[y - p0.y] * filterTableSize + ifx[x - p0.x];
+                aovPixels[PixelOffset(Point2i(x, y))].Add(aov,
+                                                          filterTable[offset]);
+            }
+    }
+
     // FilmTile Private Data
     const Bounds2i pixelBounds;
     const Vector2f filterRadius, invFilterRadius;
     const float *filterTable;
     const int filterTableSize;
     std::vector<FilmTilePixel> pixels;
+    // Empty unless the film has AOVs
+    std::vector<AOVPixel> aovPixels;
     const float maxSampleLuminance;
+    const bool filterSampled;
     friend class Film;
 };
 
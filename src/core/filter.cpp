@@ -1,9 +1,65 @@
 // core/filter.cpp*
 #include "filter.h"
+#include "sampling.h"
+#include "filters/box.h"
+#include "filters/gaussian.h"
+#include "filters/mitchell.h"
+#include "filters/sinc.h"
 
 namespace pbrt {
 
 // Filter Method Definitions
 Filter::~Filter() {}
 
-}  // namespace pbrt
\ No newline at end of file
+// FilterSampler Method Definitions
+FilterSampler::FilterSampler(const Filter &filter, int samplesPerUnit)
+    : radius(filter.radius) {
+    // Tabulate the filter's absolute value over its extent, evaluating it
+    // at the center of each cell
+    resolution = Point2i(std::max(1, int(2 * radius.x * samplesPerUnit)),
+                         std::max(1, int(2 * radius.y * samplesPerUnit)));
+    values.resize(resolution.x * resolution.y);
+    std::vector<float> absValues(values.size());
+    for (int y = 0; y < resolution.y; ++y)
+        for (int x = 0; x < resolution.x; ++x) {
+            Point2f p(Lerp((x + 0.5f) / resolution.x, -radius.x, radius.x),
+                      Lerp((y + 0.5f) / resolution.y, -radius.y, radius.y));
+            int offset = y * resolution.x + x;
+            values[offset] = filter.Evaluate(p);
+            absValues[offset] = std::abs(values[offset]);
+        }
+    distrib.reset(
+        new Distribution2D(absValues.data(), resolution.x, resolution.y));
+}
+
+FilterSampler::~FilterSampler() {}
+
+Point2f FilterSampler::SampleFilm(const Point2i &pPixel, const Point2f &u,
+                                  float *weight) const {
+    float pdf;
+    Point2f uv = distrib->SampleContinuous(u, &pdf);
+    int x = std::min(int(uv.x * resolution.x), resolution.x - 1);
+    int y = std::min(int(uv.y * resolution.y), resolution.y - 1);
+    // The density is over the unit square; convert it to one over the
+    // filter's extent
+    pdf /= 4 * radius.x * radius.y;
+    *weight = pdf > 0 ? values[y * resolution.x + x] / pdf : 0;
+    return Point2f(pPixel.x + 0.5f + Lerp(uv.x, -radius.x, radius.x),
+                   pPixel.y + 0.5f + Lerp(uv.y, -radius.y, radius.y));
+}
+
+std::unique_ptr<Filter> MakeFilter(const std::string &name,
+                                   const ParamSet &params) {
+    Filter *filter = nullptr;
+    if (name == "box")
+        filter = CreateBoxFilter(params);
+    else if (name == "gaussian")
+        filter = CreateGaussianFilter(params);
+    else if (name == "mitchell")
+        filter = CreateMitchellFilter(params);
+    else if (name == "sinc" || name == "lanczos")
+        filter = CreateSincFilter(params);
+    return std::unique_ptr<Filter>(filter);
+}
+
+}  // namespace pbrt
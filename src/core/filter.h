@@ -21,6 +21,36 @@ class Filter {
     const Vector2f radius, invRadius;
 };
 
+// Draws offsets from the pixel center distributed according to the
+// absolute value of a filter, so that each camera sample can be given to
+// the single pixel it was taken for instead of being spread over all
+// pixels within the filter's radius. The filter is tabulated once, and
+// sampling is a lookup in the tabulated distribution.
+class FilterSampler {
+  public:
+    // FilterSampler Public Methods
+    FilterSampler(const Filter &filter, int samplesPerUnit = 32);
+    ~FilterSampler();
+    // Returns the film position of a sample for _pPixel_ and sets
+    // _*weight_ to the filter's value there divided by the sample's
+    // density. The weight is negative in the filter's negative lobes.
+    Point2f SampleFilm(const Point2i &pPixel, const Point2f &u,
+                       float *weight) const;
+
+  private:
+    // FilterSampler Private Data
+    const Vector2f radius;
+    Point2i resolution;
+    std::vector<float> values;
+    std::unique_ptr<Distribution2D> distrib;
+};
+
+// Creates the filter called _name_: "box", "gaussian", "mitchell" or
+// "sinc" (a Lanczos windowed sinc, also called "lanczos"). Returns nullptr
+// if the name is unknown.
+std::unique_ptr<Filter> MakeFilter(const std::string &name,
+                                   const ParamSet &params);
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_FILTER_H
\ No newline at end of file
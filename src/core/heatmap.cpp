@@ -0,0 +1,162 @@
+// core/heatmap.cpp*
+#include "heatmap.h"
+#include "imageio.h"
+#include "paramset.h"
+#include "stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace pbrt {
+
+STAT_COUNTER("Heatmap/Heatmaps written", nHeatmapsWritten);
+
+thread_local RayWork ThreadRayWork;
+
+// Heatmap Local Definitions
+static const char tileCostsHeader[] =
+    "x0,y0,x1,y1,samplestart,sampleend,seconds,rays,bvhnodes,primitives";
+
+// Maps _t_ in [0, 1] to a color that goes from black through purple and
+// orange to pale yellow, so that cost reads as brightness. The stops are
+// sRGB values; the result is linear, since WriteImage() applies the gamma.
+static void FalseColor(float t, float rgb[3]) {
+    static const float stops[5][3] = {{0.001f, 0.000f, 0.014f},
+                                      {0.341f, 0.062f, 0.429f},
+                                      {0.735f, 0.216f, 0.330f},
+                                      {0.978f, 0.557f, 0.035f},
+                                      {0.988f, 0.998f, 0.645f}};
+    t = Clamp(t, 0, 1) * 4;
+    int i = std::min(int(t), 3);
+    float f = t - i;
+    for (int c = 0; c < 3; ++c) {
+        float v = Lerp(f, stops[i][c], stops[i + 1][c]);
+        rgb[c] = v <= 0.04045f ? v / 12.92f
+                               : std::pow((v + 0.055f) / 1.055f, 2.4f);
+    }
+}
+
+// Heatmap Function Definitions
+HeatmapSettings GetHeatmapSettings(const ParamSet &params) {
+    HeatmapSettings settings;
+    settings.filename = params.FindOneString("heatmap", "");
+    settings.tileCosts = params.FindOneString("tilecosts", "");
+    return settings;
+}
+
+bool ReadTileCosts(const std::string &filename, std::vector<TileCost> *tiles) {
+    FILE *f = fopen(filename.c_str(), "r");
+    if (!f) {
+        Error("Unable to open tile costs \"%s\"", filename.c_str());
+        return false;
+    }
+    tiles->clear();
+    char line[256];
+    bool ok = fgets(line, sizeof(line), f) &&
+              strncmp(line, tileCostsHeader, strlen(tileCostsHeader)) == 0;
+    while (ok && fgets(line, sizeof(line), f)) {
+        TileCost tile;
+        long long sampleStart, sampleEnd, rays, nodes, primitives;
+        if (sscanf(line, "%d,%d,%d,%d,%lld,%lld,%f,%lld,%lld,%lld",
+                   &tile.bounds.pMin.x, &tile.bounds.pMin.y,
+                   &tile.bounds.pMax.x, &tile.bounds.pMax.y, &sampleStart,
+                   &sampleEnd, &tile.seconds, &rays, &nodes,
+                   &primitives) != 10) {
+            ok = false;
+            break;
+        }
+        tile.sampleStart = sampleStart;
+        tile.sampleEnd = sampleEnd;
+        tile.work.rays = rays;
+        tile.work.nodesVisited = nodes;
+        tile.work.primitivesTested = primitives;
+        tiles->push_back(tile);
+    }
+    fclose(f);
+    if (!ok) {
+        Error("\"%s\" isn't a tile costs file", filename.c_str());
+        tiles->clear();
+    }
+    return ok;
+}
+
+// CostHeatmap Method Definitions
+CostHeatmap::CostHeatmap(const Bounds2i &pixelBounds)
+    : pixelBounds(pixelBounds), pixels(std::max(0, pixelBounds.Area())) {}
+
+void CostHeatmap::AddPixel(const Point2i &p, float seconds,
+                           const RayWork &work) {
+    if (!InsideExclusive(p, pixelBounds)) return;
+    int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+    PixelCost &pixel = pixels[(p.x - pixelBounds.pMin.x) +
+                              (p.y - pixelBounds.pMin.y) * width];
+    pixel.seconds += seconds;
+    pixel.work += work;
+}
+
+void CostHeatmap::AddTile(const TileCost &tile) {
+    std::lock_guard<std::mutex> lock(tileMutex);
+    tiles.push_back(tile);
+}
+
+void CostHeatmap::Write(const std::string &filename) const {
+    // Write one image per measure. Each is scaled so that the 99th
+    // percentile of the pixels that did any work maps to the top of the
+    // color ramp; the few pixels above it, often the interesting ones,
+    // saturate instead of making everything else dark.
+    const char *names[4] = {"time", "rays", "nodes", "primitives"};
+    int nPixels = pixels.size();
+    std::vector<float> values(nPixels), sorted;
+    std::unique_ptr<float[]> rgb(new float[3 * nPixels]);
+    for (int m = 0; m < 4; ++m) {
+        for (int i = 0; i < nPixels; ++i) {
+            const PixelCost &p = pixels[i];
+            values[i] = m == 0   ? p.seconds
+                        : m == 1 ? p.work.rays
+                        : m == 2 ? p.work.nodesVisited
+                                 : p.work.primitivesTested;
+        }
+        sorted.clear();
+        for (float v : values)
+            if (v > 0) sorted.push_back(v);
+        float maxValue = 0;
+        if (!sorted.empty()) {
+            auto iter = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+            std::nth_element(sorted.begin(), iter, sorted.end());
+            maxValue = *iter;
+        }
+        float invMax = maxValue > 0 ? 1 / maxValue : 0;
+        for (int i = 0; i < nPixels; ++i)
+            FalseColor(values[i] * invMax, &rgb[3 * i]);
+        std::string name = filename + "_" + names[m] + ".png";
+        LOG(INFO) << "Writing heatmap " << name << "; full scale is " <<
+            maxValue << " per pixel";
+        WriteImage(name, rgb.get(), pixelBounds,
+                   Point2i(pixelBounds.pMax.x, pixelBounds.pMax.y));
+    }
+
+    // Write the tile costs in the order tiles were rendered in each pass
+    std::string csvName = filename + "_tiles.csv";
+    FILE *f = fopen(csvName.c_str(), "w");
+    if (!f) {
+        Error("Unable to create \"%s\"", csvName.c_str());
+        return;
+    }
+    fprintf(f, "%s\n", tileCostsHeader);
+    std::vector<TileCost> sortedTiles = tiles;
+    std::stable_sort(sortedTiles.begin(), sortedTiles.end(),
+                     [](const TileCost &a, const TileCost &b) {
+                         return a.sampleStart < b.sampleStart;
+                     });
+    for (const TileCost &t : sortedTiles)
+        fprintf(f, "%d,%d,%d,%d,%lld,%lld,%g,%lld,%lld,%lld\n",
+                t.bounds.pMin.x, t.bounds.pMin.y, t.bounds.pMax.x,
+                t.bounds.pMax.y, (long long)t.sampleStart,
+                (long long)t.sampleEnd, t.seconds, (long long)t.work.rays,
+                (long long)t.work.nodesVisited,
+                (long long)t.work.primitivesTested);
+    if (fclose(f) != 0) Error("Unable to write \"%s\"", csvName.c_str());
+    ++nHeatmapsWritten;
+}
+
+}  // namespace pbrt
@@ -0,0 +1,128 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+// core/heatmap.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include <chrono>
+#include <mutex>
+
+namespace pbrt {
+
+// Heatmap Declarations
+
+// Work done tracing rays through the scene: rays traced, BVH nodes visited
+// and primitives tested for intersection
+struct RayWork {
+    int64_t rays = 0, nodesVisited = 0, primitivesTested = 0;
+    RayWork &operator+=(const RayWork &w) {
+        rays += w.rays;
+        nodesVisited += w.nodesVisited;
+        primitivesTested += w.primitivesTested;
+        return *this;
+    }
+    RayWork operator-(const RayWork &w) const {
+        RayWork r = *this;
+        r.rays -= w.rays;
+        r.nodesVisited -= w.nodesVisited;
+        r.primitivesTested -= w.primitivesTested;
+        return r;
+    }
+};
+
+// The work done by the calling thread so far; updated by Scene's and
+// BVHAccel's intersection routines. Costs are attributed to a pixel or
+// tile by the difference between readings taken before and after it.
+extern thread_local RayWork ThreadRayWork;
+
+// How a render records its costs; read from the "heatmap" (base filename
+// of the images and CSV file) and "tilecosts" (CSV file written by an
+// earlier render) parameters
+struct HeatmapSettings {
+    // Costs aren't recorded if the filename is empty
+    std::string filename;
+    // Tile costs that the first pass is scheduled by, so that the tiles
+    // that were slow last time start first
+    std::string tileCosts;
+};
+HeatmapSettings GetHeatmapSettings(const ParamSet &params);
+
+// The cost of rendering one tile for a range of sample indices
+struct TileCost {
+    Bounds2i bounds;
+    int64_t sampleStart, sampleEnd;
+    float seconds;
+    RayWork work;
+};
+
+// Reads the tiles of a CSV file written by CostHeatmap::Write()
+bool ReadTileCosts(const std::string &filename, std::vector<TileCost> *tiles);
+
+// Wall-clock time and ray work spent on each pixel and tile of a render.
+// Write() turns the pixel costs into false-color images, which show where
+// e.g. slivers of glass or dense geometry make a frame slow, and the tile
+// costs into a CSV file, which can seed a later render's tile schedule.
+class CostHeatmap {
+  public:
+    // CostHeatmap Public Methods
+    // Pixel costs are kept for _pixelBounds_, usually the film's cropped
+    // pixel bounds; those of pixels outside of it are dropped
+    CostHeatmap(const Bounds2i &pixelBounds);
+    // Adds to the cost of _p_; a pixel must not be recorded by multiple
+    // threads at once, which rendering it in a single tile guarantees
+    void AddPixel(const Point2i &p, float seconds, const RayWork &work);
+    void AddTile(const TileCost &tile);
+    // Writes <filename>_time.png, <filename>_rays.png,
+    // <filename>_nodes.png, <filename>_primitives.png and
+    // <filename>_tiles.csv
+    void Write(const std::string &filename) const;
+
+  private:
+    // CostHeatmap Private Data
+    struct PixelCost {
+        float seconds = 0;
+        RayWork work;
+    };
+    const Bounds2i pixelBounds;
+    std::vector<PixelCost> pixels;
+    std::mutex tileMutex;
+    std::vector<TileCost> tiles;
+};
+
+// Measures the time and ray work of the calling thread from construction
+// until the pixel or tile it measures is recorded; it does nothing if
+// _heatmap_ is null.
+class CostMeter {
+  public:
+    // CostMeter Public Methods
+    explicit CostMeter(CostHeatmap *heatmap) : heatmap(heatmap) {
+        if (!heatmap) return;
+        start = std::chrono::steady_clock::now();
+        work = ThreadRayWork;
+    }
+    void RecordPixel(const Point2i &p) const {
+        if (heatmap) heatmap->AddPixel(p, Seconds(), ThreadRayWork - work);
+    }
+    void RecordTile(const Bounds2i &bounds, int64_t sampleStart,
+                    int64_t sampleEnd) const {
+        if (heatmap)
+            heatmap->AddTile(TileCost{bounds, sampleStart, sampleEnd,
+                                      Seconds(), ThreadRayWork - work});
+    }
+
+  private:
+    // CostMeter Private Methods
+    float Seconds() const {
+        return std::chrono::duration<float>(std::chrono::steady_clock::now() -
+                                            start).count();
+    }
+
+    // CostMeter Private Data
+    CostHeatmap *heatmap;
+    std::chrono::steady_clock::time_point start;
+    RayWork work;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_HEATMAP_H
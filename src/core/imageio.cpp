@@ -1,10 +1,15 @@
 // core/imageio.cpp*
 #include "imageio.h"
+#include "asyncwriter.h"
 #include "ext/lodepng.h"
 #include "ext/targa.h"
 #include "fileutil.h"
 #include "spectrum.h"
 
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfHeader.h>
+#include <ImfOutputFile.h>
 #include <ImfRgba.h>
 #include <ImfRgbaFile.h>
 
@@ -13,7 +18,8 @@ namespace pbrt {
 // ImageIO Local Declarations
 static void WriteImageEXR(const std::string &name, const float *pixels,
                           int xRes, int yRes, int totalXRes, int totalYRes,
-                          int xOffset, int yOffset);
+                          int xOffset, int yOffset,
+                          const std::vector<ImageLayer> &layers);
 static void WriteImageTGA(const std::string &name, const uint8_t *pixels,
                           int xRes, int yRes, int totalXRes, int totalYRes,
                           int xOffset, int yOffset);
@@ -47,30 +53,28 @@ std::unique_ptr<RGBSpectrum[]> ReadImage(const std::string &name,
 }
 
 void WriteImage(const std::string &name, const float *rgb,
-                const Bounds2i &outputBounds, const Point2i &totalResolution) {
+                const Bounds2i &outputBounds, const Point2i &totalResolution,
+                const std::vector<ImageLayer> &layers) {
     Vector2i resolution = outputBounds.Diagonal();
+    if (!layers.empty() && !HasExtension(name, ".exr"))
+        Warning("Only EXR images can store extra layers; not writing them "
+                "to \"%s\"", name.c_str());
     if (HasExtension(name, ".exr")) {
         WriteImageEXR(name, rgb, resolution.x, resolution.y, totalResolution.x,
                       totalResolution.y, outputBounds.pMin.x,
-                      outputBounds.pMin.y);
+                      outputBounds.pMin.y, layers);
     } else if (HasExtension(name, ".pfm")) {
         WriteImagePFM(name, rgb, resolution.x, resolution.y);
     } else if (HasExtension(name, ".tga") || HasExtension(name, ".png")) {
-        // 8-bit formats; apply gamma
+        // 8-bit formats; apply gamma. This runs on the background writer
+        // thread too, possibly after the thread pool has shut down, so it
+        // doesn't use ParallelFor().
         Vector2i resolution = outputBounds.Diagonal();
         std::unique_ptr<uint8_t[]> rgb8(
             new uint8_t[3 * resolution.x * resolution.y]);
-        uint8_t *dst = rgb8.get();
-        for (int y = 0; y < resolution.y; ++y) {
-            for (int x = 0; x < resolution.x; ++x) {
-#define TO_BYTE(v) (uint8_t) Clamp(255.f * GammaCorrect(v) + 0.5f, 0.f, 255.f)
-                dst[0] = TO_BYTE(rgb[3 * (y * resolution.x + x) + 0]);
-                dst[1] = TO_BYTE(rgb[3 * (y * resolution.x + x) + 1]);
-                dst[2] = TO_BYTE(rgb[3 * (y * resolution.x + x) + 2]);
-#undef TO_BYTE
-                dst += 3;
-            }
-        }
+        for (int i = 0; i < 3 * resolution.x * resolution.y; ++i)
+            rgb8[i] = (uint8_t)Clamp(255.f * GammaCorrect(rgb[i]) + 0.5f, 0.f,
+                                     255.f);
 
         if (HasExtension(name, ".tga"))
             WriteImageTGA(name, rgb8.get(), resolution.x, resolution.y,
@@ -89,6 +93,82 @@ void WriteImage(const std::string &name, const float *rgb,
     }
 }
 
+// Background Image Writer Definitions
+static AsyncWriter imageWriter;
+
+void WriteImageAsync(const std::string &name, std::unique_ptr<float[]> rgb,
+                     const Bounds2i &outputBounds,
+                     const Point2i &totalResolution,
+                     std::vector<ImageLayer> layers) {
+    // std::function needs a copyable callable, so share the pixels
+    std::shared_ptr<float[]> pixels(std::move(rgb));
+    imageWriter.Enqueue(name, [=, layers = std::move(layers)]() {
+        WriteImage(name, pixels.get(), outputBounds, totalResolution, layers);
+    });
+}
+
+void WaitForImageWrites() { imageWriter.Wait(); }
+
+// StreamingImageWriter Method Definitions
+struct StreamingImageWriter::ExrFile {
+    ExrFile(const std::string &name, const Imf::Header &header)
+        : file(name.c_str(), header) {}
+    Imf::OutputFile file;
+};
+
+StreamingImageWriter::StreamingImageWriter(const std::string &name,
+                                           const Bounds2i &outputBounds,
+                                           const Point2i &totalResolution)
+    : name(name), outputBounds(outputBounds) {
+    using namespace Imf;
+    using namespace Imath;
+    // OpenEXR uses inclusive pixel bounds; the default increasing y line
+    // order lets scanlines be written as soon as they're done
+    Box2i displayWindow(V2i(0, 0),
+                        V2i(totalResolution.x - 1, totalResolution.y - 1));
+    Box2i dataWindow(V2i(outputBounds.pMin.x, outputBounds.pMin.y),
+                     V2i(outputBounds.pMax.x - 1, outputBounds.pMax.y - 1));
+    Header header(displayWindow, dataWindow);
+    for (const char *channel : {"R", "G", "B"})
+        header.channels().insert(channel, Channel(FLOAT));
+    try {
+        file.reset(new ExrFile(name, header));
+    } catch (const std::exception &exc) {
+        Error("Error creating \"%s\": %s", name.c_str(), exc.what());
+    }
+}
+
+StreamingImageWriter::~StreamingImageWriter() {
+    int nRows = outputBounds.pMax.y - outputBounds.pMin.y;
+    if (file && rowsWritten < nRows)
+        Warning("Only %d of %d rows were written to \"%s\"", rowsWritten,
+                nRows, name.c_str());
+}
+
+void StreamingImageWriter::WriteRows(const float *rgb, int nRows) {
+    using namespace Imf;
+    if (!file || nRows <= 0) return;
+    // Slices are addressed by absolute pixel coordinates, so offset the
+    // rows' origin by where they lie in the data window
+    int width = outputBounds.pMax.x - outputBounds.pMin.x;
+    int y = outputBounds.pMin.y + rowsWritten;
+    size_t xStride = 3 * sizeof(float), yStride = xStride * width;
+    const float *origin = rgb - 3 * (outputBounds.pMin.x + y * width);
+    FrameBuffer frameBuffer;
+    const char *channels[3] = {"R", "G", "B"};
+    for (int c = 0; c < 3; ++c)
+        frameBuffer.insert(channels[c], Slice(FLOAT, (char *)(origin + c),
+                                              xStride, yStride));
+    try {
+        file->file.setFrameBuffer(frameBuffer);
+        file->file.writePixels(nRows);
+        rowsWritten += nRows;
+    } catch (const std::exception &exc) {
+        Error("Error writing \"%s\": %s", name.c_str(), exc.what());
+        file.reset();
+    }
+}
+
 RGBSpectrum *ReadImageEXR(const std::string &name, int *width, int *height,
                           Bounds2i *dataWindow, Bounds2i *displayWindow) {
     using namespace Imf;
@@ -131,18 +211,51 @@ RGBSpectrum *ReadImageEXR(const std::string &name, int *width, int *height,
 
 static void WriteImageEXR(const std::string &name, const float *pixels,
                           int xRes, int yRes, int totalXRes, int totalYRes,
-                          int xOffset, int yOffset) {
+                          int xOffset, int yOffset,
+                          const std::vector<ImageLayer> &layers) {
     using namespace Imf;
     using namespace Imath;
 
-    Rgba *hrgba = new Rgba[xRes * yRes];
-    for (int i = 0; i < xRes * yRes; ++i)
-        hrgba[i] = Rgba(pixels[3 * i], pixels[3 * i + 1], pixels[3 * i + 2]);
-
     // OpenEXR uses inclusive pixel bounds.
     Box2i displayWindow(V2i(0, 0), V2i(totalXRes - 1, totalYRes - 1));
     Box2i dataWindow(V2i(xOffset, yOffset),
                      V2i(xOffset + xRes - 1, yOffset + yRes - 1));
+    if (!layers.empty()) {
+        // Write the image and its layers as full float channels of a
+        // single file; slices are addressed relative to the data window
+        Header header(displayWindow, dataWindow);
+        FrameBuffer frameBuffer;
+        auto addChannel = [&](const std::string &channel, const float *values,
+                              int nChannels) {
+            header.channels().insert(channel, Channel(FLOAT));
+            size_t xStride = nChannels * sizeof(float);
+            const float *origin = values - nChannels * (xOffset + yOffset * xRes);
+            frameBuffer.insert(channel, Slice(FLOAT, (char *)origin, xStride,
+                                              xStride * xRes));
+        };
+        const char *rgbNames[3] = {"R", "G", "B"};
+        for (int c = 0; c < 3; ++c) addChannel(rgbNames[c], pixels + c, 3);
+        for (const ImageLayer &layer : layers) {
+            int nChannels = layer.channels.size();
+            CHECK_EQ(layer.values.size(), (size_t)nChannels * xRes * yRes);
+            for (int c = 0; c < nChannels; ++c)
+                addChannel(layer.name + "." + layer.channels[c],
+                           layer.values.data() + c, nChannels);
+        }
+        try {
+            OutputFile file(name.c_str(), header);
+            file.setFrameBuffer(frameBuffer);
+            file.writePixels(yRes);
+        } catch (const std::exception &exc) {
+            Error("Error writing \"%s\": %s", name.c_str(), exc.what());
+        }
+        return;
+    }
+
+    Rgba *hrgba = new Rgba[xRes * yRes];
+    for (int i = 0; i < xRes * yRes; ++i)
+        hrgba[i] = Rgba(pixels[3 * i], pixels[3 * i + 1], pixels[3 * i + 2]);
+
     try {
         RgbaOutputFile file(name.c_str(), displayWindow, dataWindow,
                             WRITE_RGB);
@@ -9,14 +9,64 @@
 namespace pbrt {
 
 // ImageIO Declarations
+
+// Additional channels of an image, e.g. the albedo of the first visible
+// surface, stored interleaved by pixel. In EXR files they are named
+// "<name>.<channel>".
+struct ImageLayer {
+    std::string name;
+    std::vector<std::string> channels;
+    std::vector<float> values;
+};
+
 std::unique_ptr<RGBSpectrum[]> ReadImage(const std::string &name,
                                          Point2i *resolution);
 RGBSpectrum *ReadImageEXR(const std::string &name, int *width,
                           int *height, Bounds2i *dataWindow = nullptr,
                           Bounds2i *displayWindow = nullptr);
 
+// _layers_ are only written to EXR files and are dropped, with a warning,
+// for other formats
 void WriteImage(const std::string &name, const float *rgb,
-                const Bounds2i &outputBounds, const Point2i &totalResolution);
+                const Bounds2i &outputBounds, const Point2i &totalResolution,
+                const std::vector<ImageLayer> &layers = {});
+// Encodes and writes the image on a background I/O thread. If a previous
+// image with the same name is still waiting to be written, it is replaced.
+void WriteImageAsync(const std::string &name, std::unique_ptr<float[]> rgb,
+                     const Bounds2i &outputBounds,
+                     const Point2i &totalResolution,
+                     std::vector<ImageLayer> layers = {});
+// Blocks until all images passed to WriteImageAsync() have been written;
+// programs call it before they exit, so that no image is still being
+// written while static objects are destroyed
+void WaitForImageWrites();
+
+// Writes a scanline EXR image a few rows at a time, from the top of
+// _outputBounds_ down, so that images too large to keep in memory can be
+// written as they are rendered. The file is complete once all rows have
+// been written and the writer is destroyed.
+class StreamingImageWriter {
+  public:
+    // StreamingImageWriter Public Methods
+    StreamingImageWriter(const std::string &name, const Bounds2i &outputBounds,
+                         const Point2i &totalResolution);
+    ~StreamingImageWriter();
+    // False if the file couldn't be created or a write failed; further
+    // writes are ignored
+    bool Ok() const { return file != nullptr; }
+    // Writes the next _nRows_ rows of the image, given as RGB triples
+    void WriteRows(const float *rgb, int nRows);
+    int RowsWritten() const { return rowsWritten; }
+
+  private:
+    // StreamingImageWriter Private Data
+    // Wraps the OpenEXR output file, so that its headers aren't needed here
+    struct ExrFile;
+    std::unique_ptr<ExrFile> file;
+    const std::string name;
+    const Bounds2i outputBounds;
+    int rowsWritten = 0;
+};
 
 }  // namespace pbrt
 
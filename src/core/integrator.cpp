@@ -5,19 +5,47 @@
 #include "sampling.h"
 #include "parallel.h"
 #include "film.h"
+#include "lightdistrib.h"
 #include "sampler.h"
 #include "integrator.h"
 #include "progressreporter.h"
+#include "tilescheduler.h"
+#include "distributed.h"
 #include "camera.h"
+#include "lowdiscrepancy.h"
 #include "stats.h"
 
 namespace pbrt {
 
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_COUNTER("Integrator/Camera paths with AOVs", nAOVHits);
 
 // Integrator Method Definitions
 Integrator::~Integrator() {}
 
+void Integrator::BeginHeatmap(const Film &film, TileScheduler *scheduler) {
+    heatmap.reset();
+    if (!heatmapSettings.filename.empty())
+        heatmap.reset(new CostHeatmap(film.croppedPixelBounds));
+    if (heatmapSettings.tileCosts.empty()) return;
+    // Streaming films need tiles to finish from the top of the image down
+    if (film.Streaming()) {
+        Warning("Tile costs aren't used to schedule streaming films");
+        return;
+    }
+    std::vector<TileCost> tiles;
+    if (!ReadTileCosts(heatmapSettings.tileCosts, &tiles)) return;
+    for (const TileCost &tile : tiles)
+        scheduler->AddCost(tile.bounds, tile.seconds);
+    scheduler->NextPass();
+}
+
+void Integrator::WriteHeatmap() {
+    if (!heatmap) return;
+    heatmap->Write(heatmapSettings.filename);
+    heatmap.reset();
+}
+
 // Integrator Utility Functions
 Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
                                 MemoryArena &arena, Sampler &sampler,
@@ -73,6 +101,24 @@ Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                           scene, sampler, arena, handleMedia) / lightPdf;
 }
 
+// Chooses the light with _lightDistrib_, which may take the point's
+// surface normal into account.
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               MemoryArena &arena, Sampler &sampler,
+                               bool handleMedia,
+                               const LightDistribution &lightDistrib) {
+    ProfilePhase p(Prof::DirectLighting);
+    if (scene.lights.empty()) return Spectrum(0.f);
+    float lightPdf;
+    int lightNum = lightDistrib.Sample(it.p, it.n, sampler.Get1D(), &lightPdf);
+    if (lightPdf == 0) return Spectrum(0.f);
+    const std::shared_ptr<Light> &light = scene.lights[lightNum];
+    Point2f uLight = sampler.Get2D();
+    Point2f uScattering = sampler.Get2D();
+    return EstimateDirect(it, uScattering, *light, uLight,
+                          scene, sampler, arena, handleMedia) / lightPdf;
+}
+
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
@@ -192,118 +238,223 @@ std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
         new Distribution1D(&lightPower[0], lightPower.size()));
 }
 
+void RecordAOVs(const SurfaceInteraction &isect, const Spectrum &beta,
+                const Point3f &pCamera, AOVSample *aov) {
+    ProfilePhase p(Prof::AOVAlbedo);
+    // The albedo is estimated with a fixed Hammersley point set, so that it
+    // doesn't use any of the sampler's dimensions; BxDFs with a closed form
+    // albedo, like Lambertian reflection, ignore the points
+    static constexpr int nAlbedoSamples = 16;
+    static const std::vector<Point2f> albedoSamples = []() {
+        std::vector<Point2f> u(nAlbedoSamples);
+        for (int i = 0; i < nAlbedoSamples; ++i)
+            u[i] = Point2f((i + 0.5f) / nAlbedoSamples, RadicalInverse(0, i));
+        return u;
+    }();
+    aov->hit = true;
+    aov->albedo =
+        beta * isect.bsdf->rho(isect.wo, nAlbedoSamples, albedoSamples.data());
+    aov->n = isect.shading.n;
+    aov->depth = Distance(pCamera, isect.p);
+    aov->primitiveId = isect.primitive ? isect.primitive->GetId() : -1;
+    ++nAOVHits;
+}
+
+// Returns the (exclusive) last sample index of each rendering pass. A
+// progressive render starts with a single sample per pixel and then
+// doubles the sample count with each pass.
+static std::vector<int64_t> ComputePassSampleEnds(int64_t spp,
+                                                  bool progressive) {
+    std::vector<int64_t> passEnd;
+    if (!progressive) {
+        passEnd.push_back(spp);
+        return passEnd;
+    }
+    for (int64_t end = 1; end < spp; end *= 2) passEnd.push_back(end);
+    passEnd.push_back(spp);
+    return passEnd;
+}
+
 // SamplerIntegrator Method Definitions
+std::unique_ptr<FilmTile> SamplerIntegrator::RenderTile(
+    const Scene &scene, const TileJob &job) const {
+    // Allocate _MemoryArena_ for tile
+    MemoryArena arena;
+
+    // Get sampler instance for tile
+    std::unique_ptr<Sampler> tileSampler = sampler->Clone(job.seed);
+    const Bounds2i &tileBounds = job.tile.bounds;
+    LOG(INFO) << "Starting image tile " << tileBounds;
+
+    // Get _FilmTile_ for tile
+    std::unique_ptr<FilmTile> filmTile = camera->film->GetFilmTile(tileBounds);
+    CostMeter tileCost(heatmap.get());
+
+    // Loop over pixels in tile to render them
+    for (Point2i pixel : tileBounds) {
+        CostMeter pixelCost(heatmap.get());
+        {
+            ProfilePhase pp(Prof::StartPixel);
+            tileSampler->StartPixel(pixel);
+        }
+
+        // Do this check after the StartPixel() call; this keeps
+        // the usage of RNG values from (most) Samplers that use
+        // RNGs consistent, which improves reproducability /
+        // debugging.
+        if (!InsideExclusive(pixel, pixelBounds))
+            continue;
+
+        // Skip ahead to the first sample of the current pass
+        if (!tileSampler->SetSampleNumber(job.sampleStart)) continue;
+
+        do {
+            // Initialize _CameraSample_ for current sample
+            CameraSample cameraSample = tileSampler->GetCameraSample(
+                pixel, camera->film->GetFilterSampler());
+
+            // Generate camera ray for current sample
+            RayDifferential ray;
+            float rayWeight =
+                camera->GenerateRayDifferential(cameraSample, &ray);
+            ray.ScaleDifferentials(
+                1 / std::sqrt((float)tileSampler->samplesPerPixel));
+            ++nCameraRays;
+
+            // Evaluate radiance along camera ray
+            Spectrum L(0.f);
+            AOVSample aov;
+            AOVSample *aovPtr = camera->film->HasAOVs() ? &aov : nullptr;
+            if (rayWeight > 0)
+                L = Li(ray, scene, *tileSampler, arena, 0, aovPtr);
+
+            // Issue warning if unexpected radiance value returned
+            if (L.HasNaNs()) {
+                LOG(ERROR) << StringPrintf(
+                    "Not-a-number radiance value returned "
+                    "for pixel (%d, %d), sample %d. Setting to black.",
+                    pixel.x, pixel.y,
+                    (int)tileSampler->CurrentSampleNumber());
+                L = Spectrum(0.f);
+            } else if (L.y() < -1e-5) {
+                LOG(ERROR) << StringPrintf(
+                    "Negative luminance value, %f, returned "
+                    "for pixel (%d, %d), sample %d. Setting to black.",
+                    L.y(), pixel.x, pixel.y,
+                    (int)tileSampler->CurrentSampleNumber());
+                L = Spectrum(0.f);
+            } else if (std::isinf(L.y())) {
+                  LOG(ERROR) << StringPrintf(
+                    "Infinite luminance value returned "
+                    "for pixel (%d, %d), sample %d. Setting to black.",
+                    pixel.x, pixel.y,
+                    (int)tileSampler->CurrentSampleNumber());
+                L = Spectrum(0.f);
+            }
+            VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
+                ray << " -> L = " << L;
+
+            // Add camera ray's contribution to image
+            filmTile->AddPixelSample(pixel, cameraSample.pFilm,
+                                     cameraSample.filterWeight, L, rayWeight,
+                                     aovPtr);
+
+            // Free _MemoryArena_ memory from computing image sample
+            // value
+            arena.Reset();
+        } while (tileSampler->StartNextSample() &&
+                 tileSampler->CurrentSampleNumber() < job.sampleEnd);
+        pixelCost.RecordPixel(pixel);
+    }
+    tileCost.RecordTile(tileBounds, job.sampleStart, job.sampleEnd);
+    LOG(INFO) << "Finished image tile " << tileBounds;
+    return filmTile;
+}
+
 void SamplerIntegrator::Render(const Scene &scene) {
     Preprocess(scene, *sampler);
+    if (control && control->tileWorker) {
+        // Render the tiles that the coordinator assigns until it hangs up
+        TileWorker &worker = *control->tileWorker;
+        ParallelFor([&](int64_t) {
+            TileJob job;
+            while (!Cancelled() && worker.NextTile(&job)) {
+                std::unique_ptr<FilmTile> filmTile = RenderTile(scene, job);
+                if (!worker.SendTile(job, *filmTile)) break;
+            }
+        }, MaxThreadIndex());
+        return;
+    }
     // Render image tiles in parallel
 
-    // Compute number of tiles, _nTiles_, to use for parallel rendering
-    Bounds2i sampleBounds = camera->film->GetSampleBounds();
-    Vector2i sampleExtent = sampleBounds.Diagonal();
+    // Partition the image into tiles; interactive renders start from the
+    // center of the image, while streaming films need rows of tiles to be
+    // finished from the top down, all in one pass
+    Film *film = camera->film;
+    Bounds2i sampleBounds = film->GetSampleBounds();
     const int tileSize = 16;
-    Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
-                   (sampleExtent.y + tileSize - 1) / tileSize);
-    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
-    {
-        ParallelFor2D([&](Point2i tile) {
-            // Render section of image corresponding to _tile_
-
-            // Allocate _MemoryArena_ for tile
-            MemoryArena arena;
-
-            // Get sampler instance for tile
-            int seed = tile.y * nTiles.x + tile.x;
-            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
-
-            // Compute sample bounds for tile
-            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
-            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
-            LOG(INFO) << "Starting image tile " << tileBounds;
-
-            // Get _FilmTile_ for tile
-            std::unique_ptr<FilmTile> filmTile =
-                camera->film->GetFilmTile(tileBounds);
-
-            // Loop over pixels in tile to render them
-            for (Point2i pixel : tileBounds) {
-                {
-                    ProfilePhase pp(Prof::StartPixel);
-                    tileSampler->StartPixel(pixel);
-                }
-
-                // Do this check after the StartPixel() call; this keeps
-                // the usage of RNG values from (most) Samplers that use
-                // RNGs consistent, which improves reproducability /
-                // debugging.
-                if (!InsideExclusive(pixel, pixelBounds))
-                    continue;
-
-                do {
-                    // Initialize _CameraSample_ for current sample
-                    CameraSample cameraSample =
-                        tileSampler->GetCameraSample(pixel);
-
-                    // Generate camera ray for current sample
-                    RayDifferential ray;
-                    float rayWeight =
-                        camera->GenerateRayDifferential(cameraSample, &ray);
-                    ray.ScaleDifferentials(
-                        1 / std::sqrt((float)tileSampler->samplesPerPixel));
-                    ++nCameraRays;
-
-                    // Evaluate radiance along camera ray
-                    Spectrum L(0.f);
-                    if (rayWeight > 0) L = Li(ray, scene, *tileSampler, arena);
-
-                    // Issue warning if unexpected radiance value returned
-                    if (L.HasNaNs()) {
-                        LOG(ERROR) << StringPrintf(
-                            "Not-a-number radiance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (L.y() < -1e-5) {
-                        LOG(ERROR) << StringPrintf(
-                            "Negative luminance value, %f, returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            L.y(), pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (std::isinf(L.y())) {
-                          LOG(ERROR) << StringPrintf(
-                            "Infinite luminance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    }
-                    VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
-                        ray << " -> L = " << L;
-
-                    // Add camera ray's contribution to image
-                    filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
-
-                    // Free _MemoryArena_ memory from computing image sample
-                    // value
-                    arena.Reset();
-                } while (tileSampler->StartNextSample());
-            }
-            LOG(INFO) << "Finished image tile " << tileBounds;
-
+    bool progressive = Progressive();
+    if (film->Streaming() && progressive) {
+        Warning("Streaming films can't be rendered progressively");
+        progressive = false;
+    }
+    TileScheduler scheduler(sampleBounds, tileSize,
+                            film->Streaming() ? TileOrder::RowMajor
+                            : progressive     ? TileOrder::Spiral
+                                              : TileOrder::Hilbert);
+    std::vector<int64_t> passEnd = ComputePassSampleEnds(
+        sampler->samplesPerPixel, progressive);
+    BeginHeatmap(*film, &scheduler);
+    if (film->Streaming()) {
+        std::vector<Bounds2i> tileBounds;
+        for (const ScheduledTile &tile : scheduler.Tiles())
+            tileBounds.push_back(tile.bounds);
+        film->BeginStreaming(tileBounds);
+    }
+    int nPasses = passEnd.size();
+    ProgressReporter reporter(sampleBounds.Area() * nPasses, "Rendering");
+    for (int pass = 0; pass < nPasses && !Cancelled(); ++pass) {
+        int64_t passStart = (pass == 0) ? 0 : passEnd[pass - 1];
+        auto tileJob = [&](const ScheduledTile &tile) {
+            return TileJob{tile, pass * scheduler.MaxTileId() + tile.id,
+                           passStart, passEnd[pass], 0};
+        };
+        auto mergeTile = [&](const TileJob &job,
+                             std::unique_ptr<FilmTile> filmTile) {
             // Merge image tile into _Film_
             camera->film->MergeFilmTile(std::move(filmTile));
-            reporter.Update();
-        }, nTiles);
-        reporter.Done();
+            reporter.Update(job.tile.bounds.Area());
+        };
+        if (control && control->tileCoordinator) {
+            // Farm the pass's tiles out to the workers, and render any
+            // that they couldn't take here
+            std::vector<TileJob> jobs;
+            for (const ScheduledTile &tile : scheduler.Tiles())
+                jobs.push_back(tileJob(tile));
+            jobs = control->tileCoordinator->RenderTiles(
+                std::move(jobs), camera->film, mergeTile, control->cancelled);
+            ParallelFor([&](int64_t i) {
+                if (Cancelled()) return;
+                mergeTile(jobs[i], RenderTile(scene, jobs[i]));
+            }, jobs.size());
+        } else
+            scheduler.ParallelForTiles([&](const ScheduledTile &tile) {
+                // Render section of image corresponding to _tile_
+                if (Cancelled()) return;
+                TileJob job = tileJob(tile);
+                mergeTile(job, RenderTile(scene, job));
+            });
+        scheduler.NextPass();
+        if (pass + 1 < nPasses) PassFinished(scene, pass);
+        if (control) ++control->passesDone;
     }
+    reporter.Done();
+    if (Cancelled()) LOG(INFO) << "Rendering cancelled";
     LOG(INFO) << "Rendering finished";
 
     // Save final image after rendering
     camera->film->WriteImage();
+    WriteHeatmap();
 }
 
 Spectrum SamplerIntegrator::SpecularReflect(
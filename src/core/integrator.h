@@ -9,15 +9,56 @@
 #include "reflection.h"
 #include "sampler.h"
 #include "material.h"
+#include "heatmap.h"
+#include <atomic>
 
 namespace pbrt {
 
+// RenderControl Declarations
+// Shared between an _Integrator_ and whoever drives it (e.g. the Qt
+// viewer), so that a render running on another thread can be observed
+// and cancelled.
+struct RenderControl {
+    // Render the image in passes of increasing sample count, so that a
+    // complete low-quality image is available early on.
+    bool progressive = false;
+    std::atomic<bool> cancelled{false};
+    std::atomic<int> passesDone{0};
+    // What readers of the film pass to Film::GetRGB() to scale the splats
+    // resolved so far, as the final image will be; splatting integrators
+    // update it before counting a pass as done.
+    std::atomic<float> splatScale{1};
+    // When set, a SamplerIntegrator farms its tiles out to worker
+    // processes, or renders the tiles a coordinator assigns to it, instead
+    // of rendering the whole image itself; see core/distributed.h.
+    TileCoordinator *tileCoordinator = nullptr;
+    TileWorker *tileWorker = nullptr;
+};
+
 // Integrator Declarations
 class Integrator {
   public:
     // Integrator Interface
     virtual ~Integrator();
     virtual void Render(const Scene &scene) = 0;
+    void SetRenderControl(std::shared_ptr<RenderControl> c) { control = c; }
+    bool Cancelled() const { return control && control->cancelled; }
+    void SetHeatmapSettings(const HeatmapSettings &s) { heatmapSettings = s; }
+
+  protected:
+    // Integrator Protected Methods
+    // Tile-based integrators call these around their render loops: the
+    // first creates _heatmap_ if costs are to be recorded and schedules
+    // _scheduler_'s first pass by the tile costs given in the settings;
+    // the second writes the heatmap and frees it.
+    void BeginHeatmap(const Film &film, TileScheduler *scheduler);
+    void WriteHeatmap();
+
+    // Integrator Protected Data
+    std::shared_ptr<RenderControl> control;
+    HeatmapSettings heatmapSettings;
+    // Null unless costs are being recorded; see core/heatmap.h
+    std::unique_ptr<CostHeatmap> heatmap;
 };
 
 Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
@@ -28,6 +69,10 @@ Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                                MemoryArena &arena, Sampler &sampler,
                                bool handleMedia = false,
                                const Distribution1D *lightDistrib = nullptr);
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               MemoryArena &arena, Sampler &sampler,
+                               bool handleMedia,
+                               const LightDistribution &lightDistrib);
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uShading,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
@@ -35,6 +80,11 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uShading,
                         bool specular = false);
 std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
     const Scene &scene);
+// Records the AOVs of a camera path at _isect_, its first surface with a
+// non-specular BSDF; _beta_ is the path's throughput up to _isect_ and
+// _pCamera_ the origin of the camera ray.
+void RecordAOVs(const SurfaceInteraction &isect, const Spectrum &beta,
+                const Point3f &pCamera, AOVSample *aov);
 
 // SamplerIntegrator Declarations
 class SamplerIntegrator : public Integrator {
@@ -45,10 +95,19 @@ class SamplerIntegrator : public Integrator {
                       const Bounds2i &pixelBounds)
         : camera(camera), sampler(sampler), pixelBounds(pixelBounds) {}
     virtual void Preprocess(const Scene &scene, Sampler &sampler) {}
+    // Called between rendering passes, when no Li() calls are in flight
+    virtual void PassFinished(const Scene &scene, int pass) {}
+    virtual bool Progressive() const { return control && control->progressive; }
     void Render(const Scene &scene);
+    // Takes samples _job.sampleStart_ through _job.sampleEnd_ - 1 in each
+    // pixel of _job.tile_
+    std::unique_ptr<FilmTile> RenderTile(const Scene &scene,
+                                         const TileJob &job) const;
+    // If _aov_ is given, integrators that support AOVs fill it in; see
+    // RecordAOVs()
     virtual Spectrum Li(const RayDifferential &ray, const Scene &scene,
-                        Sampler &sampler, MemoryArena &arena,
-                        int depth = 0) const = 0;
+                        Sampler &sampler, MemoryArena &arena, int depth = 0,
+                        AOVSample *aov = nullptr) const = 0;
     Spectrum SpecularReflect(const RayDifferential &ray,
                              const SurfaceInteraction &isect,
                              const Scene &scene, Sampler &sampler,
@@ -61,9 +120,6 @@ class SamplerIntegrator : public Integrator {
   protected:
     // SamplerIntegrator Protected Data
     std::shared_ptr<const Camera> camera;
-
-  private:
-    // SamplerIntegrator Private Data
     std::shared_ptr<Sampler> sampler;
     const Bounds2i pixelBounds;
 };
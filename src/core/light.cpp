@@ -4,12 +4,88 @@
 #include "sampling.h"
 #include "stats.h"
 #include "paramset.h"
+#include "shape.h"
 
 namespace pbrt {
 
 STAT_COUNTER("Scene/Lights", numLights);
 STAT_COUNTER("Scene/AreaLights", numAreaLights);
 
+// LightBounds Method Definitions
+LightBounds::LightBounds(const Bounds3f &bounds, const Vector3f &w, float phi,
+                         float cosTheta_o, float cosTheta_e, bool twoSided)
+    : bounds(bounds),
+      w(Normalize(w)),
+      phi(phi),
+      cosTheta_o(cosTheta_o),
+      cosTheta_e(cosTheta_e),
+      twoSided(twoSided) {}
+
+// The cosine and sine of max(0, a - b), given the sines and cosines of
+// the angles _a_ and _b_.
+static float CosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    if (cosA > cosB) return 1;
+    return cosA * cosB + sinA * sinB;
+}
+
+static float SinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    if (cosA > cosB) return 0;
+    return sinA * cosB - cosA * sinB;
+}
+
+static float SafeSqrt(float x) { return std::sqrt(std::max((float)0, x)); }
+
+float LightBounds::Importance(const Point3f &p, const Normal3f &n) const {
+    // Clamp the squared distance to the bounds' center to the bounds'
+    // size, so that points close to or inside the bounds get finite
+    // importance
+    Point3f pc;
+    float radius;
+    bounds.BoundingSphere(&pc, &radius);
+    float d2 = std::max(DistanceSquared(p, pc), radius * radius);
+
+    // Compute the angle between the direction from the bounds to _p_ and
+    // the normal cone, less the angles spanned by the cone and by the
+    // bounds as seen from _p_
+    Vector3f wi = p - pc;
+    if (wi.LengthSquared() > 0) wi = Normalize(wi);
+    float cosTheta_w = Dot(w, wi);
+    if (twoSided) cosTheta_w = std::abs(cosTheta_w);
+    float sinTheta_w = SafeSqrt(1 - cosTheta_w * cosTheta_w);
+    float cosTheta_b = -1;
+    if (DistanceSquared(p, pc) > radius * radius)
+        cosTheta_b = SafeSqrt(1 - radius * radius / DistanceSquared(p, pc));
+    float sinTheta_b = SafeSqrt(1 - cosTheta_b * cosTheta_b);
+    float sinTheta_o = SafeSqrt(1 - cosTheta_o * cosTheta_o);
+    float cosTheta_x =
+        CosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    float sinTheta_x =
+        SinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    float cosThetap =
+        CosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+    if (cosThetap <= cosTheta_e) return 0;
+    float importance = phi * cosThetap / d2;
+
+    // Account for the cosine at the receiving surface, if any
+    if (n != Normal3f(0, 0, 0)) {
+        float cosTheta_i = AbsDot(wi, n);
+        float sinTheta_i = SafeSqrt(1 - cosTheta_i * cosTheta_i);
+        importance *=
+            CosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+    }
+    return std::max(importance, (float)0);
+}
+
+LightBounds Union(const LightBounds &a, const LightBounds &b) {
+    if (a.phi == 0) return b;
+    if (b.phi == 0) return a;
+    DirectionCone cone = Union(DirectionCone(a.w, a.cosTheta_o),
+                               DirectionCone(b.w, b.cosTheta_o));
+    return LightBounds(Union(a.bounds, b.bounds), cone.w, a.phi + b.phi,
+                       cone.cosTheta, std::min(a.cosTheta_e, b.cosTheta_e),
+                       a.twoSided || b.twoSided);
+}
+
 // Light Method Definitions
 Light::Light(int flags, const Transform &LightToWorld,
              const MediumInterface &mediumInterface, int nSamples)
@@ -21,6 +21,30 @@ inline bool IsDeltaLight(int flags) {
            flags & (int)LightFlags::DeltaDirection;
 }
 
+// LightBounds Declarations
+// Bounds on where a light is and in which directions it emits: emission
+// leaves points in _bounds_ with normals within _cosTheta_o_ of _w_, and
+// spreads at most _cosTheta_e_ from those normals (a hemisphere for area
+// lights). _phi_ is the light's emitted power.
+struct LightBounds {
+    LightBounds() = default;
+    LightBounds(const Bounds3f &bounds, const Vector3f &w, float phi,
+                float cosTheta_o, float cosTheta_e, bool twoSided);
+    // Returns a conservative estimate of the light's contribution at _p_,
+    // which is zero only if the light cannot illuminate _p_. _n_ is the
+    // surface normal at _p_, or zero for points in media.
+    float Importance(const Point3f &p, const Normal3f &n) const;
+    Point3f Centroid() const { return (bounds.pMin + bounds.pMax) / 2; }
+
+    Bounds3f bounds;
+    Vector3f w;
+    float phi = 0;
+    float cosTheta_o = 1, cosTheta_e = 1;
+    bool twoSided = false;
+};
+
+LightBounds Union(const LightBounds &a, const LightBounds &b);
+
 // Light Declarations
 class Light {
   public:
@@ -40,6 +64,9 @@ class Light {
                                float *pdfDir) const = 0;
     virtual void Pdf_Le(const Ray &ray, const Normal3f &nLight, float *pdfPos,
                         float *pdfDir) const = 0;
+    // Returns false for lights without finite bounds, like infinite and
+    // distant lights.
+    virtual bool Bounds(LightBounds *bounds) const { return false; }
 
     // Light Public Data
     const int flags;
@@ -10,6 +10,11 @@ namespace pbrt {
 
 LightDistribution::~LightDistribution() {}
 
+int LightDistribution::Sample(const Point3f &p, const Normal3f &n, float u,
+                              float *pdf) const {
+    return Lookup(p)->SampleDiscrete(u, pdf);
+}
+
 std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
     const std::string &name, const Scene &scene) {
     if (name == "uniform" || scene.lights.size() == 1)
@@ -21,6 +26,9 @@ std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
     else if (name == "spatial")
         return std::unique_ptr<LightDistribution>{
             new SpatialLightDistribution(scene)};
+    else if (name == "bvh")
+        return std::unique_ptr<LightDistribution>{
+            new BVHLightDistribution(scene)};
     else {
         Error(
             "Light sample distribution type \"%s\" unknown. Using \"spatial\".",
@@ -194,22 +202,24 @@ const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
     }
 }
 
-Distribution1D *
-SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
-    ProfilePhase _(Prof::LightDistribCreation);
-    ++nCreated;
-    ++nDistributions;
-
-    // Compute the world-space bounding box of the voxel corresponding to
-    // |pi|.
+// Compute the world-space bounding box of the voxel corresponding to |pi|.
+Bounds3f SpatialLightDistribution::VoxelBounds(Point3i pi) const {
     Point3f p0(float(pi[0]) / float(nVoxels[0]),
                float(pi[1]) / float(nVoxels[1]),
                float(pi[2]) / float(nVoxels[2]));
     Point3f p1(float(pi[0] + 1) / float(nVoxels[0]),
                float(pi[1] + 1) / float(nVoxels[1]),
                float(pi[2] + 1) / float(nVoxels[2]));
-    Bounds3f voxelBounds(scene.WorldBound().Lerp(p0),
-                         scene.WorldBound().Lerp(p1));
+    return Bounds3f(scene.WorldBound().Lerp(p0), scene.WorldBound().Lerp(p1));
+}
+
+Distribution1D *
+SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
+    ProfilePhase _(Prof::LightDistribCreation);
+    ++nCreated;
+    ++nDistributions;
+
+    Bounds3f voxelBounds = VoxelBounds(pi);
 
     // Compute the sampling distribution. Sample a number of points inside
     // voxelBounds using a 3D Halton sequence; at each one, sample each
@@ -264,4 +274,208 @@ SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
     return new Distribution1D(&lightContrib[0], int(lightContrib.size()));
 }
 
+///////////////////////////////////////////////////////////////////////////
+// BVHLightDistribution
+
+STAT_COUNTER("BVHLightDistribution/Tree nodes", nLightBVHNodes);
+
+// The measure of the directions a light with the given normal cone and
+// emission spread can emit into, as used by the cost function below.
+static float ConeMeasure(float cosTheta_o, float cosTheta_e) {
+    float theta_o = std::acos(Clamp(cosTheta_o, -1, 1));
+    float theta_e = std::acos(Clamp(cosTheta_e, -1, 1));
+    float theta_w = std::min(theta_o + theta_e, Pi);
+    float sinTheta_o = std::sin(theta_o);
+    return 2 * Pi * (1 - cosTheta_o) +
+           Pi / 2 * (2 * theta_w * sinTheta_o - std::cos(theta_o - 2 * theta_w) -
+                     2 * theta_o * sinTheta_o + cosTheta_o);
+}
+
+// Cost of a node in the light BVH: a surface area heuristic weighted by
+// power and by the spread of emitted directions. Splits across the thin
+// dimensions of the parent's bounds are penalized by _Kr_.
+static float LightBVHCost(const LightBounds &b, const Bounds3f &parent,
+                          int dim) {
+    Vector3f d = parent.Diagonal();
+    float Kr = d[dim] > 0 ? d[parent.MaximumExtent()] / d[dim] : 1;
+    return b.phi * ConeMeasure(b.cosTheta_o, b.cosTheta_e) * Kr *
+           b.bounds.SurfaceArea();
+}
+
+BVHLightDistribution::BVHLightDistribution(const Scene &scene)
+    : SpatialLightDistribution(scene, 16) {
+    std::vector<BVHBuildItem> items;
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        LightBounds lb;
+        if (!scene.lights[i]->Bounds(&lb))
+            infiniteLights.push_back(i);
+        else if (lb.phi > 0)
+            items.push_back({int(i), lb});
+    }
+    if (!items.empty()) BuildBVH(items, 0, items.size());
+    nLightBVHNodes += nodes.size();
+    LOG(INFO) << "BVHLightDistribution: " << items.size() << " lights in " <<
+        nodes.size() << " nodes, " << infiniteLights.size() <<
+        " infinite lights";
+}
+
+int BVHLightDistribution::BuildBVH(std::vector<BVHBuildItem> &items,
+                                   int start, int end) {
+    int nodeIndex = nodes.size();
+    nodes.push_back(LightBVHNode());
+    if (end - start == 1) {
+        nodes[nodeIndex] = {items[start].bounds, items[start].lightIndex, true};
+        return nodeIndex;
+    }
+
+    // Choose the split that minimizes the cost of the two children, using
+    // buckets along each axis of the bounds of the light centroids
+    Bounds3f bounds, centroidBounds;
+    for (int i = start; i < end; ++i) {
+        bounds = Union(bounds, items[i].bounds.bounds);
+        centroidBounds = Union(centroidBounds, items[i].bounds.Centroid());
+    }
+    constexpr int nBuckets = 12;
+    float minCost = Infinity;
+    int minCostBucket = -1, minCostDim = -1;
+    for (int dim = 0; dim < 3; ++dim) {
+        if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) continue;
+        LightBounds buckets[nBuckets];
+        for (int i = start; i < end; ++i) {
+            int b = nBuckets * centroidBounds.Offset(
+                                   items[i].bounds.Centroid())[dim];
+            b = std::min(b, nBuckets - 1);
+            buckets[b] = Union(buckets[b], items[i].bounds);
+        }
+        for (int split = 0; split < nBuckets - 1; ++split) {
+            LightBounds b0, b1;
+            for (int i = 0; i <= split; ++i) b0 = Union(b0, buckets[i]);
+            for (int i = split + 1; i < nBuckets; ++i)
+                b1 = Union(b1, buckets[i]);
+            float cost = LightBVHCost(b0, bounds, dim) +
+                         LightBVHCost(b1, bounds, dim);
+            if (cost < minCost) {
+                minCost = cost;
+                minCostBucket = split;
+                minCostDim = dim;
+            }
+        }
+    }
+
+    // Partition the lights, splitting them in half if the buckets could
+    // not separate them
+    int mid;
+    if (minCostDim == -1)
+        mid = (start + end) / 2;
+    else {
+        BVHBuildItem *pmid = std::partition(
+            &items[start], &items[end - 1] + 1, [&](const BVHBuildItem &item) {
+                int b = nBuckets * centroidBounds.Offset(
+                                       item.bounds.Centroid())[minCostDim];
+                return std::min(b, nBuckets - 1) <= minCostBucket;
+            });
+        mid = pmid - &items[0];
+        if (mid == start || mid == end) mid = (start + end) / 2;
+    }
+
+    BuildBVH(items, start, mid);
+    int second = BuildBVH(items, mid, end);
+    nodes[nodeIndex] = {Union(nodes[nodeIndex + 1].bounds, nodes[second].bounds),
+                        second, false};
+    return nodeIndex;
+}
+
+int BVHLightDistribution::Sample(const Point3f &p, const Normal3f &n, float u,
+                                 float *pdf) const {
+    ProfilePhase _(Prof::LightDistribLookup);
+    // Choose between the infinite lights and the tree, which counts as one
+    // more light
+    int nInfinite = infiniteLights.size();
+    int nChoices = nInfinite + (nodes.empty() ? 0 : 1);
+    if (nChoices == 0) {
+        *pdf = 0;
+        return -1;
+    }
+    float pInfinite = float(nInfinite) / float(nChoices);
+    if (u < pInfinite) {
+        int index = std::min(int(u / pInfinite * nInfinite), nInfinite - 1);
+        *pdf = pInfinite / nInfinite;
+        return infiniteLights[index];
+    }
+
+    // Descend the tree, choosing children in proportion to their importance
+    // and reusing _u_ at each level
+    u = std::min((u - pInfinite) / (1 - pInfinite), OneMinusEpsilon);
+    float pmf = 1 - pInfinite;
+    int node = 0;
+    if (nodes[0].isLeaf && nodes[0].bounds.Importance(p, n) == 0) {
+        *pdf = 0;
+        return -1;
+    }
+    while (!nodes[node].isLeaf) {
+        int children[2] = {node + 1, nodes[node].childOrLightIndex};
+        float ci[2] = {nodes[children[0]].bounds.Importance(p, n),
+                       nodes[children[1]].bounds.Importance(p, n)};
+        if (ci[0] == 0 && ci[1] == 0) {
+            *pdf = 0;
+            return -1;
+        }
+        float p0 = ci[0] / (ci[0] + ci[1]);
+        if (u < p0) {
+            node = children[0];
+            u = std::min(u / p0, OneMinusEpsilon);
+            pmf *= p0;
+        } else {
+            node = children[1];
+            u = std::min((u - p0) / (1 - p0), OneMinusEpsilon);
+            pmf *= 1 - p0;
+        }
+    }
+    *pdf = pmf;
+    return nodes[node].childOrLightIndex;
+}
+
+// Adds to |prob| the probability of Sample() choosing each light below
+// |node| at |p|, given the probability |pmf| of reaching |node|.
+void BVHLightDistribution::ComputeProbabilities(int node, const Point3f &p,
+                                                float pmf,
+                                                std::vector<float> &prob) const {
+    if (nodes[node].isLeaf) {
+        prob[nodes[node].childOrLightIndex] += pmf;
+        return;
+    }
+    int children[2] = {node + 1, nodes[node].childOrLightIndex};
+    float ci[2] = {nodes[children[0]].bounds.Importance(p, Normal3f()),
+                   nodes[children[1]].bounds.Importance(p, Normal3f())};
+    if (ci[0] == 0 && ci[1] == 0) return;
+    for (int c = 0; c < 2; ++c)
+        if (ci[c] > 0)
+            ComputeProbabilities(children[c], p, pmf * ci[c] / (ci[0] + ci[1]),
+                                 prob);
+}
+
+Distribution1D *BVHLightDistribution::ComputeDistribution(Point3i pi) const {
+    ProfilePhase _(Prof::LightDistribCreation);
+    ++nCreated;
+    ++nDistributions;
+
+    // Evaluate the tree at the voxel's center
+    Bounds3f voxelBounds = VoxelBounds(pi);
+    Point3f pc = voxelBounds.Lerp(Point3f(.5f, .5f, .5f));
+    std::vector<float> prob(scene.lights.size(), float(0));
+    int nChoices = infiniteLights.size() + (nodes.empty() ? 0 : 1);
+    for (int index : infiniteLights) prob[index] = float(1) / nChoices;
+    if (!nodes.empty())
+        ComputeProbabilities(0, pc, float(1) / nChoices, prob);
+
+    // As with the spatial distribution, make sure that every light keeps a
+    // small probability, since lights may still reach other points in the
+    // voxel
+    float avgProb = std::accumulate(prob.begin(), prob.end(), float(0)) /
+                    prob.size();
+    float minProb = (avgProb > 0) ? .001 * avgProb : 1;
+    for (float &p : prob) p = std::max(p, minProb);
+    return new Distribution1D(&prob[0], int(prob.size()));
+}
+
 }  // namespace pbrt
@@ -3,6 +3,7 @@
 
 #include "pbrt.h"
 #include "geometry.h"
+#include "light.h"
 #include "sampling.h"
 #include <atomic>
 #include <functional>
@@ -22,6 +23,14 @@ class LightDistribution {
     // Given a point |p| in space, this method returns a (hopefully
     // effective) sampling distribution for light sources at that point.
     virtual const Distribution1D *Lookup(const Point3f &p) const = 0;
+
+    // Chooses a light to sample at |p|, where |n| is the surface normal
+    // there (or zero for points in participating media). Returns the
+    // light's index in Scene::lights and sets |pdf| to the probability of
+    // having chosen it; a zero |pdf| means no light could be chosen. The
+    // default implementation samples the distribution from Lookup().
+    virtual int Sample(const Point3f &p, const Normal3f &n, float u,
+                       float *pdf) const;
 };
 
 std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
@@ -71,12 +80,15 @@ class SpatialLightDistribution : public LightDistribution {
     ~SpatialLightDistribution();
     const Distribution1D *Lookup(const Point3f &p) const;
 
-  private:
+  protected:
     // Compute the sampling distribution for the voxel with integer
     // coordiantes given by "pi".
-    Distribution1D *ComputeDistribution(Point3i pi) const;
+    virtual Distribution1D *ComputeDistribution(Point3i pi) const;
+    Bounds3f VoxelBounds(Point3i pi) const;
 
     const Scene &scene;
+
+  private:
     int nVoxels[3];
 
     // The hash table is a fixed number of HashEntry structs (where we
@@ -92,6 +104,49 @@ class SpatialLightDistribution : public LightDistribution {
     size_t hashTableSize;
 };
 
+// A bounding volume hierarchy over the lights' spatial and directional
+// bounds (see LightBounds). Sample() descends the tree from the root,
+// choosing each child with probability proportional to an estimate of its
+// contribution at the shading point, so that choosing among many lights
+// (e.g. the triangles of an emissive mesh) costs O(log n). Lights without
+// bounds (infinite and distant lights) are chosen uniformly, with the
+// whole tree counting as one of them.
+//
+// Lookup() is needed by integrators that require a complete distribution
+// (BDPT); it reuses SpatialLightDistribution's voxel cache, filling each
+// voxel with the probabilities the tree gives at the voxel's center.
+class BVHLightDistribution : public SpatialLightDistribution {
+  public:
+    BVHLightDistribution(const Scene &scene);
+    int Sample(const Point3f &p, const Normal3f &n, float u,
+               float *pdf) const;
+
+  private:
+    // BVHLightDistribution Private Declarations
+    struct BVHBuildItem {
+        int lightIndex;
+        LightBounds bounds;
+    };
+    struct LightBVHNode {
+        LightBounds bounds;
+        // For interior nodes, the index of the second child; the first
+        // child immediately follows its parent. For leaves, the index of
+        // the light in Scene::lights.
+        int childOrLightIndex;
+        bool isLeaf;
+    };
+
+    // BVHLightDistribution Private Methods
+    int BuildBVH(std::vector<BVHBuildItem> &items, int start, int end);
+    void ComputeProbabilities(int node, const Point3f &p, float pmf,
+                              std::vector<float> &prob) const;
+    Distribution1D *ComputeDistribution(Point3i pi) const;
+
+    // BVHLightDistribution Private Data
+    std::vector<LightBVHNode> nodes;
+    std::vector<int> infiniteLights;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_LIGHTDISTRIB_H
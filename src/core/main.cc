@@ -1,110 +1,59 @@
-#include "twray.h"
+#include "camera.h"
+#include "checkpoint.h"
+#include "fileutil.h"
+#include "film.h"
+#include "parallel.h"
+#include "scenes.h"
+#include "session.h"
+#include "stats.h"
+#include "qt/qt.h"
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 using namespace pbrt;
 
-struct Parameters{
-    int width = 500;
-    int height = 500;
-    int samplePerPixel = 4;
-    int maxDepth = 5;
+// A render running on a background thread. The GUI thread only reads the
+// job's film (to display it) and its control block (to cancel it).
+struct RenderJob{
+    std::thread thread;
+    std::shared_ptr<const Camera> camera;
+    std::shared_ptr<RenderControl> control;
+    std::atomic<bool> finished{false};
 };
 
-void Render(Parameters param){
-
-    // World
-    std::vector<std::shared_ptr<Primitive>> objects;
-    std::vector<std::shared_ptr<Light>> lights;
-
-    // Medium
-    Medium *medium;
-    Vector3f sigma_a(0.05, 0.05, 0.05);
-    Vector3f sigma_s(0.1, 0.1, 0.1);
-    medium = add_medium("", sigma_a, sigma_s, 0.0, 1);
-    MediumInterface mi;
-
-    // Stanford bunny 265,-70,295
-    // float color[3] = {1.0, 1.0, 1.0};
-    // objects += add_stanford_bunny(Vector3f(265,-70,295), color, mi);
-
-    // Stanford dragon 265,-70,295
-    // float color[3] = {1.0, 1.0, 1.0};
-    // objects += add_stanford_dragon(Vector3f(0., -0., -0.5), color, mi);
-
-    // add_cornell_box(objects, lights, 20.0, mi);
-    // add_sample_scene(objects, lights, 2, mi);
-    // add_caustics_scene(objects, lights, 0.3, mi);
-    add_wine_glass_scene(objects, lights, 1, mi);
-    // Create BVH
-    ParamSet bvhParams;
-    std::shared_ptr<Primitive> bvh = CreateBVHAccelerator(objects, bvhParams);
-
-    Scene scene(bvh, lights);
-
-    // Camera
-
-    // Cornell box camera params
-    // Point3f origin(278, 278, -800);
-    // Point3f lookAt(278, 278, 0);
-    // Vector3f up(0, 1, 0);
-    // float fov = 40.0;
-
-    // Sample scene camera params
-    // Point3f origin(3.69558, -3.46243, 3.25463);
-    // Point3f lookAt(3.04072, -2.85176, 2.80939);
-    // Vector3f up(-0.317366, 0.312466, 0.895346);
-    // float fov = 28.8415038750464;
-    
-    // Caustics scene camera params
-    // Point3f origin(-5.5, 7, -5.5);
-    // Point3f lookAt(-4.75, 2.25, 0);
-    // Vector3f up(0, 1, 0);
-    // float fov = 40;
-
-    // Wine glass camera params
-    Point3f origin(7.3589, -6.9258, 4.9583);
-    Point3f lookAt(2.0204, -1.8232, 1);
-    Vector3f up(0, 0, 1);
-    float fov = 23;
-
-    auto camera = add_camera(origin, lookAt, up, fov, param.width, param.height, mi, "twray.png");
-    
-    // Sampler
-    ParamSet sampParams;
-    auto samplePerPixel = std::make_unique<int[]>(1);
-    samplePerPixel[0] = param.samplePerPixel;
-    sampParams.AddInt("pixelsamples", std::move(samplePerPixel), 1);
-    auto sampler = CreateHaltonSampler(sampParams, camera->film->GetSampleBounds());
-
-    // Integrator
-    ParamSet integParams;
-    auto maxDepth = std::make_unique<int[]>(1);
-    maxDepth[0] = param.maxDepth;
-    integParams.AddInt("maxdepth", std::move(maxDepth), 1);
-
-    auto iterations = std::make_unique<int[]>(1);
-    iterations[0] = 32;
-    integParams.AddInt("numiterations", std::move(iterations), 1);
-
-    auto radius = std::make_unique<float[]>(1);
-    radius[0] = 0.025;
-    integParams.AddFloat("radius", std::move(radius), 1);
-
-    auto integrator = CreatePathIntegrator(integParams, std::shared_ptr<Sampler>(sampler), camera);
-    // auto integrator = CreateSPPMIntegrator(integParams, camera);
-    // Render
-    integrator->Render(scene);
+// Copies the current contents of _film_ into _label_, scaling its splats
+// by _splatScale_
+void ShowFilm(Film *film, float splatScale, QLabel &label){
+    Vector2i res = film->croppedPixelBounds.Diagonal();
+    std::unique_ptr<float[]> rgb(new float[3 * res.x * res.y]);
+    film->GetRGB(rgb.get(), splatScale);
+    if (film->Denoising()) film->Denoise(rgb.get());
+    label.setPixmap(QPixmap::fromImage(createImage(rgb.get(), res.x, res.y)));
 }
 
 int main(int argc, char *argv[]){
 
     QApplication app(argc, argv);
     app.setStyle(QStyleFactory::create("Fusion"));
+    // QApplication has removed the arguments it handles itself; the thread
+    // pool options match twray_cli's
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--numa"))
+            PbrtOptions.numa = true;
+        else if (!strcmp(argv[i], "--nthreads") && i + 1 < argc)
+            PbrtOptions.nThreads = atoi(argv[++i]);
+        else
+            Warning("Ignoring argument \"%s\"", argv[i]);
+    }
     ParallelInit();
     InitProfiler();
     SetSearchDirectory("/home/ririka/PBR/TWRay/");
 
-    Parameters param;
-    param.samplePerPixel = 4;
+    // The scene is built by the first render and reused by later ones
+    const BuiltinScene *scene = FindBuiltinScene("wineglass");
+    RenderSession session(scene->build, BuiltinSceneCamera(*scene));
+    RenderSettings settings;
 
     QLabel label;
     std::string file = AbsolutePath(ResolveFilename("build/twray.png"));
@@ -121,20 +70,63 @@ int main(int argc, char *argv[]){
 
     std::vector<QSpinBox*> spinBoxes = {width, height, spp, depth};
 
+    QCheckBox *guiding = new QCheckBox("Path guiding");
+    buttonSpinboxLayout->addWidget(guiding);
+    QCheckBox *denoise = new QCheckBox("Denoise");
+    buttonSpinboxLayout->addWidget(denoise);
+
+    std::unique_ptr<RenderJob> job;
+
     QPushButton *renderButton = new QPushButton("Render");
     renderButton->setFixedSize(200,50);
     renderButton->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
-    QObject::connect(renderButton, &QPushButton::clicked, [spinBoxes, dir, &param, &label](){ 
-        param.width = spinBoxes[0]->value();
-        param.height = spinBoxes[1]->value();
-        param.samplePerPixel = spinBoxes[2]->value();
-        param.maxDepth = spinBoxes[3]->value();
-        Render(param); 
-        QPixmap newPixmap(dir);
-        label.setPixmap(newPixmap);
-        label.update();
+    QPushButton *cancelButton = new QPushButton("Cancel");
+    cancelButton->setFixedSize(200,50);
+    cancelButton->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
+    cancelButton->setEnabled(false);
+
+    QObject::connect(renderButton, &QPushButton::clicked, [spinBoxes, guiding, denoise, &session, &settings, &job, renderButton, cancelButton](){ 
+        if (job) return;
+        settings.width = spinBoxes[0]->value();
+        settings.height = spinBoxes[1]->value();
+        settings.samplesPerPixel = spinBoxes[2]->value();
+        settings.maxDepth = spinBoxes[3]->value();
+        settings.pathGuiding = guiding->isChecked();
+        settings.denoise = denoise->isChecked();
+
+        // Render on a background thread; the timer below picks up the
+        // film's contents as tiles are merged into it
+        job.reset(new RenderJob);
+        job->camera = session.Prepare(settings);
+        job->control = std::make_shared<RenderControl>();
+        job->control->progressive = true;
+        RenderJob *j = job.get();
+        j->thread = std::thread([j, &session](){
+            session.Render(j->control);
+            j->finished = true;
+        });
+        renderButton->setEnabled(false);
+        cancelButton->setEnabled(true);
+    });
+    QObject::connect(cancelButton, &QPushButton::clicked, [&job](){
+        if (job) job->control->cancelled = true;
     });
     buttonSpinboxLayout->addWidget(renderButton);
+    buttonSpinboxLayout->addWidget(cancelButton);
+
+    QTimer displayTimer;
+    QObject::connect(&displayTimer, &QTimer::timeout, [&job, &label, renderButton, cancelButton](){
+        if (!job) return;
+        bool finished = job->finished;
+        ShowFilm(job->camera->film, job->control->splatScale, label);
+        if (finished) {
+            job->thread.join();
+            job.reset();
+            renderButton->setEnabled(true);
+            cancelButton->setEnabled(false);
+        }
+    });
+    displayTimer.start(100);
 
     QHBoxLayout *layout = new QHBoxLayout;
     layout->addWidget(&label);
@@ -145,5 +137,14 @@ int main(int argc, char *argv[]){
     window.setLayout(layout);
     window.show();
 
-    return app.exec();
+    int ret = app.exec();
+    if (job) {
+        job->control->cancelled = true;
+        job->thread.join();
+    }
+    WaitForImageWrites();
+    WaitForCheckpointWrites();
+    CleanupProfiler();
+    ParallelCleanup();
+    return ret;
 }
\ No newline at end of file
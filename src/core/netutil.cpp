@@ -0,0 +1,44 @@
+// core/netutil.cpp*
+#include "netutil.h"
+#include <cerrno>
+#include <sys/socket.h>
+
+namespace pbrt {
+
+bool SendAll(int fd, const void *data, size_t size) {
+    const char *p = (const char *)data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool SendLine(int fd, const std::string &line) {
+    return SendAll(fd, (line + "\n").data(), line.size() + 1);
+}
+
+bool ReceiveLine(int fd, std::string *line) {
+    line->clear();
+    char c;
+    while (true) {
+        ssize_t n = recv(fd, &c, 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n != 1) break;
+        if (c == '\n') return true;
+        *line += c;
+    }
+    return !line->empty();
+}
+
+bool PeerDisconnected(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                      errno != EINTR);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,23 @@
+#ifndef NETUTIL_H
+#define NETUTIL_H
+
+// core/netutil.h*
+#include "pbrt.h"
+#include <string>
+
+namespace pbrt {
+
+// Blocking helpers for the line-based socket protocols of the render
+// server and distributed rendering. The send functions return false once
+// the peer has gone away, without raising SIGPIPE.
+bool SendAll(int fd, const void *data, size_t size);
+bool SendLine(int fd, const std::string &line);
+// Reads up to and excluding the next newline; returns false at the end of
+// the stream.
+bool ReceiveLine(int fd, std::string *line);
+// Returns true once the peer has closed its end of the connection
+bool PeerDisconnected(int fd);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_NETUTIL_H
@@ -2,64 +2,145 @@
 #include "parallel.h"
 #include "memory.h"
 #include "stats.h"
-#include <list>
+#include <algorithm>
+#include <deque>
+#include <fstream>
 #include <thread>
 #include <condition_variable>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace pbrt {
 
+Options PbrtOptions;
+
 // Parallel Local Definitions
 static std::vector<std::thread> threads;
 static bool shutdownThreads = false;
-class ParallelForLoop;
-static ParallelForLoop *workList = nullptr;
-static std::mutex workListMutex;
+// Ids of the NUMA nodes in use and the CPUs that belong to each of them;
+// only filled in NUMA mode when there is more than one node.
+static std::vector<int> numaNodes;
+static std::vector<std::vector<int>> numaNodeCPUs;
 
 // Bookkeeping variables to help with the implementation of
 // MergeWorkerThreadStats().
-static std::atomic<bool> reportWorkerStats{false};
+static int reportEpoch = 0;
 // Number of workers that still need to report their stats.
 static std::atomic<int> reporterCount;
 // After kicking the workers to report their stats, the main thread waits
 // on this condition variable until they've all done so.
 static std::condition_variable reportDoneCondition;
-static std::mutex reportDoneMutex;
 
 class ParallelForLoop {
   public:
     // ParallelForLoop Public Methods
-    ParallelForLoop(std::function<void(int64_t)> func1D, int64_t maxIndex,
-                    int chunkSize, uint64_t profilerState)
-        : func1D(std::move(func1D)),
-          maxIndex(maxIndex),
+    ParallelForLoop(void (*body)(void *, int64_t, int64_t), void *func,
+                    int64_t count, int chunkSize, uint64_t profilerState)
+        : body(body),
+          func(func),
           chunkSize(chunkSize),
-          profilerState(profilerState) {}
-    ParallelForLoop(const std::function<void(Point2i)> &f, const Point2i &count,
-                    uint64_t profilerState)
-        : func2D(f),
-          maxIndex(count.x * count.y),
-          chunkSize(1),
-          profilerState(profilerState) {
-        nX = count.x;
-    }
+          profilerState(profilerState),
+          remaining(count) {}
 
-  public:
-    // ParallelForLoop Private Data
-    std::function<void(int64_t)> func1D;
-    std::function<void(Point2i)> func2D;
-    const int64_t maxIndex;
+    // ParallelForLoop Public Data
+    void (*body)(void *, int64_t, int64_t);
+    void *func;
     const int chunkSize;
     uint64_t profilerState;
-    int64_t nextIndex = 0;
-    int activeWorkers = 0;
-    ParallelForLoop *next = nullptr;
-    int nX = -1;
-
-    // ParallelForLoop Private Methods
-    bool Finished() const {
-        return nextIndex >= maxIndex && activeWorkers == 0;
-    }
+    // Iterations that haven't finished running yet; the loop is only
+    // referenced by queued tasks while this is nonzero.
+    std::atomic<int64_t> remaining;
+};
+
+// A contiguous range of a loop's iterations that hasn't been started yet
+struct ParallelTask {
+    ParallelForLoop *loop;
+    int64_t begin, end;
+};
+
+// Each thread pushes the ranges it splits off to the back of its own queue
+// and takes work from there first, while idle threads steal the older,
+// larger ranges from the front of other threads' queues. The queues'
+// locks are only contended when a thread is being stolen from.
+struct alignas(64) TaskQueue {
+    std::mutex mutex;
+    std::deque<ParallelTask> tasks;
 };
+static std::unique_ptr<TaskQueue[]> taskQueues;
+static int nTaskQueues = 0;
+
+// Idle workers sleep on _workCondition_; pushing threads only take
+// _workMutex_ to wake them when some are known to be sleeping.
+static std::mutex workMutex;
+static std::condition_variable workCondition;
+static std::atomic<int64_t> queuedTasks{0};
+static std::atomic<int> nSleeping{0};
+
+static int QueueIndex() { return std::min(ThreadIndex, nTaskQueues - 1); }
+
+static void PushTask(int queue, const ParallelTask &task) {
+    {
+        std::lock_guard<std::mutex> lock(taskQueues[queue].mutex);
+        taskQueues[queue].tasks.push_back(task);
+    }
+    ++queuedTasks;
+    if (nSleeping > 0) {
+        std::lock_guard<std::mutex> lock(workMutex);
+        workCondition.notify_one();
+    }
+}
+
+// Takes the most recently pushed task from _queue_, or the oldest one if
+// _steal_ is true, provided that it belongs to _loop_ (or any loop, if
+// _loop_ is null).
+static bool TakeTask(int queue, const ParallelForLoop *loop, bool steal,
+                     ParallelTask *task) {
+    TaskQueue &q = taskQueues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) return false;
+    const ParallelTask &t = steal ? q.tasks.front() : q.tasks.back();
+    if (loop && t.loop != loop) return false;
+    *task = t;
+    if (steal)
+        q.tasks.pop_front();
+    else
+        q.tasks.pop_back();
+    --queuedTasks;
+    return true;
+}
+
+static bool FindTask(int queue, const ParallelForLoop *loop,
+                     ParallelTask *task) {
+    if (TakeTask(queue, loop, false, task)) return true;
+    for (int i = 1; i < nTaskQueues; ++i)
+        if (TakeTask((queue + i) % nTaskQueues, loop, true, task))
+            return true;
+    return false;
+}
+
+static void RunTask(ParallelTask task, int queue) {
+    ParallelForLoop &loop = *task.loop;
+    // Split off the upper half of the range for other threads to steal
+    // until what's left is a single chunk
+    while (task.end - task.begin > loop.chunkSize) {
+        int64_t mid = task.begin + (task.end - task.begin) / 2;
+        PushTask(queue, ParallelTask{&loop, mid, task.end});
+        task.end = mid;
+    }
+
+    // Run loop indices in _[task.begin, task.end)_
+    uint64_t oldState = ProfilerState;
+    ProfilerState = loop.profilerState;
+    loop.body(loop.func, task.begin, task.end);
+    ProfilerState = oldState;
+
+    // _loop_ may be freed as soon as _remaining_ reaches zero
+    loop.remaining -= task.end - task.begin;
+}
 
 void Barrier::Wait() {
     std::unique_lock<std::mutex> lock(mutex);
@@ -74,12 +155,76 @@ void Barrier::Wait() {
         cv.wait(lock, [this] { return count == 0; });
 }
 
-static std::condition_variable workListCondition;
+#ifdef __linux__
+// Parses a Linux sysfs list such as "0-3,8-11"
+static std::vector<int> ParseSysfsList(const std::string &str) {
+    std::vector<int> values;
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos) end = str.size();
+        std::string range = str.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        if (!range.empty() && isdigit(range[0])) {
+            int first = atoi(range.c_str());
+            int last = dash == std::string::npos
+                           ? first
+                           : atoi(range.c_str() + dash + 1);
+            for (int v = first; v <= last; ++v) values.push_back(v);
+        }
+        pos = end + 1;
+    }
+    return values;
+}
+
+static std::string ReadSysfsLine(const std::string &filename) {
+    std::ifstream in(filename);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+#endif  // __linux__
+
+static void DiscoverNUMANodes() {
+    numaNodes.clear();
+    numaNodeCPUs.clear();
+#ifdef __linux__
+    for (int node : ParseSysfsList(
+             ReadSysfsLine("/sys/devices/system/node/online"))) {
+        std::vector<int> cpus = ParseSysfsList(ReadSysfsLine(StringPrintf(
+            "/sys/devices/system/node/node%d/cpulist", node)));
+        if (cpus.empty()) continue;
+        numaNodes.push_back(node);
+        numaNodeCPUs.push_back(cpus);
+    }
+#endif
+    if (numaNodes.size() < 2) {
+        numaNodes.clear();
+        numaNodeCPUs.clear();
+    }
+    LOG(INFO) << "Using " << NumNUMANodes() << " NUMA node(s)";
+}
+
+// Restricts the calling thread to the CPUs of the _i_th NUMA node in use;
+// memory that it touches first is then allocated on that node.
+static void PinThreadToNUMANode(int i) {
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (int cpu : numaNodeCPUs[i]) CPU_SET(cpu, &cpuSet);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0)
+        Warning("Unable to pin thread to NUMA node %d", numaNodes[i]);
+#endif
+}
 
 static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     LOG(INFO) << "Started execution in worker thread " << tIndex;
     ThreadIndex = tIndex;
 
+    // Spread consecutive workers over the nodes, so that renders using
+    // fewer threads than there are cores still use all memory controllers
+    if (!numaNodes.empty()) PinThreadToNUMANode(tIndex % numaNodes.size());
+
     // Give the profiler a chance to do per-thread initialization for
     // the worker thread before the profiling system actually stops running.
     ProfilerWorkerThreadInit();
@@ -93,182 +238,106 @@ static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     // the threads have cleared it.
     barrier.reset();
 
-    std::unique_lock<std::mutex> lock(workListMutex);
-    while (!shutdownThreads) {
-        if (reportWorkerStats) {
+    int reportedEpoch;
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+        reportedEpoch = reportEpoch;
+    }
+    while (true) {
+        // Run tasks from this thread's queue or steal them from others
+        ParallelTask task;
+        if (FindTask(tIndex, nullptr, &task)) {
+            RunTask(task, tIndex);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(workMutex);
+        if (shutdownThreads) break;
+        if (reportedEpoch != reportEpoch) {
             ReportThreadStats();
+            reportedEpoch = reportEpoch;
             if (--reporterCount == 0)
                 // Once all worker threads have merged their stats, wake up
                 // the main thread.
                 reportDoneCondition.notify_one();
-            // Now sleep again.
-            workListCondition.wait(lock);
-        } else if (!workList) {
-            // Sleep until there are more tasks to run
-            workListCondition.wait(lock);
-        } else {
-            // Get work from _workList_ and run loop iterations
-            ParallelForLoop &loop = *workList;
-
-            // Run a chunk of loop iterations for _loop_
-
-            // Find the set of loop iterations to run next
-            int64_t indexStart = loop.nextIndex;
-            int64_t indexEnd =
-                std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-            // Update _loop_ to reflect iterations this thread will run
-            loop.nextIndex = indexEnd;
-            if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-            loop.activeWorkers++;
-
-            // Run loop indices in _[indexStart, indexEnd)_
-            lock.unlock();
-            for (int64_t index = indexStart; index < indexEnd; ++index) {
-                uint64_t oldState = ProfilerState;
-                ProfilerState = loop.profilerState;
-                if (loop.func1D) {
-                    loop.func1D(index);
-                }
-                // Handle other types of loops
-                else {
-                    CHECK(loop.func2D);
-                    loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-                }
-                ProfilerState = oldState;
-            }
-            lock.lock();
-
-            // Update _loop_ to reflect completion of iterations
-            loop.activeWorkers--;
-            if (loop.Finished()) workListCondition.notify_all();
+            continue;
         }
+
+        // Sleep until there are more tasks to run
+        ++nSleeping;
+        workCondition.wait(lock, [&]() {
+            return queuedTasks > 0 || shutdownThreads ||
+                   reportedEpoch != reportEpoch;
+        });
+        --nSleeping;
     }
     LOG(INFO) << "Exiting worker thread " << tIndex;
 }
 
 // Parallel Definitions
-void ParallelFor(std::function<void(int64_t)> func, int64_t count,
-                 int chunkSize) {
+void ParallelForRange(void (*body)(void *, int64_t, int64_t), void *func,
+                      int64_t count, int chunkSize) {
     CHECK(threads.size() > 0 || MaxThreadIndex() == 1);
 
     // Run iterations immediately if not using threads or if _count_ is small
     if (threads.empty() || count < chunkSize) {
-        for (int64_t i = 0; i < count; ++i) func(i);
+        if (count > 0) body(func, 0, count);
         return;
     }
 
-    // Create and enqueue _ParallelForLoop_ for this loop
-    ParallelForLoop loop(std::move(func), count, chunkSize,
+    // Start on the whole range, splitting off work for other threads
+    ParallelForLoop loop(body, func, count, std::max(chunkSize, 1),
                          CurrentProfilerState());
-    workListMutex.lock();
-    loop.next = workList;
-    workList = &loop;
-    workListMutex.unlock();
-
-    // Notify worker threads of work to be done
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
+    int queue = QueueIndex();
+    RunTask(ParallelTask{&loop, 0, count}, queue);
+
+    // Help out with _loop_'s remaining iterations in the current thread;
+    // tasks of other loops aren't run here, since they may depend on
+    // per-thread state that the caller is still using
+    while (loop.remaining > 0) {
+        ParallelTask task;
+        if (FindTask(queue, &loop, &task))
+            RunTask(task, queue);
+        else
+            std::this_thread::yield();
     }
 }
 
 thread_local int ThreadIndex;
 
 int MaxThreadIndex() {
-    return NumSystemCores();
-}
-
-void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count) {
-    CHECK(threads.size() > 0 || MaxThreadIndex() == 1);
-
-    if (threads.empty() || count.x * count.y <= 1) {
-        for (int y = 0; y < count.y; ++y)
-            for (int x = 0; x < count.x; ++x) func(Point2i(x, y));
-        return;
-    }
-
-    ParallelForLoop loop(std::move(func), count, CurrentProfilerState());
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        loop.next = workList;
-        workList = &loop;
-    }
-
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
-    }
+    return PbrtOptions.nThreads == 0 ? NumSystemCores() : PbrtOptions.nThreads;
 }
 
 int NumSystemCores() {
     return std::max(1u, std::thread::hardware_concurrency());
 }
 
+int NumNUMANodes() { return std::max<int>(1, numaNodes.size()); }
+
+void InterleaveMemory(void *ptr, size_t size) {
+#ifdef __linux__
+    if (numaNodes.empty() || !ptr) return;
+    // Only whole pages can be placed; pages that are already allocated are
+    // migrated
+    const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)ptr + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(pageSize - 1);
+    if (end <= start) return;
+    const int mpolInterleave = 3, mpolMfMove = 1 << 1;
+    const int maskBits = 8 * sizeof(unsigned long);
+    int maxNode = *std::max_element(numaNodes.begin(), numaNodes.end());
+    std::vector<unsigned long> nodeMask(maxNode / maskBits + 1, 0);
+    for (int node : numaNodes)
+        nodeMask[node / maskBits] |= 1ul << (node % maskBits);
+    if (syscall(SYS_mbind, start, end - start, mpolInterleave,
+                nodeMask.data(), nodeMask.size() * maskBits + 1,
+                mpolMfMove) != 0) {
+        VLOG(1) << "mbind() failed; memory stays where it was allocated";
+    }
+#endif
+}
+
 void ParallelInit() {
     CHECK_EQ(threads.size(), 0);
     int nThreads = MaxThreadIndex();
@@ -279,6 +348,9 @@ void ParallelInit() {
     // function.  In turn, we can be sure that the profiling system isn't
     // started until after all worker threads have done that.
     std::shared_ptr<Barrier> barrier = std::make_shared<Barrier>(nThreads);
+    if (PbrtOptions.numa) DiscoverNUMANodes();
+    nTaskQueues = nThreads;
+    taskQueues.reset(new TaskQueue[nTaskQueues]);
 
     // Launch one fewer worker thread than the total number we want doing
     // work, since the main thread helps out, too.
@@ -292,9 +364,9 @@ void ParallelCleanup() {
     if (threads.empty()) return;
 
     {
-        std::lock_guard<std::mutex> lock(workListMutex);
+        std::lock_guard<std::mutex> lock(workMutex);
         shutdownThreads = true;
-        workListCondition.notify_all();
+        workCondition.notify_all();
     }
 
     for (std::thread &thread : threads) thread.join();
@@ -303,20 +375,17 @@ void ParallelCleanup() {
 }
 
 void MergeWorkerThreadStats() {
-    std::unique_lock<std::mutex> lock(workListMutex);
-    std::unique_lock<std::mutex> doneLock(reportDoneMutex);
-    // Set up state so that the worker threads will know that we would like
-    // them to report their thread-specific stats when they wake up.
-    reportWorkerStats = true;
+    std::unique_lock<std::mutex> lock(workMutex);
+    // Start a new reporting epoch so that each worker thread will report
+    // its thread-specific stats once when it wakes up.
+    ++reportEpoch;
     reporterCount = threads.size();
 
     // Wake up the worker threads.
-    workListCondition.notify_all();
+    workCondition.notify_all();
 
     // Wait for all of them to merge their stats.
     reportDoneCondition.wait(lock, []() { return reporterCount == 0; });
-
-    reportWorkerStats = false;
 }
 
 }  // namespace pbrt
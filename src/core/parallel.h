@@ -8,6 +8,7 @@
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <type_traits>
 
 namespace pbrt {
 
@@ -61,12 +62,37 @@ class Barrier {
     int count;
 };
 
-void ParallelFor(std::function<void(int64_t)> func, int64_t count,
-                 int chunkSize = 1);
+// Runs _body(func, begin, end)_ over disjoint subranges of _[0, count)_
+// of up to _chunkSize_ iterations; the ranges are split lazily and
+// balanced between threads by work stealing. Calls may be nested: a
+// thread waiting for a loop only runs that loop's iterations meanwhile.
+void ParallelForRange(void (*body)(void *func, int64_t begin, int64_t end),
+                      void *func, int64_t count, int chunkSize);
+
+template <typename Func>
+void ParallelFor(Func &&func, int64_t count, int chunkSize = 1) {
+    using F = typename std::remove_reference<Func>::type;
+    ParallelForRange([](void *f, int64_t begin, int64_t end) {
+        for (int64_t i = begin; i < end; ++i) (*(F *)f)(i);
+    }, (void *)&func, count, chunkSize);
+}
+
 extern thread_local int ThreadIndex;
-void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count);
+
+template <typename Func>
+void ParallelFor2D(Func &&func, const Point2i &count) {
+    int nX = count.x;
+    ParallelFor([&](int64_t i) { func(Point2i(i % nX, i / nX)); },
+                (int64_t)count.x * count.y, 1);
+}
 int MaxThreadIndex();
 int NumSystemCores();
+// Number of NUMA nodes that worker threads are spread over; one unless
+// _PbrtOptions.numa_ is set on a multi-socket Linux machine.
+int NumNUMANodes();
+// Spreads the pages of memory that all threads read, such as acceleration
+// structures and meshes, evenly across the NUMA nodes in use.
+void InterleaveMemory(void *ptr, size_t size);
 
 void ParallelInit();
 void ParallelCleanup();
@@ -85,8 +85,15 @@ struct CameraSample;
 class ProjectiveCamera;
 class Sampler;
 class Filter;
+class FilterSampler;
 class Film;
 class FilmTile;
+struct AOVSample;
+class Checkpoint;
+struct TileJob;
+class TileScheduler;
+class TileCoordinator;
+class TileWorker;
 class BxDF;
 class BRDF;
 class BTDF;
@@ -104,6 +111,7 @@ struct BSSRDFTable;
 class Light;
 class VisibilityTester;
 class AreaLight;
+class LightDistribution;
 struct Distribution1D;
 class Distribution2D;
 // #ifdef PBRT_FLOAT_AS_DOUBLE
@@ -128,6 +136,9 @@ struct Options {
         cropWindow[1][1] = 1;
     }
     int nThreads = 0;
+    // Pin worker threads to NUMA nodes and spread the pages of shared
+    // read-only scene data across all nodes
+    bool numa = false;
     bool quickRender = false;
     bool quiet = false;
     bool cat = false, toPly = false;
@@ -3,11 +3,15 @@
 #include "light.h"
 #include "interaction.h"
 #include "stats.h"
+#include <atomic>
 
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Primitives", primitiveMemory);
 
+// Primitive Local Definitions
+static std::atomic<int> nextPrimitiveId{0};
+
 // Primitive Method Definitions
 Primitive::~Primitive() {}
 const AreaLight *Aggregate::GetAreaLight() const {
@@ -70,7 +74,8 @@ GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape,
     : shape(shape),
     material(material),
     areaLight(areaLight),
-    mediumInterface(mediumInterface) {
+    mediumInterface(mediumInterface),
+    id(nextPrimitiveId++) {
     primitiveMemory += sizeof(*this);
 }
 
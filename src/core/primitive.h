@@ -24,6 +24,9 @@ class Primitive {
                                             MemoryArena &arena,
                                             TransportMode mode,
                                             bool allowMultipleLobes) const = 0;
+    // Identifies the primitive in AOVs; -1 for primitives that are never
+    // returned by intersection tests
+    virtual int GetId() const { return -1; }
 };
 
 // GeometricPrimitive Declarations
@@ -42,6 +45,9 @@ class GeometricPrimitive : public Primitive {
     void ComputeScatteringFunctions(SurfaceInteraction *isect,
                                     MemoryArena &arena, TransportMode mode,
                                     bool allowMultipleLobes) const;
+    // Ids are handed out in creation order, so they're stable for a given
+    // scene but unique across all scenes of a process
+    int GetId() const { return id; }
 
   private:
     // GeometricPrimitive Private Data
@@ -49,6 +55,7 @@ class GeometricPrimitive : public Primitive {
     std::shared_ptr<Material> material;
     std::shared_ptr<AreaLight> areaLight;
     MediumInterface mediumInterface;
+    const int id;
 };
 
 // TransformedPrimitive Declarations
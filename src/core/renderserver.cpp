@@ -0,0 +1,198 @@
+// core/renderserver.cpp*
+#include "renderserver.h"
+#include "camera.h"
+#include "checkpoint.h"
+#include "film.h"
+#include "imageio.h"
+#include "netutil.h"
+#include "scenes.h"
+#include "stats.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace pbrt {
+
+STAT_COUNTER("Server/Jobs", nServerJobs);
+STAT_PERCENT("Server/Scene cache hits", nSceneCacheHits, nSceneLookups);
+
+// RenderServer Local Definitions
+static size_t ResidentBytes() {
+    // The second field of /proc/self/statm is the resident set in pages
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, residentPages = 0;
+    statm >> pages >> residentPages;
+    return residentPages * sysconf(_SC_PAGESIZE);
+}
+
+// RenderServer Method Definitions
+bool RenderServer::Run() {
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        Error("Unable to create socket: %s", strerror(errno));
+        return false;
+    }
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        Error("Socket path \"%s\" is too long", socketPath.c_str());
+        close(listenFd);
+        return false;
+    }
+    strcpy(addr.sun_path, socketPath.c_str());
+    unlink(socketPath.c_str());
+    if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd, 16) != 0) {
+        Error("Unable to listen on \"%s\": %s", socketPath.c_str(),
+              strerror(errno));
+        close(listenFd);
+        return false;
+    }
+    LOG(INFO) << "Render server listening on " << socketPath;
+
+    while (true) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            Error("accept() failed: %s", strerror(errno));
+            break;
+        }
+        ServeJob(fd);
+        close(fd);
+    }
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return false;
+}
+
+RenderServer::CachedScene &RenderServer::AcquireScene(const std::string &name,
+                                                      bool *cached,
+                                                      double *loadSeconds) {
+    ++nSceneLookups;
+    *loadSeconds = 0;
+    for (auto iter = scenes.begin(); iter != scenes.end(); ++iter)
+        if (iter->name == name) {
+            // Move the scene to the front of the LRU list
+            scenes.splice(scenes.begin(), scenes, iter);
+            ++nSceneCacheHits;
+            *cached = true;
+            return scenes.front();
+        }
+    *cached = false;
+
+    // Evict least recently used scenes so that the new one is likely to
+    // fit; its size isn't known until it has been built
+    size_t cachedBytes = 0;
+    for (const CachedScene &scene : scenes) cachedBytes += scene.bytes;
+    while (!scenes.empty() && cachedBytes > cacheBudgetBytes / 2) {
+        LOG(INFO) << "Evicting scene " << scenes.back().name;
+        cachedBytes -= scenes.back().bytes;
+        scenes.pop_back();
+    }
+
+    const BuiltinScene *builtin = FindBuiltinScene(name);
+    CHECK(builtin);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    size_t residentBefore = ResidentBytes();
+    std::unique_ptr<RenderSession> session(
+        new RenderSession(builtin->build, BuiltinSceneCamera(*builtin)));
+    session->LoadScene();
+    size_t residentAfter = ResidentBytes();
+    *loadSeconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start).count();
+    scenes.push_front(CachedScene{
+        name, std::move(session),
+        residentAfter > residentBefore ? residentAfter - residentBefore : 0});
+
+    // Evict more scenes if the new one pushed the cache over budget
+    cachedBytes += scenes.front().bytes;
+    while (scenes.size() > 1 && cachedBytes > cacheBudgetBytes) {
+        LOG(INFO) << "Evicting scene " << scenes.back().name;
+        cachedBytes -= scenes.back().bytes;
+        scenes.pop_back();
+    }
+    return scenes.front();
+}
+
+void RenderServer::ServeJob(int fd) {
+    std::string line, error;
+    if (!ReceiveLine(fd, &line)) return;
+    RenderSettings settings;
+    std::string sceneName = "wineglass";
+    bool progressive = false;
+    std::map<std::string, std::string> extra;
+    if (!ParseRenderSettings(line, &settings, &sceneName, &error, &extra)) {
+        SendLine(fd, "error " + error);
+        return;
+    }
+    for (const auto &kv : extra) {
+        if (kv.first != "progressive") {
+            SendLine(fd, "error unknown key \"" + kv.first + "\"");
+            return;
+        }
+        progressive = kv.second == "1" || kv.second == "true";
+    }
+    if (!FindBuiltinScene(sceneName)) {
+        SendLine(fd, "error scene \"" + sceneName + "\" unknown");
+        return;
+    }
+    if (!SendLine(fd, "ok")) return;
+    ++nServerJobs;
+
+    bool cached;
+    double sceneSeconds;
+    CachedScene &scene = AcquireScene(sceneName, &cached, &sceneSeconds);
+    std::shared_ptr<const Camera> camera = scene.session->Prepare(settings);
+    Film *film = camera->film;
+
+    // Render on a separate thread, sending a snapshot of the film after
+    // each pass and cancelling the job if the client goes away
+    std::shared_ptr<RenderControl> control = std::make_shared<RenderControl>();
+    control->progressive = progressive;
+    std::atomic<bool> finished{false};
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::thread renderThread([&]() {
+        scene.session->Render(control);
+        finished = true;
+    });
+    Vector2i res = film->croppedPixelBounds.Diagonal();
+    std::unique_ptr<float[]> rgb(new float[3 * res.x * res.y]);
+    int passesSent = 0;
+    bool connected = true;
+    while (!finished) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        int passesDone = control->passesDone;
+        if (progressive && connected && passesDone > passesSent) {
+            passesSent = passesDone;
+            film->GetRGB(rgb.get(), control->splatScale);
+            if (film->Denoising()) film->Denoise(rgb.get());
+            connected = SendLine(fd, StringPrintf("pass %d %d %d", passesDone,
+                                                  res.x, res.y)) &&
+                        SendAll(fd, rgb.get(),
+                                3 * res.x * res.y * sizeof(float));
+        }
+        if (connected && PeerDisconnected(fd)) connected = false;
+        if (!connected && !control->cancelled) {
+            LOG(INFO) << "Client disconnected; cancelling job";
+            control->cancelled = true;
+        }
+    }
+    renderThread.join();
+    WaitForImageWrites();
+    WaitForCheckpointWrites();
+    double renderSeconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start).count();
+    if (connected)
+        SendLine(fd, StringPrintf("done %.3f %.3f %d", sceneSeconds,
+                                  renderSeconds, cached ? 1 : 0));
+}
+
+}  // namespace pbrt
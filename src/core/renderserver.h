@@ -0,0 +1,71 @@
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+// core/renderserver.h*
+#include "pbrt.h"
+#include "session.h"
+#include <list>
+
+namespace pbrt {
+
+// RenderServer Declarations
+
+// A long-running renderer that accepts jobs over a local UNIX socket and
+// keeps the most recently used scenes, with their acceleration structures,
+// resident between jobs. Each connection submits one job as a single line
+// of space-separated _key=value_ tokens:
+//
+//   scene=<name> width=<n> height=<n> spp=<n> maxdepth=<n>
+//   integrator=<name> guiding=<0|1> param=<type:name=value> (repeatable)
+//   outfile=<filename> progressive=<0|1>
+//
+// along with the other keys of ParseRenderSettings(). Unspecified
+// settings take their RenderSettings defaults, and jobs whose settings
+// don't pass ValidateRenderSettings() are refused with an error. The
+// server replies with text lines:
+//
+//   ok                        the job was accepted
+//   pass <n> <width> <height> followed by width * height * 3 floats of
+//                             linear RGB, once per finished pass when
+//                             progressive=1
+//   done <scene s> <render s> <cached 0|1>
+//   error <message>
+//
+// Closing the connection cancels the job. Jobs run one at a time, each
+// using all render threads.
+class RenderServer {
+  public:
+    // RenderServer Public Methods
+    // Scenes are evicted, least recently used first, once their estimated
+    // total size exceeds _cacheBudgetBytes_.
+    RenderServer(const std::string &socketPath, size_t cacheBudgetBytes)
+        : socketPath(socketPath), cacheBudgetBytes(cacheBudgetBytes) {}
+    // Serves jobs until an unrecoverable socket error occurs; returns
+    // false in that case.
+    bool Run();
+
+  private:
+    // RenderServer Private Declarations
+    struct CachedScene {
+        std::string name;
+        std::unique_ptr<RenderSession> session;
+        // Growth of the process's resident memory while the scene was
+        // built
+        size_t bytes;
+    };
+
+    // RenderServer Private Methods
+    void ServeJob(int fd);
+    CachedScene &AcquireScene(const std::string &name, bool *cached,
+                              double *loadSeconds);
+
+    // RenderServer Private Data
+    const std::string socketPath;
+    const size_t cacheBudgetBytes;
+    // Most recently used first
+    std::list<CachedScene> scenes;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_RENDERSERVER_H
@@ -0,0 +1,100 @@
+#include "netutil.h"
+#include "parallel.h"
+#include "renderserver.h"
+#include "stats.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace pbrt;
+
+// Checks that twray_server turns away jobs it can't render with an error
+// line, instead of accepting them and aborting later on, and that it keeps
+// serving connections afterwards.
+
+static int Connect(const std::string &socketPath) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath.c_str());
+    // The server thread may not be listening yet
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return -1;
+}
+
+// Sends _job_ and returns the server's first reply line
+static std::string Submit(const std::string &socketPath,
+                          const std::string &job) {
+    int fd = Connect(socketPath);
+    if (fd < 0) return "(unable to connect)";
+    std::string reply;
+    if (!SendLine(fd, job) || !ReceiveLine(fd, &reply))
+        reply = "(connection closed)";
+    close(fd);
+    return reply;
+}
+
+int main() {
+    ParallelInit();
+    InitProfiler();
+    std::string socketPath =
+        StringPrintf("/tmp/twray_test_%d.sock", (int)getpid());
+    RenderServer server(socketPath, size_t(1) << 30);
+    std::thread([&server]() { server.Run(); }).detach();
+
+    const char *rejected[] = {
+        // Splatting and whole-image integrators can't stream
+        "integrator=bdpt outfile=out.exr streaming=1",
+        "integrator=vcm outfile=out.exr streaming=1",
+        "integrator=mlt outfile=out.exr streaming=1",
+        "integrator=sppm outfile=out.exr streaming=1",
+        // ReSTIR direct lighting merges its own tiles in several passes
+        "integrator=directlighting outfile=out.exr streaming=1 "
+        "param=string:strategy=restir",
+        // Streaming writes scanline EXRs only
+        "integrator=path outfile=out.png streaming=1",
+        "integrator=path outfile=out.exr streaming=1 aovs=1",
+        "integrator=path outfile=out.exr streaming=1 denoise=1",
+        "integrator=bdpt outfile=out.exr aovs=1",
+        "integrator=path outfile=out.png aovs=1",
+    };
+    int failures = 0;
+    for (const char *job : rejected) {
+        std::string reply = Submit(socketPath, job);
+        bool ok = reply.compare(0, 6, "error ") == 0;
+        printf("%s: %s -> %s\n", ok ? "ok" : "FAILED", job, reply.c_str());
+        if (!ok) ++failures;
+    }
+
+    std::string error, sceneName;
+    RenderSettings settings;
+    if (!ParseRenderSettings("integrator=volpath outfile=out.exr streaming=1",
+                             &settings, &sceneName, &error) ||
+        !settings.streaming) {
+        printf("FAILED: valid streaming settings rejected: %s\n",
+               error.c_str());
+        ++failures;
+    }
+
+    if (!ParseRenderSettings("integrator=directlighting outfile=out.exr "
+                             "streaming=1 param=string:strategy=one",
+                             &settings, &sceneName, &error)) {
+        printf("FAILED: valid directlighting streaming settings rejected: "
+               "%s\n", error.c_str());
+        ++failures;
+    }
+
+    unlink(socketPath.c_str());
+    printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
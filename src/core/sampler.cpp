@@ -2,6 +2,7 @@
 #include "sampler.h"
 #include "sampling.h"
 #include "camera.h"
+#include "filter.h"
 #include "stats.h"
 
 namespace pbrt {
@@ -11,9 +12,13 @@ Sampler::~Sampler() {}
 
 Sampler::Sampler(int64_t samplesPerPixel) : samplesPerPixel(samplesPerPixel) {}
 
-CameraSample Sampler::GetCameraSample(const Point2i &pRaster) {
+CameraSample Sampler::GetCameraSample(const Point2i &pRaster,
+                                      const FilterSampler *filterSampler) {
     CameraSample cs;
-    cs.pFilm = (Point2f)pRaster + Get2D();
+    if (filterSampler)
+        cs.pFilm = filterSampler->SampleFilm(pRaster, Get2D(), &cs.filterWeight);
+    else
+        cs.pFilm = (Point2f)pRaster + Get2D();
     cs.time = Get1D();
     cs.pLens = Get2D();
     return cs;
@@ -18,7 +18,10 @@ class Sampler {
     virtual void StartPixel(const Point2i &p);
     virtual float Get1D() = 0;
     virtual Point2f Get2D() = 0;
-    CameraSample GetCameraSample(const Point2i &pRaster);
+    // If _filterSampler_ is given, pFilm is distributed according to the
+    // film's reconstruction filter rather than uniformly over the pixel
+    CameraSample GetCameraSample(const Point2i &pRaster,
+                                 const FilterSampler *filterSampler = nullptr);
     void Request1DArray(int n);
     void Request2DArray(int n);
     virtual int RoundCount(int n) const { return n; }
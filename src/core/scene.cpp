@@ -1,5 +1,7 @@
 // core/scene.cpp*
 #include "scene.h"
+#include "heatmap.h"
+#include "lightdistrib.h"
 #include "stats.h"
 
 namespace pbrt {
@@ -11,12 +13,14 @@ STAT_COUNTER("Intersections/Shadow ray intersection tests", nShadowTests);
 // Scene Method Definitions
 bool Scene::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     ++nIntersectionTests;
+    ++ThreadRayWork.rays;
     DCHECK_NE(ray.d, Vector3f(0,0,0));
     return aggregate->Intersect(ray, isect);
 }
 
 bool Scene::IntersectP(const Ray &ray) const {
     ++nShadowTests;
+    ++ThreadRayWork.rays;
     DCHECK_NE(ray.d, Vector3f(0,0,0));
     return aggregate->IntersectP(ray);
 }
@@ -36,4 +40,12 @@ bool Scene::IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
     }
 }
 
+std::shared_ptr<LightDistribution> Scene::GetLightSampleDistribution(
+    const std::string &name) const {
+    std::lock_guard<std::mutex> lock(lightDistribMutex);
+    std::shared_ptr<LightDistribution> &distrib = lightDistribs[name];
+    if (!distrib) distrib = CreateLightSampleDistribution(name, *this);
+    return distrib;
+}
+
 }  // namespace pbrt
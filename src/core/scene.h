@@ -7,6 +7,8 @@
 #include "geometry.h"
 #include "primitive.h"
 #include "light.h"
+#include <map>
+#include <mutex>
 
 namespace pbrt {
 
@@ -30,6 +32,8 @@ class Scene {
     bool IntersectP(const Ray &ray) const;
     bool IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                      Spectrum *transmittance) const;
+    std::shared_ptr<LightDistribution> GetLightSampleDistribution(
+        const std::string &name) const;
 
     // Scene Public Data
     std::vector<std::shared_ptr<Light>> lights;
@@ -41,6 +45,11 @@ class Scene {
     // Scene Private Data
     std::shared_ptr<Primitive> aggregate;
     Bounds3f worldBound;
+    // Light sampling distributions only depend on the scene, so they are
+    // created on first use and shared by every integrator rendering it.
+    mutable std::mutex lightDistribMutex;
+    mutable std::map<std::string, std::shared_ptr<LightDistribution>>
+        lightDistribs;
 };
 
 }  // namespace pbrt
@@ -0,0 +1,60 @@
+// core/scenes.cpp*
+#include "scenes.h"
+#include "twray.h"
+
+namespace pbrt {
+
+// Scene Registry Definitions
+const std::vector<BuiltinScene> &BuiltinScenes() {
+    static const std::vector<BuiltinScene> scenes = {
+        {"cornell",
+         [](std::vector<std::shared_ptr<Primitive>> &objects,
+            std::vector<std::shared_ptr<Light>> &lights) {
+             add_cornell_box(objects, lights, 20.0, MediumInterface());
+         },
+         Point3f(278, 278, -800), Point3f(278, 278, 0), Vector3f(0, 1, 0),
+         40.f},
+        {"dragon",
+         [](std::vector<std::shared_ptr<Primitive>> &objects,
+            std::vector<std::shared_ptr<Light>> &lights) {
+             add_sample_scene(objects, lights, 2, MediumInterface());
+         },
+         Point3f(3.69558, -3.46243, 3.25463),
+         Point3f(3.04072, -2.85176, 2.80939),
+         Vector3f(-0.317366, 0.312466, 0.895346), 28.8415038750464f},
+        {"caustics",
+         [](std::vector<std::shared_ptr<Primitive>> &objects,
+            std::vector<std::shared_ptr<Light>> &lights) {
+             add_caustics_scene(objects, lights, 0.3, MediumInterface());
+         },
+         Point3f(-5.5, 7, -5.5), Point3f(-4.75, 2.25, 0), Vector3f(0, 1, 0),
+         40.f},
+        {"wineglass",
+         [](std::vector<std::shared_ptr<Primitive>> &objects,
+            std::vector<std::shared_ptr<Light>> &lights) {
+             add_wine_glass_scene(objects, lights, 1, MediumInterface());
+         },
+         Point3f(7.3589, -6.9258, 4.9583), Point3f(2.0204, -1.8232, 1),
+         Vector3f(0, 0, 1), 23.f},
+    };
+    return scenes;
+}
+
+const BuiltinScene *FindBuiltinScene(const std::string &name) {
+    for (const BuiltinScene &scene : BuiltinScenes())
+        if (scene.name == name) return &scene;
+    return nullptr;
+}
+
+RenderSession::CameraBuilder BuiltinSceneCamera(const BuiltinScene &scene) {
+    return [&scene](const RenderSettings &settings) {
+        return add_camera(scene.cameraOrigin, scene.cameraLookAt,
+                          scene.cameraUp, scene.fov, settings.width,
+                          settings.height, MediumInterface(),
+                          settings.outputFile, settings.filter,
+                          settings.filterImportanceSampling, settings.aovs,
+                          settings.denoise, settings.streaming);
+    };
+}
+
+}  // namespace pbrt
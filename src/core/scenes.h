@@ -0,0 +1,30 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+// core/scenes.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "session.h"
+
+namespace pbrt {
+
+// Scene Registry Declarations
+
+// A scene that is built in code, together with the camera it is meant to
+// be viewed from; both front ends select scenes from this registry.
+struct BuiltinScene {
+    std::string name;
+    RenderSession::SceneBuilder build;
+    Point3f cameraOrigin, cameraLookAt;
+    Vector3f cameraUp;
+    float fov;
+};
+
+const std::vector<BuiltinScene> &BuiltinScenes();
+// Returns nullptr if there is no scene called _name_
+const BuiltinScene *FindBuiltinScene(const std::string &name);
+RenderSession::CameraBuilder BuiltinSceneCamera(const BuiltinScene &scene);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_SCENES_H
@@ -0,0 +1,250 @@
+// core/sdtree.cpp*
+#include "sdtree.h"
+#include "rng.h"
+#include "stats.h"
+
+namespace pbrt {
+
+STAT_COUNTER("Path guiding/Spatial subdivisions", nSpatialSplits);
+STAT_MEMORY_COUNTER("Memory/Path guiding quadtrees", dTreeBytes);
+
+// The relative flux above which a quadrant is subdivided, and the depth
+// limit of each quadtree.
+static const float quadtreeThreshold = 0.01f;
+static const int quadtreeMaxDepth = 20;
+
+// Direction Mapping Functions
+static Point2f DirectionToSquare(const Vector3f &w) {
+    float cosTheta = Clamp(w.z, -1, 1);
+    float phi = std::atan2(w.y, w.x);
+    if (phi < 0) phi += 2 * Pi;
+    return Point2f(Clamp((cosTheta + 1) * 0.5f, 0, OneMinusEpsilon),
+                   Clamp(phi * Inv2Pi, 0, OneMinusEpsilon));
+}
+
+static Vector3f SquareToDirection(const Point2f &p) {
+    float cosTheta = 2 * p.x - 1;
+    float sinTheta = std::sqrt(std::max((float)0, 1 - cosTheta * cosTheta));
+    float phi = 2 * Pi * p.y;
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi),
+                    cosTheta);
+}
+
+// Returns the quadrant of the unit square containing _p_ and remaps _p_ to
+// that quadrant's local coordinates.
+static int ChildQuadrant(Point2f *p) {
+    int x = p->x >= 0.5f, y = p->y >= 0.5f;
+    p->x = std::min(2 * p->x - x, OneMinusEpsilon);
+    p->y = std::min(2 * p->y - y, OneMinusEpsilon);
+    return x + 2 * y;
+}
+
+// DTree Method Definitions
+DTree::DTree() : nodes(1), sampleCount(0) {}
+
+DTree::DTree(const DTree &t) : nodes(t.nodes), sampleCount(t.SampleCount()) {}
+
+DTree &DTree::operator=(const DTree &t) {
+    nodes = t.nodes;
+    sampleCount = t.SampleCount();
+    return *this;
+}
+
+float DTree::Flux() const { return nodes[0].Sum(); }
+
+void DTree::Record(const Vector3f &w, float radiance) {
+    ++sampleCount;
+    if (!(radiance > 0) || std::isinf(radiance)) return;
+    Point2f p = DirectionToSquare(w);
+    uint32_t node = 0;
+    while (true) {
+        int q = ChildQuadrant(&p);
+        nodes[node].sum[q].Add(radiance);
+        if (!nodes[node].child[q]) break;
+        node = nodes[node].child[q];
+    }
+}
+
+float DTree::Pdf(const Vector3f &w) const {
+    if (Flux() <= 0) return Inv4Pi;
+    Point2f p = DirectionToSquare(w);
+    float pdf = 1;
+    uint32_t node = 0;
+    while (true) {
+        const Node &n = nodes[node];
+        int q = ChildQuadrant(&p);
+        float sum = n.Sum();
+        if (n.sum[q] <= 0) return 0;
+        pdf *= 4 * n.sum[q] / sum;
+        if (!n.child[q]) break;
+        node = n.child[q];
+    }
+    return pdf * Inv4Pi;
+}
+
+Vector3f DTree::Sample(Point2f u, float *pdf) const {
+    if (Flux() <= 0) {
+        *pdf = Inv4Pi;
+        return SquareToDirection(u);
+    }
+    // Descend the quadtree, choosing the quadrant's column and then its
+    // row in proportion to the recorded flux and rescaling _u_ each time
+    Point2f origin(0, 0);
+    float size = 1;
+    uint32_t node = 0;
+    while (true) {
+        const Node &n = nodes[node];
+        float s[4] = {n.sum[0], n.sum[1], n.sum[2], n.sum[3]};
+        float pLeft = (s[0] + s[2]) / (s[0] + s[1] + s[2] + s[3]);
+        int x = u.x >= pLeft;
+        u.x = x ? (u.x - pLeft) / (1 - pLeft) : u.x / pLeft;
+        float pBottom = s[x] / (s[x] + s[x + 2]);
+        int y = u.y >= pBottom;
+        u.y = y ? (u.y - pBottom) / (1 - pBottom) : u.y / pBottom;
+        u = Point2f(std::min(u.x, OneMinusEpsilon),
+                    std::min(u.y, OneMinusEpsilon));
+
+        size *= 0.5f;
+        origin += Vector2f(x * size, y * size);
+        int q = x + 2 * y;
+        if (!n.child[q]) break;
+        node = n.child[q];
+    }
+    Vector3f w = SquareToDirection(origin + Vector2f(u) * size);
+    *pdf = Pdf(w);
+    return w;
+}
+
+void DTree::Refine(const DTree &recorded, float rho, int maxDepth,
+                   size_t maxBytes) {
+    // Start from an empty root; quadrants holding more than _rho_ of the
+    // recorded flux are subdivided, reusing the recorded tree's structure
+    // where it exists and splitting the flux evenly where it does not
+    nodes.assign(1, Node());
+    sampleCount = 0;
+    float total = recorded.Flux();
+    if (total <= 0) return;
+    size_t maxNodes = std::max(maxBytes / sizeof(Node), (size_t)1);
+
+    struct RefineItem {
+        uint32_t node;
+        int recordedNode;
+        float flux[4];
+        int depth;
+    };
+    std::vector<RefineItem> todo;
+    RefineItem root{0, 0, {0, 0, 0, 0}, 1};
+    for (int q = 0; q < 4; ++q) root.flux[q] = recorded.nodes[0].sum[q];
+    todo.push_back(root);
+    while (!todo.empty()) {
+        RefineItem item = todo.back();
+        todo.pop_back();
+        for (int q = 0; q < 4; ++q) {
+            if (item.depth >= maxDepth || nodes.size() >= maxNodes ||
+                item.flux[q] <= rho * total)
+                continue;
+            RefineItem child;
+            child.node = nodes.size();
+            child.depth = item.depth + 1;
+            nodes.push_back(Node());
+            nodes[item.node].child[q] = child.node;
+            uint32_t rc =
+                item.recordedNode >= 0
+                    ? recorded.nodes[item.recordedNode].child[q]
+                    : 0;
+            child.recordedNode = rc ? int(rc) : -1;
+            for (int j = 0; j < 4; ++j)
+                child.flux[j] =
+                    rc ? float(recorded.nodes[rc].sum[j]) : item.flux[q] / 4;
+            todo.push_back(child);
+        }
+    }
+}
+
+// SDTree Method Definitions
+SDTree::SDTree(const Bounds3f &bounds, int spatialThreshold, size_t maxBytes)
+    : bounds(bounds),
+      spatialThreshold(spatialThreshold),
+      maxBytes(maxBytes),
+      nodes(1) {
+    leaves.push_back(std::unique_ptr<DTreeWrapper>(new DTreeWrapper));
+}
+
+DTreeWrapper *SDTree::Lookup(const Point3f &p) const {
+    Vector3f o = bounds.Offset(p);
+    for (int i = 0; i < 3; ++i) o[i] = Clamp(o[i], 0, 1);
+    uint32_t node = 0;
+    while (nodes[node].children) {
+        int axis = nodes[node].axis;
+        if (o[axis] < 0.5f) {
+            o[axis] *= 2;
+            node = nodes[node].children;
+        } else {
+            o[axis] = 2 * o[axis] - 1;
+            node = nodes[node].children + 1;
+        }
+    }
+    return leaves[nodes[node].leaf].get();
+}
+
+size_t SDTree::MemoryBytes() const {
+    size_t bytes = nodes.size() * sizeof(Node);
+    for (const auto &leaf : leaves)
+        bytes += sizeof(DTreeWrapper) + leaf->building.MemoryBytes() +
+                 leaf->sampling.MemoryBytes();
+    return bytes;
+}
+
+void SDTree::Refine(int iteration) {
+    // Split spatial leaves that received more than the threshold number of
+    // samples; the threshold grows with the square root of the number of
+    // samples taken per pass, which doubles with each iteration
+    int64_t threshold =
+        int64_t(spatialThreshold * std::sqrt(std::pow(2.f, iteration)));
+    size_t bytes = MemoryBytes();
+    std::vector<uint32_t> todo;
+    for (uint32_t i = 0; i < nodes.size(); ++i)
+        if (!nodes[i].children) todo.push_back(i);
+    while (!todo.empty()) {
+        uint32_t node = todo.back();
+        todo.pop_back();
+        DTreeWrapper *leaf = leaves[nodes[node].leaf].get();
+        if (leaf->building.SampleCount() < threshold) continue;
+        size_t leafBytes = sizeof(DTreeWrapper) + leaf->building.MemoryBytes() +
+                           leaf->sampling.MemoryBytes();
+        if (bytes + leafBytes + 2 * sizeof(Node) > maxBytes) break;
+        bytes += leafBytes + 2 * sizeof(Node);
+        ++nSpatialSplits;
+
+        // Both children start out with the parent's quadtrees and half of
+        // its samples
+        leaf->building.ScaleSampleCount(0.5f);
+        Node child;
+        child.axis = (nodes[node].axis + 1) % 3;
+        child.leaf = nodes[node].leaf;
+        uint32_t children = nodes.size();
+        nodes[node].children = children;
+        nodes.push_back(child);
+        child.leaf = leaves.size();
+        nodes.push_back(child);
+        leaves.push_back(std::unique_ptr<DTreeWrapper>(new DTreeWrapper(*leaf)));
+        todo.push_back(children);
+        todo.push_back(children + 1);
+    }
+
+    // Sample from what was recorded in this pass and rebuild each leaf's
+    // quadtree to match it, sharing the remaining budget between leaves
+    size_t spatialBytes =
+        nodes.size() * sizeof(Node) + leaves.size() * sizeof(DTreeWrapper);
+    size_t leafBytes =
+        maxBytes > spatialBytes ? (maxBytes - spatialBytes) / leaves.size() : 0;
+    ParallelFor([&](int64_t i) {
+        DTreeWrapper *leaf = leaves[i].get();
+        leaf->sampling = leaf->building;
+        leaf->building.Refine(leaf->sampling, quadtreeThreshold,
+                              quadtreeMaxDepth, leafBytes / 2);
+    }, leaves.size(), 32);
+    dTreeBytes = MemoryBytes();
+}
+
+}  // namespace pbrt
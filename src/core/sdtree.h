@@ -0,0 +1,108 @@
+#ifndef SDTREE_H
+#define SDTREE_H
+
+// core/sdtree.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "parallel.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace pbrt {
+
+// DTree Declarations
+
+// A quadtree over the square of (cos theta, phi) direction coordinates,
+// which maps to the sphere of directions with a constant Jacobian of 4 Pi.
+// Each node stores the radiance recorded in each of its four quadrants;
+// the quadtree is refined so that every leaf holds roughly the same share
+// of the total, which makes sampling proportional to the recorded
+// radiance cheap.
+class DTree {
+  public:
+    // DTree Public Methods
+    DTree();
+    DTree(const DTree &t);
+    DTree &operator=(const DTree &t);
+    void Record(const Vector3f &w, float radiance);
+    float Pdf(const Vector3f &w) const;
+    Vector3f Sample(Point2f u, float *pdf) const;
+    void Refine(const DTree &recorded, float rho, int maxDepth,
+                size_t maxBytes);
+    float Flux() const;
+    int64_t SampleCount() const { return sampleCount; }
+    void ScaleSampleCount(float s) { sampleCount = int64_t(sampleCount * s); }
+    size_t MemoryBytes() const { return nodes.size() * sizeof(Node); }
+
+  private:
+    // DTree Private Declarations
+    struct Node {
+        Node() {
+            for (int i = 0; i < 4; ++i) {
+                sum[i] = 0;
+                child[i] = 0;
+            }
+        }
+        Node(const Node &n) { *this = n; }
+        Node &operator=(const Node &n) {
+            for (int i = 0; i < 4; ++i) {
+                sum[i] = float(n.sum[i]);
+                child[i] = n.child[i];
+            }
+            return *this;
+        }
+        float Sum() const { return sum[0] + sum[1] + sum[2] + sum[3]; }
+        AtomicFloat sum[4];
+        // Index of the node refining each quadrant; 0 for leaf quadrants,
+        // since the root can never be a child.
+        uint32_t child[4];
+    };
+
+    // DTree Private Data
+    std::vector<Node> nodes;
+    std::atomic<int64_t> sampleCount;
+};
+
+// The pair of quadtrees kept for each spatial cell: _sampling_ holds the
+// distribution learned in the previous pass, while _building_ collects
+// radiance during the current one.
+struct DTreeWrapper {
+    DTree building, sampling;
+};
+
+// SDTree Declarations
+
+// A binary tree over the scene bounds that alternates its split axis at
+// each level, with a directional quadtree at each leaf. The spatial tree
+// is refined between passes wherever enough samples were recorded, and
+// each leaf's quadtree is rebuilt from the radiance recorded into it.
+class SDTree {
+  public:
+    // SDTree Public Methods
+    SDTree(const Bounds3f &bounds, int spatialThreshold, size_t maxBytes);
+    DTreeWrapper *Lookup(const Point3f &p) const;
+    void Refine(int iteration);
+    size_t MemoryBytes() const;
+
+  private:
+    // SDTree Private Declarations
+    struct Node {
+        int axis = 0;
+        // Children are stored next to each other; 0 marks a leaf, since
+        // the root can never be a child.
+        uint32_t children = 0;
+        int leaf = 0;
+    };
+
+    // SDTree Private Data
+    const Bounds3f bounds;
+    const int spatialThreshold;
+    const size_t maxBytes;
+    std::vector<Node> nodes;
+    std::vector<std::unique_ptr<DTreeWrapper>> leaves;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_SDTREE_H
@@ -0,0 +1,63 @@
+#include "checkpoint.h"
+#include "fileutil.h"
+#include "imageio.h"
+#include "parallel.h"
+#include "renderserver.h"
+#include "stats.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace pbrt;
+
+// Render daemon: serves jobs for the built-in scenes over a UNIX socket;
+// see core/renderserver.h for the protocol.
+
+static void Usage(const char *msg = nullptr) {
+    if (msg) fprintf(stderr, "twray_server: %s\n\n", msg);
+    fprintf(stderr, R"(usage: twray_server [<options>]
+  --socket <path>        Socket to listen on (default: /tmp/twray.sock).
+  --cache-mb <n>         Memory budget for resident scenes (default: 4096).
+  --searchdir <dir>      Directory that scene assets are loaded from.
+  --nthreads <n>         Number of render threads (default: one per core).
+  --numa                 Pin threads to NUMA nodes and interleave scene data.
+  --help                 Print this help text.
+)");
+    exit(msg ? 1 : 0);
+}
+
+int main(int argc, char *argv[]) {
+    std::string socketPath = "/tmp/twray.sock", searchDir;
+    size_t cacheMB = 4096;
+    for (int i = 1; i < argc; ++i) {
+        auto value = [&]() -> const char * {
+            if (i + 1 == argc)
+                Usage(StringPrintf("missing value after %s", argv[i]).c_str());
+            return argv[++i];
+        };
+        if (!strcmp(argv[i], "--socket"))
+            socketPath = value();
+        else if (!strcmp(argv[i], "--cache-mb"))
+            cacheMB = atol(value());
+        else if (!strcmp(argv[i], "--searchdir"))
+            searchDir = value();
+        else if (!strcmp(argv[i], "--nthreads"))
+            PbrtOptions.nThreads = atoi(value());
+        else if (!strcmp(argv[i], "--numa"))
+            PbrtOptions.numa = true;
+        else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+            Usage();
+        else
+            Usage(StringPrintf("argument \"%s\" unknown", argv[i]).c_str());
+    }
+
+    ParallelInit();
+    InitProfiler();
+    if (!searchDir.empty()) SetSearchDirectory(searchDir);
+    RenderServer server(socketPath, cacheMB << 20);
+    bool ok = server.Run();
+    WaitForImageWrites();
+    WaitForCheckpointWrites();
+    CleanupProfiler();
+    ParallelCleanup();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,292 @@
+// core/session.cpp*
+#include "session.h"
+#include "bvh.h"
+#include "camera.h"
+#include "film.h"
+#include "fileutil.h"
+#include "paramset.h"
+#include "samplers/halton.h"
+#include "integrators/bdpt.h"
+#include "integrators/directlighting.h"
+#include "integrators/mlt.h"
+#include "integrators/path.h"
+#include "integrators/sppm.h"
+#include "integrators/vcm.h"
+#include "integrators/volpath.h"
+#include "stats.h"
+#include <sstream>
+
+namespace pbrt {
+
+STAT_COUNTER("Session/Scene builds", nSceneBuilds);
+STAT_COUNTER("Session/Camera builds", nCameraBuilds);
+STAT_COUNTER("Session/Sampler builds", nSamplerBuilds);
+
+// RenderSession Local Definitions
+// Adds a parameter given as "type:name=value" to _params_
+static bool AddParam(ParamSet *params, const std::string &spec) {
+    size_t colon = spec.find(':'), equals = spec.find('=');
+    if (colon == std::string::npos || equals == std::string::npos ||
+        equals < colon) {
+        Error("Integrator parameter \"%s\" isn't of the form "
+              "\"type:name=value\"", spec.c_str());
+        return false;
+    }
+    std::string type = spec.substr(0, colon);
+    std::string name = spec.substr(colon + 1, equals - colon - 1);
+    std::string value = spec.substr(equals + 1);
+    if (type == "int") {
+        auto v = std::make_unique<int[]>(1);
+        v[0] = atoi(value.c_str());
+        params->AddInt(name, std::move(v), 1);
+    } else if (type == "float") {
+        auto v = std::make_unique<float[]>(1);
+        v[0] = atof(value.c_str());
+        params->AddFloat(name, std::move(v), 1);
+    } else if (type == "bool") {
+        auto v = std::make_unique<bool[]>(1);
+        v[0] = value == "true" || value == "1";
+        params->AddBool(name, std::move(v), 1);
+    } else if (type == "string") {
+        auto v = std::make_unique<std::string[]>(1);
+        v[0] = value;
+        params->AddString(name, std::move(v), 1);
+    } else {
+        Error("Unknown type \"%s\" for integrator parameter \"%s\"",
+              type.c_str(), name.c_str());
+        return false;
+    }
+    return true;
+}
+
+static Integrator *CreateIntegrator(const std::string &name,
+                                    const ParamSet &params,
+                                    std::shared_ptr<Sampler> sampler,
+                                    std::shared_ptr<const Camera> camera) {
+    if (name == "path")
+        return CreatePathIntegrator(params, sampler, camera);
+    else if (name == "volpath")
+        return CreateVolPathIntegrator(params, sampler, camera);
+    else if (name == "directlighting")
+        return CreateDirectLightingIntegrator(params, sampler, camera);
+    else if (name == "bdpt")
+        return CreateBDPTIntegrator(params, sampler, camera);
+    else if (name == "sppm")
+        return CreateSPPMIntegrator(params, camera);
+    else if (name == "vcm")
+        return CreateVCMIntegrator(params, sampler, camera);
+    else if (name == "mlt")
+        return CreateMLTIntegrator(params, camera);
+    Error("Integrator \"%s\" unknown; using \"path\".", name.c_str());
+    return CreatePathIntegrator(params, sampler, camera);
+}
+
+// RenderSession Method Definitions
+std::shared_ptr<const Camera> RenderSession::Prepare(
+    const RenderSettings &s) {
+    bool newCamera = !camera || s.width != settings.width ||
+                     s.height != settings.height ||
+                     s.outputFile != settings.outputFile ||
+                     s.filter != settings.filter ||
+                     s.filterImportanceSampling !=
+                         settings.filterImportanceSampling ||
+                     s.aovs != settings.aovs || s.denoise != settings.denoise ||
+                     s.streaming != settings.streaming;
+    if (newCamera) {
+        camera = buildCamera(s);
+        ++nCameraBuilds;
+    }
+
+    // The sampler's sample bounds come from the film, so a new camera
+    // always requires a new sampler
+    bool newSampler =
+        newCamera || !sampler || s.samplesPerPixel != settings.samplesPerPixel;
+    if (newSampler) {
+        ParamSet sampParams;
+        auto samplePerPixel = std::make_unique<int[]>(1);
+        samplePerPixel[0] = s.samplesPerPixel;
+        sampParams.AddInt("pixelsamples", std::move(samplePerPixel), 1);
+        sampler.reset(
+            CreateHaltonSampler(sampParams, camera->film->GetSampleBounds()));
+        ++nSamplerBuilds;
+    }
+
+    if (newSampler || !integrator || s.maxDepth != settings.maxDepth ||
+        s.pathGuiding != settings.pathGuiding ||
+        s.integrator != settings.integrator ||
+        s.integratorParams != settings.integratorParams) {
+        ParamSet integParams;
+        auto maxDepth = std::make_unique<int[]>(1);
+        maxDepth[0] = s.maxDepth;
+        integParams.AddInt("maxdepth", std::move(maxDepth), 1);
+
+        auto guiding = std::make_unique<bool[]>(1);
+        guiding[0] = s.pathGuiding;
+        integParams.AddBool("guiding", std::move(guiding), 1);
+
+        // SPPM runs until its estimate settles rather than for a fixed
+        // number of iterations
+        auto iterations = std::make_unique<int[]>(1);
+        iterations[0] = 1024;
+        integParams.AddInt("numiterations", std::move(iterations), 1);
+
+        auto convergence = std::make_unique<float[]>(1);
+        convergence[0] = 0.005f;
+        integParams.AddFloat("convergencethreshold", std::move(convergence),
+                             1);
+
+        auto radius = std::make_unique<float[]>(1);
+        radius[0] = 0.025;
+        integParams.AddFloat("radius", std::move(radius), 1);
+
+        for (const std::string &spec : s.integratorParams)
+            AddParam(&integParams, spec);
+        integrator.reset(
+            CreateIntegrator(s.integrator, integParams, sampler, camera));
+        integrator->SetHeatmapSettings(GetHeatmapSettings(integParams));
+    }
+    settings = s;
+    return camera;
+}
+
+void RenderSession::LoadScene() {
+    if (scene) return;
+    ProfilePhase _(Prof::SceneConstruction);
+    std::vector<std::shared_ptr<Primitive>> objects;
+    std::vector<std::shared_ptr<Light>> lights;
+    buildScene(objects, lights);
+    ParamSet bvhParams;
+    std::shared_ptr<Primitive> bvh = CreateBVHAccelerator(objects, bvhParams);
+    scene.reset(new Scene(bvh, lights));
+    ++nSceneBuilds;
+}
+
+void RenderSession::Render(std::shared_ptr<RenderControl> control) {
+    CHECK(integrator) << "RenderSession::Prepare() must be called first";
+    LoadScene();
+
+    // The film may still hold the previous render's samples
+    camera->film->Clear();
+    integrator->SetRenderControl(control);
+    integrator->Render(*scene);
+}
+
+bool ParseRenderSettings(const std::string &line, RenderSettings *settings,
+                         std::string *sceneName, std::string *error,
+                         std::map<std::string, std::string> *extra) {
+    std::istringstream tokens(line);
+    std::string token;
+    while (tokens >> token) {
+        size_t equals = token.find('=');
+        if (equals == std::string::npos) {
+            *error = "expected key=value, got \"" + token + "\"";
+            return false;
+        }
+        std::string key = token.substr(0, equals);
+        std::string value = token.substr(equals + 1);
+        if (key == "scene")
+            *sceneName = value;
+        else if (key == "width")
+            settings->width = atoi(value.c_str());
+        else if (key == "height")
+            settings->height = atoi(value.c_str());
+        else if (key == "spp")
+            settings->samplesPerPixel = atoi(value.c_str());
+        else if (key == "maxdepth")
+            settings->maxDepth = atoi(value.c_str());
+        else if (key == "integrator")
+            settings->integrator = value;
+        else if (key == "guiding")
+            settings->pathGuiding = value == "1" || value == "true";
+        else if (key == "param")
+            settings->integratorParams.push_back(value);
+        else if (key == "outfile")
+            settings->outputFile = value;
+        else if (key == "filter")
+            settings->filter = value;
+        else if (key == "filtersampling")
+            settings->filterImportanceSampling = value == "1" || value == "true";
+        else if (key == "aovs")
+            settings->aovs = value == "1" || value == "true";
+        else if (key == "denoise")
+            settings->denoise = value == "1" || value == "true";
+        else if (key == "streaming")
+            settings->streaming = value == "1" || value == "true";
+        else if (extra)
+            (*extra)[key] = value;
+        else {
+            *error = "unknown key \"" + key + "\"";
+            return false;
+        }
+    }
+    return ValidateRenderSettings(*settings, error);
+}
+
+bool UsesSamplerTiles(const RenderSettings &settings) {
+    if (settings.integrator == "path" || settings.integrator == "volpath")
+        return true;
+    if (settings.integrator != "directlighting") return false;
+    ParamSet params;
+    for (const std::string &spec : settings.integratorParams)
+        AddParam(&params, spec);
+    return params.FindOneString("strategy", "all") != "restir";
+}
+
+bool ValidateRenderSettings(const RenderSettings &settings,
+                            std::string *error) {
+    if (settings.width <= 0 || settings.height <= 0 ||
+        settings.samplesPerPixel <= 0) {
+        *error = "image resolution and sample count must be positive";
+        return false;
+    }
+    if (!MakeFilter(settings.filter, ParamSet())) {
+        *error = "unknown filter \"" + settings.filter + "\"";
+        return false;
+    }
+    bool exr = HasExtension(settings.outputFile, ".exr");
+    if (settings.aovs && settings.integrator != "path" &&
+        settings.integrator != "volpath") {
+        *error = "AOVs need the path or volpath integrator";
+        return false;
+    }
+    if (settings.aovs && !exr) {
+        *error = "AOVs can only be written to an EXR output file";
+        return false;
+    }
+    // Rows are written once all the tiles touching them have been merged,
+    // which only the SamplerIntegrator tile loop does; the others splat,
+    // set the whole image or merge their own tiles over several passes
+    if (settings.streaming && !UsesSamplerTiles(settings)) {
+        *error = "streaming needs a path, volpath or directlighting "
+                 "integrator, without the restir strategy";
+        return false;
+    }
+    if (settings.streaming && !exr) {
+        *error = "streaming can only write an EXR output file";
+        return false;
+    }
+    if (settings.streaming && (settings.aovs || settings.denoise)) {
+        *error = "streaming can't be combined with AOVs or denoising";
+        return false;
+    }
+    return true;
+}
+
+std::string FormatRenderSettings(const RenderSettings &settings,
+                                 const std::string &sceneName) {
+    std::string line = StringPrintf(
+        "scene=%s width=%d height=%d spp=%d maxdepth=%d integrator=%s "
+        "guiding=%d outfile=%s filter=%s filtersampling=%d aovs=%d "
+        "denoise=%d streaming=%d",
+        sceneName.c_str(), settings.width, settings.height,
+        settings.samplesPerPixel, settings.maxDepth,
+        settings.integrator.c_str(), settings.pathGuiding ? 1 : 0,
+        settings.outputFile.c_str(), settings.filter.c_str(),
+        settings.filterImportanceSampling ? 1 : 0, settings.aovs ? 1 : 0,
+        settings.denoise ? 1 : 0, settings.streaming ? 1 : 0);
+    for (const std::string &param : settings.integratorParams)
+        line += " param=" + param;
+    return line;
+}
+
+}  // namespace pbrt
@@ -0,0 +1,113 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+// core/session.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "scene.h"
+#include <functional>
+#include <map>
+
+namespace pbrt {
+
+// RenderSettings Declarations
+struct RenderSettings {
+    int width = 500;
+    int height = 500;
+    int samplesPerPixel = 4;
+    int maxDepth = 5;
+    bool pathGuiding = false;
+    std::string outputFile = "twray.png";
+    // Reconstruction filter: "box", "gaussian", "mitchell" or "sinc"
+    std::string filter = "box";
+    // Draw camera samples from the filter instead of splatting each one
+    // over the pixels within the filter's radius
+    bool filterImportanceSampling = false;
+    // Record albedo, normal, depth and primitive id AOVs (path and volpath
+    // integrators only); they're written as layers of EXR output images
+    bool aovs = false;
+    // Denoise the output image, guided by the AOVs where the integrator
+    // records them; see core/denoise.h
+    bool denoise = false;
+    // Write finished rows of the image to disk as rendering proceeds
+    // instead of keeping the whole image in memory; only for EXR output
+    // of the SamplerIntegrators, and not with AOVs or denoising
+    bool streaming = false;
+    // One of "path", "volpath", "directlighting", "bdpt", "sppm", "vcm"
+    // or "mlt"
+    std::string integrator = "path";
+    // Additional integrator parameters, given as "type:name=value" with a
+    // type of int, float, bool or string; they override the settings
+    // above.
+    std::vector<std::string> integratorParams;
+};
+
+// RenderSession Declarations
+// A RenderSession keeps the scene (geometry, materials, BVH and light
+// structures) alive between renders. Changing the settings only rebuilds
+// what they invalidate: the camera and film when the resolution, output
+// file, filter, AOVs or denoising change,
+// the sampler when the sample count changes and the integrator when
+// either of those, the path depth or path guiding changes.
+class RenderSession {
+  public:
+    // RenderSession Public Types
+    typedef std::function<void(std::vector<std::shared_ptr<Primitive>> &,
+                               std::vector<std::shared_ptr<Light>> &)>
+        SceneBuilder;
+    // Builds a camera and film for the resolution, output file and filter
+    // in the given settings
+    typedef std::function<std::shared_ptr<const Camera>(
+        const RenderSettings &settings)>
+        CameraBuilder;
+
+    // RenderSession Public Methods
+    RenderSession(SceneBuilder buildScene, CameraBuilder buildCamera)
+        : buildScene(std::move(buildScene)),
+          buildCamera(std::move(buildCamera)) {}
+    // Cheap; brings the camera, sampler and integrator up to date with
+    // _settings_. Must not be called while a render is in progress.
+    std::shared_ptr<const Camera> Prepare(const RenderSettings &settings);
+    // Builds the scene and its acceleration structures, unless that has
+    // already been done.
+    void LoadScene();
+    // Loads the scene on first use, then renders into a cleared film.
+    void Render(std::shared_ptr<RenderControl> control);
+
+  private:
+    // RenderSession Private Data
+    const SceneBuilder buildScene;
+    const CameraBuilder buildCamera;
+    RenderSettings settings;
+    std::unique_ptr<Scene> scene;
+    std::shared_ptr<const Camera> camera;
+    std::shared_ptr<Sampler> sampler;
+    std::unique_ptr<Integrator> integrator;
+};
+
+// True if the settings' integrator renders through the SamplerIntegrator
+// tile loop, which streaming films and distributed rendering rely on:
+// path, volpath, or directlighting without its "restir" strategy, which
+// runs passes over the whole image of its own
+bool UsesSamplerTiles(const RenderSettings &settings);
+// Returns false, with a message in _error_, if _settings_ can't be
+// rendered, e.g. because a film feature isn't supported by the integrator
+// or the output format
+bool ValidateRenderSettings(const RenderSettings &settings,
+                            std::string *error);
+// Parses a line of space-separated _key=value_ tokens: scene, width,
+// height, spp, maxdepth, integrator, guiding (0 or 1), param (repeatable),
+// outfile, filter, filtersampling (0 or 1), aovs (0 or 1), denoise (0 or
+// 1) and streaming (0 or 1). Other keys are stored in _extra_ if it is
+// given and are an error otherwise. The settings are checked with
+// ValidateRenderSettings().
+bool ParseRenderSettings(const std::string &line, RenderSettings *settings,
+                         std::string *sceneName, std::string *error,
+                         std::map<std::string, std::string> *extra = nullptr);
+// Inverse of ParseRenderSettings(); values must not contain spaces.
+std::string FormatRenderSettings(const RenderSettings &settings,
+                                 const std::string &sceneName);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_SESSION_H
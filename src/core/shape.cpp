@@ -5,6 +5,28 @@
 
 namespace pbrt {
 
+// DirectionCone Function Definitions
+DirectionCone Union(const DirectionCone &a, const DirectionCone &b) {
+    if (a.IsEmpty()) return b;
+    if (b.IsEmpty()) return a;
+
+    // Return the larger cone if it already contains the smaller one
+    float thetaA = std::acos(Clamp(a.cosTheta, -1, 1));
+    float thetaB = std::acos(Clamp(b.cosTheta, -1, 1));
+    float thetaD = std::acos(Clamp(Dot(a.w, b.w), -1, 1));
+    if (std::min(thetaD + thetaB, Pi) <= thetaA) return a;
+    if (std::min(thetaD + thetaA, Pi) <= thetaB) return b;
+
+    // Otherwise find the cone that just spans both, rotating _a.w_
+    // towards _b.w_
+    float thetaO = (thetaA + thetaD + thetaB) / 2;
+    if (thetaO >= Pi) return DirectionCone::EntireSphere();
+    Vector3f wr = Cross(a.w, b.w);
+    if (wr.LengthSquared() == 0) return DirectionCone::EntireSphere();
+    Vector3f w = Rotate(Degrees(thetaO - thetaA), wr)(a.w);
+    return DirectionCone(w, std::cos(thetaO));
+}
+
 // Shape Method Definitions
 Shape::~Shape() {}
 
@@ -10,6 +10,24 @@
 
 namespace pbrt{
 
+// DirectionCone Declarations
+// A bound on a set of directions: all of them lie within _cosTheta_ of
+// the cone's central direction _w_. The default cone is empty.
+struct DirectionCone {
+    DirectionCone() = default;
+    DirectionCone(const Vector3f &w, float cosTheta)
+        : w(Normalize(w)), cosTheta(cosTheta) {}
+    static DirectionCone EntireSphere() {
+        return DirectionCone(Vector3f(0, 0, 1), -1);
+    }
+    bool IsEmpty() const { return cosTheta == Infinity; }
+
+    Vector3f w;
+    float cosTheta = Infinity;
+};
+
+DirectionCone Union(const DirectionCone &a, const DirectionCone &b);
+
 class Shape {
   public:
     // Shape Interface
@@ -44,6 +62,13 @@ class Shape {
     // used in this case.
     virtual float SolidAngle(const Point3f &p, int nSamples = 512) const;
 
+    // Returns a bound on the geometric normals (the _n_ of the
+    // interactions returned by Intersect() and Sample()) over the shape.
+    // Area lights use it to bound their emission directions.
+    virtual DirectionCone NormalBounds() const {
+        return DirectionCone::EntireSphere();
+    }
+
     // Shape Public Data
     const Transform *ObjectToWorld, *WorldToObject;
     const bool reverseOrientation;
@@ -145,6 +145,9 @@ enum class Prof {
     MergeFilmTile,
     SplatFilm,
     AddFilmSample,
+    AddFilmAOVs,
+    AOVAlbedo,
+    Denoise,
     StartPixel,
     GetSample,
     TexFiltTrilerp,
@@ -200,6 +203,9 @@ static const char *ProfNames[] = {
     "Film::MergeTile()",
     "Film::AddSplat()",
     "Film::AddSample()",
+    "FilmTile AOV accumulation",
+    "AOV albedo estimation",
+    "Denoising",
     "Sampler::StartPixelSample()",
     "Sampler::GetSample[12]D()",
     "MIPMap::Lookup() (trilinear)",
@@ -18,8 +18,7 @@ inline std::string copyToFormatString(const char **fmt_ptr, std::string *s) {
             *s += *fmt;
             ++fmt;
         } else if (fmt[1] == '%') {
-            // "%%"; let it pass through
-            *s += '%';
+            // "%%"; print a single '%'
             *s += '%';
             fmt += 2;
         } else
@@ -54,6 +53,15 @@ inline std::string formatOne(const char *fmt, T v) {
     return str;
 }
 
+// Base case of stringPrintfRecursive(): no arguments are left, so copy
+// the rest of the formatting string.
+inline void stringPrintfRecursive(std::string *s, const char *fmt) {
+    for (const char *c = fmt; *c; ++c) {
+        if (c[0] == '%' && c[1] == '%') ++c;
+        *s += *c;
+    }
+}
+
 // General-purpose version of stringPrintfRecursive; add the formatted
 // output for a single StringPrintf() argument to the final result string
 // in *s.
@@ -62,7 +70,7 @@ inline void stringPrintfRecursive(std::string *s, const char *fmt, T v,
                                   Args... args) {
     std::string nextFmt = copyToFormatString(&fmt, s);
     *s += formatOne(nextFmt.c_str(), v);
-    // stringPrintfRecursive(s, fmt, args...);
+    stringPrintfRecursive(s, fmt, args...);
 }
 
 // Special case of StringPrintRecursive for float-valued arguments.
@@ -82,7 +90,7 @@ inline void stringPrintfRecursive(std::string *s, const char *fmt, float v,
         *s += formatOne(nextFmt.c_str(), v);
 
     // Go forth and print the next arg.
-    // stringPrintfRecursive(s, fmt, args...);
+    stringPrintfRecursive(s, fmt, args...);
 }
 
 // Specialization for doubles that always uses enough precision.  (It seems
@@ -96,7 +104,7 @@ inline void stringPrintfRecursive(std::string *s, const char *fmt, double v,
         *s += formatOne("%.17g", v);
     else
         *s += formatOne(nextFmt.c_str(), v);
-    // stringPrintfRecursive(s, fmt, args...);
+    stringPrintfRecursive(s, fmt, args...);
 }
 
 // StringPrintf() is a replacement for sprintf() (and the like) that
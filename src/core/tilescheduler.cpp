@@ -0,0 +1,118 @@
+// core/tilescheduler.cpp*
+#include "tilescheduler.h"
+#include <algorithm>
+#include <limits>
+
+namespace pbrt {
+
+// Returns the index of _(x, y)_ along a Hilbert curve covering a square
+// grid of _n_ cells on a side, where _n_ is a power of two.
+static int64_t HilbertIndex(int n, int x, int y) {
+    int64_t d = 0;
+    for (int s = n / 2; s > 0; s /= 2) {
+        int rx = (x & s) > 0, ry = (y & s) > 0;
+        d += int64_t(s) * int64_t(s) * ((3 * rx) ^ ry);
+        // Rotate the quadrant so that the curve's sub-curves connect
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+// TileScheduler Method Definitions
+TileScheduler::TileScheduler(const Bounds2i &sampleBounds, int tileSize,
+                             TileOrder order)
+    : sampleBounds(sampleBounds), tileSize(tileSize), order(order) {
+    Vector2i extent = sampleBounds.Diagonal();
+    nBaseTiles = Point2i((extent.x + tileSize - 1) / tileSize,
+                         (extent.y + tileSize - 1) / tileSize);
+    int nTiles = nBaseTiles.x * nBaseTiles.y;
+    costs.resize(MaxTileId(), 0.f);
+
+    // Compute the position of each tile along the scheduling order
+    curveIndex.resize(nTiles);
+    int n = RoundUpPow2(std::max(nBaseTiles.x, nBaseTiles.y));
+    Point2f center(0.5f * nBaseTiles.x, 0.5f * nBaseTiles.y);
+    for (int y = 0; y < nBaseTiles.y; ++y)
+        for (int x = 0; x < nBaseTiles.x; ++x) {
+            int64_t &index = curveIndex[y * nBaseTiles.x + x];
+            if (order == TileOrder::Hilbert)
+                index = HilbertIndex(n, x, y);
+            else if (order == TileOrder::Spiral) {
+                // Order tiles by the square ring around the center they
+                // lie on, and then by their angle around it
+                Vector2f d = Point2f(x + 0.5f, y + 0.5f) - center;
+                int ring = int(std::max(std::abs(d.x), std::abs(d.y)));
+                float angle = std::atan2(d.y, d.x) + Pi;
+                index = int64_t(ring) * 1024 +
+                        std::min(int(angle * Inv2Pi * 1024), 1023);
+            } else
+                index = y * nBaseTiles.x + x;
+        }
+    PlanTiles();
+}
+
+void TileScheduler::NextPass() {
+    PlanTiles();
+    std::fill(costs.begin(), costs.end(), 0.f);
+}
+
+void TileScheduler::AddCost(const Bounds2i &bounds, float seconds) {
+    Point2i center((bounds.pMin.x + bounds.pMax.x) / 2,
+                   (bounds.pMin.y + bounds.pMax.y) / 2);
+    if (!InsideExclusive(center, sampleBounds)) return;
+    Vector2i offset = center - sampleBounds.pMin;
+    int t = offset.y / tileSize * nBaseTiles.x + offset.x / tileSize;
+    costs[4 * t] += seconds;
+}
+
+void TileScheduler::PlanTiles() {
+    // Sort the tiles by their cost in the last pass, rounded to a power of
+    // two so that tiles of similar cost keep their order along the curve.
+    // Costs under a second have negative buckets, so tiles without a
+    // measured cost get the lowest bucket and go last.
+    int nTiles = nBaseTiles.x * nBaseTiles.y;
+    std::vector<int> costBucket(nTiles, std::numeric_limits<int>::min());
+    for (int i = 0; i < nTiles; ++i) {
+        float cost = costs[4 * i] + costs[4 * i + 1] + costs[4 * i + 2] +
+                     costs[4 * i + 3];
+        if (cost > 0) costBucket[i] = int(std::ceil(std::log2(cost)));
+    }
+    std::vector<int> baseOrder(nTiles);
+    for (int i = 0; i < nTiles; ++i) baseOrder[i] = i;
+    std::sort(baseOrder.begin(), baseOrder.end(), [&](int a, int b) {
+        if (costBucket[a] != costBucket[b])
+            return costBucket[a] > costBucket[b];
+        return curveIndex[a] < curveIndex[b];
+    });
+
+    // Split the tiles scheduled last into quarters
+    int nSplit = tileSize >= 8 ? std::min(2 * MaxThreadIndex(), nTiles / 4)
+                               : 0;
+    tiles.clear();
+    for (int i = 0; i < nTiles; ++i) {
+        int t = baseOrder[i];
+        Point2i p0 = sampleBounds.pMin + Vector2i(t % nBaseTiles.x * tileSize,
+                                                  t / nBaseTiles.x * tileSize);
+        Point2i p1 = Point2i(std::min(p0.x + tileSize, sampleBounds.pMax.x),
+                             std::min(p0.y + tileSize, sampleBounds.pMax.y));
+        if (i < nTiles - nSplit) {
+            tiles.push_back(ScheduledTile{Bounds2i(p0, p1), 4 * t});
+            continue;
+        }
+        Point2i pMid(std::min(p0.x + tileSize / 2, p1.x),
+                     std::min(p0.y + tileSize / 2, p1.y));
+        for (int q = 0; q < 4; ++q) {
+            Bounds2i b(Point2i(q & 1 ? pMid.x : p0.x, q & 2 ? pMid.y : p0.y),
+                       Point2i(q & 1 ? p1.x : pMid.x, q & 2 ? p1.y : pMid.y));
+            if (b.Area() > 0) tiles.push_back(ScheduledTile{b, 4 * t + q});
+        }
+    }
+}
+
+}  // namespace pbrt
@@ -0,0 +1,82 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+// core/tilescheduler.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "parallel.h"
+#include <atomic>
+#include <chrono>
+
+namespace pbrt {
+
+// TileScheduler Declarations
+enum class TileOrder { RowMajor, Hilbert, Spiral };
+
+struct ScheduledTile {
+    Bounds2i bounds;
+    // Identifies the tile independently of the order that tiles are
+    // scheduled in; useful for seeding per-tile samplers.
+    int id;
+};
+
+// Partitions an image's sample bounds into square tiles and hands them
+// out to render threads in a fixed order: along a Hilbert curve, so that
+// consecutively rendered tiles are close on screen, or in a spiral from
+// the image center, which shows the usual subject first when rendering
+// interactively. The time spent on each tile is recorded, and later passes
+// start the most expensive tiles first so that they don't end up as
+// stragglers. The tiles scheduled last in each pass are split into
+// quarters so that threads finish at about the same time.
+class TileScheduler {
+  public:
+    // TileScheduler Public Methods
+    TileScheduler(const Bounds2i &sampleBounds, int tileSize, TileOrder order);
+    const std::vector<ScheduledTile> &Tiles() const { return tiles; }
+    // Upper bound on the tile ids
+    int MaxTileId() const { return 4 * nBaseTiles.x * nBaseTiles.y; }
+    // Reorders the tiles using the costs recorded since the last call
+    void NextPass();
+    // Adds _seconds_ to the cost of the tile containing the center of
+    // _bounds_, e.g. to schedule the first pass by the tile costs of an
+    // earlier render; NextPass() then reorders the tiles
+    void AddCost(const Bounds2i &bounds, float seconds);
+    template <typename Func>
+    void ParallelForTiles(Func func);
+
+  private:
+    // TileScheduler Private Methods
+    void PlanTiles();
+
+    // TileScheduler Private Data
+    const Bounds2i sampleBounds;
+    const int tileSize;
+    const TileOrder order;
+    Point2i nBaseTiles;
+    // Position of each base tile along the scheduling curve
+    std::vector<int64_t> curveIndex;
+    // Seconds spent on each tile id in the current pass
+    std::vector<float> costs;
+    std::vector<ScheduledTile> tiles;
+};
+
+// TileScheduler Inline Method Definitions
+template <typename Func>
+void TileScheduler::ParallelForTiles(Func func) {
+    // Each task takes the next unstarted tile until none are left, so that
+    // tiles start in exactly the scheduled order
+    std::atomic<int> nextTile{0};
+    ParallelFor([&](int64_t) {
+        for (int i = nextTile++; i < (int)tiles.size(); i = nextTile++) {
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            func(tiles[i]);
+            costs[tiles[i].id] += std::chrono::duration<float>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+    }, MaxThreadIndex());
+}
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_TILESCHEDULER_H
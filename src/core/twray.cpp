@@ -313,7 +313,11 @@ std::shared_ptr<Light> add_infinite_light(std::string filename, Vector3f intensi
 
 std::shared_ptr<const Camera> add_camera(Point3f origin, Point3f lookAt, Vector3f up, 
                                         float fovc, int image_width, int image_height, 
-                                        MediumInterface mi, std::string filename){
+                                        MediumInterface mi, std::string filename,
+                                        const std::string &filterName,
+                                        bool filterImportanceSampling,
+                                        bool aovs, bool denoise,
+                                        bool streaming){
     ParamSet camParams;
     Transform *camToWorld = new Transform;
     *camToWorld = Inverse(LookAt(origin, lookAt, up));
@@ -324,7 +328,11 @@ std::shared_ptr<const Camera> add_camera(Point3f origin, Point3f lookAt, Vector3
     camParams.AddFloat("fov", std::move(fov), 1);
 
     ParamSet emptyParam;
-    std::unique_ptr<Filter> boxFilter = std::unique_ptr<Filter>(CreateBoxFilter(emptyParam));
+    std::unique_ptr<Filter> filter = MakeFilter(filterName, emptyParam);
+    if (!filter) {
+        Warning("Filter \"%s\" unknown; using \"box\"", filterName.c_str());
+        filter = MakeFilter("box", emptyParam);
+    }
     
     ParamSet filmParam;
     auto x_res = std::make_unique<int[]>(1);
@@ -336,8 +344,20 @@ std::shared_ptr<const Camera> add_camera(Point3f origin, Point3f lookAt, Vector3
     auto name = std::make_unique<std::string[]>(1);
     name[0] = filename;
     filmParam.AddString("filename", std::move(name), 1);
-
-    Film *film = CreateFilm(filmParam, std::move(boxFilter));
+    auto fis = std::make_unique<bool[]>(1);
+    fis[0] = filterImportanceSampling;
+    filmParam.AddBool("filterimportancesampling", std::move(fis), 1);
+    auto aovParam = std::make_unique<bool[]>(1);
+    aovParam[0] = aovs;
+    filmParam.AddBool("aovs", std::move(aovParam), 1);
+    auto denoiseParam = std::make_unique<bool[]>(1);
+    denoiseParam[0] = denoise;
+    filmParam.AddBool("denoise", std::move(denoiseParam), 1);
+    auto streamingParam = std::make_unique<bool[]>(1);
+    streamingParam[0] = streaming;
+    filmParam.AddBool("streaming", std::move(streamingParam), 1);
+
+    Film *film = CreateFilm(filmParam, std::move(filter));
 
     PerspectiveCamera *cam = CreatePerspectiveCamera(camParams, animatedCam2World, film, mi.outside);
     return std::shared_ptr<const Camera>(cam);
@@ -0,0 +1,35 @@
+#ifndef PBRT_FILTERS_GAUSSIAN_H
+#define PBRT_FILTERS_GAUSSIAN_H
+
+// filters/gaussian.h*
+#include "filter.h"
+
+namespace pbrt {
+
+// Gaussian Filter Declarations
+class GaussianFilter : public Filter {
+  public:
+    // GaussianFilter Public Methods
+    GaussianFilter(const Vector2f &radius, float alpha)
+        : Filter(radius),
+          alpha(alpha),
+          expX(std::exp(-alpha * radius.x * radius.x)),
+          expY(std::exp(-alpha * radius.y * radius.y)) {}
+    float Evaluate(const Point2f &p) const;
+
+  private:
+    // GaussianFilter Private Data
+    const float alpha;
+    const float expX, expY;
+
+    // GaussianFilter Utility Functions
+    float Gaussian(float d, float expv) const {
+        return std::max((float)0, float(std::exp(-alpha * d * d) - expv));
+    }
+};
+
+GaussianFilter *CreateGaussianFilter(const ParamSet &ps);
+
+}  // namespace pbrt
+
+#endif  // PBRT_FILTERS_GAUSSIAN_H
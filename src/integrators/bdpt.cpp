@@ -1,5 +1,6 @@
 // integrators/bdpt.cpp*
 #include "integrators/bdpt.h"
+#include "checkpoint.h"
 #include "film.h"
 #include "filters/box.h"
 #include "integrator.h"
@@ -7,12 +8,15 @@
 #include "paramset.h"
 #include "progressreporter.h"
 #include "sampler.h"
+#include "samplers/random.h"
 #include "stats.h"
+#include "tilescheduler.h"
 
 namespace pbrt {
 
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
 STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_MEMORY_COUNTER("Memory/BDPT light vertex cache", lightVertexCacheBytes);
 
 // BDPT Forward Declarations
 int RandomWalk(const Scene &scene, RayDifferential ray, Sampler &sampler,
@@ -261,6 +265,15 @@ float MISWeight(const Scene &scene, Vertex *lightVertices,
     return 1 / (1 + sumRi);
 }
 
+// The light subpaths traced in one pass, stored back to back. _depth_
+// gives each vertex's index within its subpath, and _connectible_ lists
+// the vertices past the light source that camera subpaths can connect to.
+struct LightVertexCache {
+    std::vector<Vertex> vertices;
+    std::vector<int> depth;
+    std::vector<int> connectible;
+};
+
 // BDPT Method Definitions
 inline int BufferIndex(int s, int t) {
     int above = s + t - 2;
@@ -268,8 +281,12 @@ inline int BufferIndex(int s, int t) {
 }
 
 void BDPTIntegrator::Render(const Scene &scene) {
-    std::unique_ptr<LightDistribution> lightDistribution =
-        CreateLightSampleDistribution(lightSampleStrategy, scene);
+    if (cacheConnections > 0) {
+        RenderWithLightVertexCache(scene);
+        return;
+    }
+    std::shared_ptr<LightDistribution> lightDistribution =
+        scene.GetLightSampleDistribution(lightSampleStrategy);
 
     // Compute a reverse mapping from light pointers to offsets into the
     // scene lights vector (and, equivalently, offsets into
@@ -282,11 +299,14 @@ void BDPTIntegrator::Render(const Scene &scene) {
     // Partition the image into tiles
     Film *film = camera->film;
     const Bounds2i sampleBounds = film->GetSampleBounds();
-    const Vector2i sampleExtent = sampleBounds.Diagonal();
     const int tileSize = 16;
-    const int nXTiles = (sampleExtent.x + tileSize - 1) / tileSize;
-    const int nYTiles = (sampleExtent.y + tileSize - 1) / tileSize;
-    ProgressReporter reporter(nXTiles * nYTiles, "Rendering");
+    TileScheduler scheduler(sampleBounds, tileSize, TileOrder::Hilbert);
+    BeginHeatmap(*film, &scheduler);
+    int64_t samplesTaken = 0;
+    int64_t nextSample = ResumeFromCheckpoint(&samplesTaken);
+    ProgressReporter reporter(
+        sampleBounds.Area() * std::max<int64_t>(sampleEnd - nextSample, 0),
+        "Rendering");
 
     // Allocate buffers for debug visualization
     const int bufferCount = (1 + maxDepth) * (6 + maxDepth) / 2;
@@ -309,29 +329,50 @@ void BDPTIntegrator::Render(const Scene &scene) {
         }
     }
 
-    // Render and write the output image to disk
-    if (scene.lights.size() > 0) {
-        ParallelFor2D([&](const Point2i tile) {
+    // Render and write the output image to disk. Checkpoints can only be
+    // taken and splats are only resolved between passes, so with
+    // checkpointing enabled or a progressive render each pass takes one
+    // sample per pixel.
+    const int64_t passSamples =
+        checkpoint.filename.empty() && !(control && control->progressive)
+            ? sampleEnd - nextSample
+            : 1;
+    std::chrono::steady_clock::time_point lastCheckpoint =
+        std::chrono::steady_clock::now();
+    while (nextSample < sampleEnd && scene.lights.size() > 0 &&
+           !Cancelled()) {
+        const int64_t passStart = nextSample;
+        const int64_t passEnd = std::min(passStart + passSamples,
+                                         (int64_t)sampleEnd);
+        scheduler.ParallelForTiles([&](const ScheduledTile &tile) {
             // Render a single tile using BDPT
             MemoryArena arena;
-            int seed = tile.y * nXTiles + tile.x;
+            // Passes are numbered by their first sample, so that resumed
+            // renders seed their tiles as the original render would have
+            int seed = (int)passStart * scheduler.MaxTileId() + tile.id;
             std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
-            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
-            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+            const Bounds2i &tileBounds = tile.bounds;
             LOG(INFO) << "Starting image tile " << tileBounds;
 
             std::unique_ptr<FilmTile> filmTile =
                 camera->film->GetFilmTile(tileBounds);
+            const FilterSampler *filterSampler =
+                camera->film->GetFilterSampler();
+            CostMeter tileCost(heatmap.get());
             for (Point2i pPixel : tileBounds) {
+                CostMeter pixelCost(heatmap.get());
                 tileSampler->StartPixel(pPixel);
                 if (!InsideExclusive(pPixel, pixelBounds))
                     continue;
+                if (!tileSampler->SetSampleNumber(passStart)) continue;
                 do {
                     // Generate a single sample using BDPT
-                    Point2f pFilm = (Point2f)pPixel + tileSampler->Get2D();
+                    float filterWeight = 1;
+                    Point2f pFilm =
+                        filterSampler
+                            ? filterSampler->SampleFilm(
+                                  pPixel, tileSampler->Get2D(), &filterWeight)
+                            : (Point2f)pPixel + tileSampler->Get2D();
 
                     // Trace the camera subpath
                     Vertex *cameraVertices = arena.Alloc<Vertex>(maxDepth + 2);
@@ -345,7 +386,9 @@ void BDPTIntegrator::Render(const Scene &scene) {
                     // distribution on any of the vertices of the camera
                     // path is unlikely to be a good strategy. We use the
                     // PowerLightDistribution by default here, which
-                    // doesn't use the point passed to it.
+                    // doesn't use the point passed to it. With the "bvh"
+                    // strategy, this evaluates the light BVH at the
+                    // camera, which is cached per voxel.
                     const Distribution1D *lightDistr =
                         lightDistribution->Lookup(cameraVertices[0].p());
                     // Now trace the light subpath
@@ -389,17 +432,32 @@ void BDPTIntegrator::Render(const Scene &scene) {
                     }
                     VLOG(2) << "Add film sample pFilm: " << pFilm << ", L: " << L <<
                         ", (y: " << L.y() << ")";
-                    filmTile->AddSample(pFilm, L);
+                    filmTile->AddPixelSample(pPixel, pFilm, filterWeight, L);
                     arena.Reset();
-                } while (tileSampler->StartNextSample());
+                } while (tileSampler->StartNextSample() &&
+                         tileSampler->CurrentSampleNumber() < passEnd);
+                pixelCost.RecordPixel(pPixel);
             }
+            tileCost.RecordTile(tileBounds, passStart, passEnd);
             film->MergeFilmTile(std::move(filmTile));
-            reporter.Update();
+            reporter.Update(tileBounds.Area() * (passEnd - passStart));
             LOG(INFO) << "Finished image tile " << tileBounds;
-        }, Point2i(nXTiles, nYTiles));
-        reporter.Done();
+        });
+        scheduler.NextPass();
+        film->ResolveSplats();
+        nextSample = passEnd;
+        samplesTaken += passEnd - passStart;
+        if (control) {
+            control->splatScale = 1.0f / samplesTaken;
+            ++control->passesDone;
+        }
+        if (checkpoint.Due(&lastCheckpoint))
+            SaveCheckpoint(nextSample, samplesTaken);
     }
-    film->WriteImage(1.0f / sampler->samplesPerPixel);
+    reporter.Done();
+    if (!checkpoint.filename.empty()) SaveCheckpoint(nextSample, samplesTaken);
+    film->WriteImage(1.0f / std::max<int64_t>(samplesTaken, 1));
+    WriteHeatmap();
 
     // Write buffers for debug visualization
     if (visualizeStrategies || visualizeWeights) {
@@ -409,12 +467,228 @@ void BDPTIntegrator::Render(const Scene &scene) {
     }
 }
 
-Spectrum ConnectBDPT(
-    const Scene &scene, Vertex *lightVertices, Vertex *cameraVertices, int s,
-    int t, const Distribution1D &lightDistr,
+void BDPTIntegrator::RenderWithLightVertexCache(const Scene &scene) {
+    std::shared_ptr<LightDistribution> lightDistribution =
+        scene.GetLightSampleDistribution(lightSampleStrategy);
+    std::unordered_map<const Light *, size_t> lightToIndex;
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+        lightToIndex[scene.lights[i].get()] = i;
+
+    // Partition the image into tiles
+    Film *film = camera->film;
+    const Bounds2i sampleBounds = film->GetSampleBounds();
+    const int tileSize = 16;
+    TileScheduler scheduler(sampleBounds, tileSize, TileOrder::Hilbert);
+    BeginHeatmap(*film, &scheduler);
+
+    // Cached light subpaths aren't associated with a camera subpath, so
+    // they all start from the light distribution at the camera. One is
+    // traced per pixel in each pass, as BDPT traces one per camera sample.
+    Point3f pCamera =
+        camera->CameraToWorld(camera->shutterOpen, Point3f(0, 0, 0));
+    const Distribution1D *lightDistr = lightDistribution->Lookup(pCamera);
+    const int nLightPaths = pixelBounds.Area();
+    // Each pass takes one sample per pixel, and pass _n_ takes sample _n_
+    int64_t samplesTaken = 0;
+    int pass = ResumeFromCheckpoint(&samplesTaken);
+    std::chrono::steady_clock::time_point lastCheckpoint =
+        std::chrono::steady_clock::now();
+
+    ProgressReporter reporter(std::max(sampleEnd - pass, 0), "Rendering");
+    std::vector<MemoryArena> lightArenas(MaxThreadIndex());
+    RandomSampler lightSampler(1);
+    LightVertexCache cache;
+    for (; pass < sampleEnd && !scene.lights.empty() && !Cancelled(); ++pass) {
+        // Trace this pass's light subpaths into the cache, splatting their
+        // connections to the camera
+        {
+            const int chunkSize = 1024;
+            const int nChunks = (nLightPaths + chunkSize - 1) / chunkSize;
+            std::vector<std::vector<Vertex>> chunkVertices(nChunks);
+            std::vector<std::vector<int>> chunkDepths(nChunks);
+            ParallelFor([&](int64_t chunk) {
+                MemoryArena &arena = lightArenas[ThreadIndex];
+                std::unique_ptr<Sampler> chunkSampler =
+                    lightSampler.Clone(pass * nChunks + chunk);
+                std::vector<Vertex> lightVertices(maxDepth + 1);
+                Vertex cameraVertex;
+                int end = std::min<int>((chunk + 1) * chunkSize, nLightPaths);
+                for (int i = chunk * chunkSize; i < end; ++i) {
+                    chunkSampler->StartPixel(Point2i(i, pass));
+                    float time = Lerp(chunkSampler->Get1D(),
+                                      camera->shutterOpen,
+                                      camera->shutterClose);
+                    int nLight = GenerateLightSubpath(
+                        scene, *chunkSampler, arena, maxDepth + 1, time,
+                        *lightDistr, lightToIndex, &lightVertices[0]);
+                    for (int s = 2; s <= nLight; ++s) {
+                        Point2f pRaster;
+                        Spectrum Lpath = ConnectBDPT(
+                            scene, &lightVertices[0], &cameraVertex, s, 1,
+                            *lightDistr, lightToIndex, *camera, *chunkSampler,
+                            &pRaster);
+                        if (!Lpath.IsBlack()) film->AddSplat(pRaster, Lpath);
+                    }
+                    for (int j = 0; j < nLight; ++j) {
+                        chunkVertices[chunk].push_back(lightVertices[j]);
+                        chunkDepths[chunk].push_back(j);
+                    }
+                }
+            }, nChunks, 1);
+
+            cache.vertices.clear();
+            cache.depth.clear();
+            cache.connectible.clear();
+            for (int c = 0; c < nChunks; ++c) {
+                cache.vertices.insert(cache.vertices.end(),
+                                      chunkVertices[c].begin(),
+                                      chunkVertices[c].end());
+                cache.depth.insert(cache.depth.end(), chunkDepths[c].begin(),
+                                   chunkDepths[c].end());
+            }
+            for (size_t v = 0; v < cache.vertices.size(); ++v)
+                if (cache.depth[v] > 0 && cache.vertices[v].IsConnectible())
+                    cache.connectible.push_back(v);
+            lightVertexCacheBytes = std::max(
+                lightVertexCacheBytes,
+                int64_t(cache.vertices.size() * sizeof(Vertex) +
+                        (cache.depth.size() + cache.connectible.size()) *
+                            sizeof(int)));
+        }
+
+        // Each camera subpath connects to _cacheConnections_ vertices
+        // chosen uniformly from the cache; scale their contributions so
+        // that they estimate the connections to one full light subpath
+        const int nConnectible = cache.connectible.size();
+        const float connectionScale =
+            float(nConnectible) / (float(nLightPaths) * cacheConnections);
+        scheduler.ParallelForTiles([&](const ScheduledTile &tile) {
+            MemoryArena arena;
+            std::unique_ptr<Sampler> tileSampler =
+                sampler->Clone(pass * scheduler.MaxTileId() + tile.id);
+            const Bounds2i &tileBounds = tile.bounds;
+            std::unique_ptr<FilmTile> filmTile = film->GetFilmTile(tileBounds);
+            const FilterSampler *filterSampler = film->GetFilterSampler();
+            // Connections temporarily modify the light vertices they use,
+            // so each one works on a private copy of its subpath
+            std::vector<Vertex> lightVertices(maxDepth + 1);
+            CostMeter tileCost(heatmap.get());
+            for (Point2i pPixel : tileBounds) {
+                CostMeter pixelCost(heatmap.get());
+                tileSampler->StartPixel(pPixel);
+                if (!InsideExclusive(pPixel, pixelBounds)) continue;
+                if (!tileSampler->SetSampleNumber(pass)) continue;
+                float filterWeight = 1;
+                Point2f pFilm =
+                    filterSampler
+                        ? filterSampler->SampleFilm(
+                              pPixel, tileSampler->Get2D(), &filterWeight)
+                        : (Point2f)pPixel + tileSampler->Get2D();
+                Vertex *cameraVertices = arena.Alloc<Vertex>(maxDepth + 2);
+                int nCamera =
+                    GenerateCameraSubpath(scene, *tileSampler, arena,
+                                          maxDepth + 2, *camera, pFilm,
+                                          cameraVertices);
+
+                // Execute the strategies that don't need a light subpath
+                Spectrum L(0.f);
+                for (int t = 2; t <= nCamera; ++t) {
+                    for (int s = 0; s <= 1 && s + t - 2 <= maxDepth; ++s) {
+                        Point2f pFilmNew = pFilm;
+                        L += ConnectBDPT(scene, &lightVertices[0],
+                                         cameraVertices, s, t, *lightDistr,
+                                         lightToIndex, *camera, *tileSampler,
+                                         &pFilmNew);
+                    }
+                }
+
+                // Connect to randomly chosen cached light vertices
+                for (int c = 0; c < cacheConnections && nConnectible > 0;
+                     ++c) {
+                    int v = cache.connectible[std::min<int>(
+                        tileSampler->Get1D() * nConnectible, nConnectible - 1)];
+                    int s = cache.depth[v] + 1;
+                    std::copy(cache.vertices.begin() + (v - s + 1),
+                              cache.vertices.begin() + (v + 1),
+                              lightVertices.begin());
+                    for (int t = 2; t <= nCamera && s + t - 2 <= maxDepth;
+                         ++t) {
+                        Point2f pFilmNew = pFilm;
+                        L += connectionScale *
+                             ConnectBDPT(scene, &lightVertices[0],
+                                         cameraVertices, s, t, *lightDistr,
+                                         lightToIndex, *camera, *tileSampler,
+                                         &pFilmNew);
+                    }
+                }
+                filmTile->AddPixelSample(pPixel, pFilm, filterWeight, L);
+                arena.Reset();
+                pixelCost.RecordPixel(pPixel);
+            }
+            tileCost.RecordTile(tileBounds, pass, pass + 1);
+            film->MergeFilmTile(std::move(filmTile));
+        });
+        scheduler.NextPass();
+
+        // Release this pass's light subpaths
+        for (MemoryArena &arena : lightArenas) arena.Reset();
+        film->ResolveSplats();
+        reporter.Update();
+        ++samplesTaken;
+        if (control) {
+            control->splatScale = 1.0f / samplesTaken;
+            ++control->passesDone;
+        }
+        if (checkpoint.Due(&lastCheckpoint))
+            SaveCheckpoint(pass + 1, samplesTaken);
+    }
+    reporter.Done();
+    if (Cancelled()) LOG(INFO) << "Rendering cancelled";
+    if (!checkpoint.filename.empty()) SaveCheckpoint(pass, samplesTaken);
+    film->WriteImage(1.0f / std::max<int64_t>(samplesTaken, 1));
+    WriteHeatmap();
+}
+
+int64_t BDPTIntegrator::ResumeFromCheckpoint(int64_t *samplesTaken) {
+    *samplesTaken = 0;
+    if (checkpoint.filename.empty() || !checkpoint.resume) return sampleStart;
+    Checkpoint state;
+    std::vector<int64_t> samples;
+    if (!state.Read(checkpoint.filename)) {
+        Warning("No checkpoint \"%s\" to resume from; starting over",
+                checkpoint.filename.c_str());
+        return sampleStart;
+    }
+    // The samples section holds the next sample and the number of samples
+    // that the film's pixels have accumulated
+    if (!state.Get("samples", &samples) || samples.size() != 2 ||
+        samples[0] < sampleStart || samples[0] > sampleEnd ||
+        !camera->film->LoadCheckpoint(state)) {
+        Error("Checkpoint \"%s\" doesn't match this render; starting over",
+              checkpoint.filename.c_str());
+        camera->film->Clear();
+        return sampleStart;
+    }
+    LOG(INFO) << "Resuming from sample " << samples[0];
+    *samplesTaken = samples[1];
+    return samples[0];
+}
+
+void BDPTIntegrator::SaveCheckpoint(int64_t nextSample, int64_t samplesTaken) {
+    std::unique_ptr<Checkpoint> state(new Checkpoint);
+    camera->film->SaveCheckpoint(state.get());
+    int64_t samples[2] = {nextSample, samplesTaken};
+    state->Add("samples", samples, 2);
+    WriteCheckpointAsync(checkpoint.filename, std::move(state));
+}
+
+Spectrum ConnectSubpaths(
+    const Scene &scene, const Vertex *lightVertices,
+    const Vertex *cameraVertices, int s, int t,
+    const Distribution1D &lightDistr,
     const std::unordered_map<const Light *, size_t> &lightToIndex,
     const Camera &camera, Sampler &sampler, Point2f *pRaster,
-    float *misWeightPtr) {
+    Vertex *sampled) {
     ProfilePhase _(Prof::BDPTConnectSubpaths);
     Spectrum L(0.f);
     // Ignore invalid connections related to infinite area lights
@@ -422,7 +696,6 @@ Spectrum ConnectBDPT(
         return Spectrum(0.f);
 
     // Perform connection and write contribution to _L_
-    Vertex sampled;
     if (s == 0) {
         // Interpret the camera subpath as a complete path
         const Vertex &pt = cameraVertices[t - 1];
@@ -439,8 +712,8 @@ Spectrum ConnectBDPT(
                                            &wi, &pdf, pRaster, &vis);
             if (pdf > 0 && !Wi.IsBlack()) {
                 // Initialize dynamically sampled vertex and _L_ for $t=1$ case
-                sampled = Vertex::CreateCamera(&camera, vis.P1(), Wi / pdf);
-                L = qs.beta * qs.f(sampled, TransportMode::Importance) * sampled.beta;
+                *sampled = Vertex::CreateCamera(&camera, vis.P1(), Wi / pdf);
+                L = qs.beta * qs.f(*sampled, TransportMode::Importance) * sampled->beta;
                 if (qs.IsOnSurface()) L *= AbsDot(wi, qs.ns());
                 DCHECK(!L.HasNaNs());
                 // Only check visibility after we know that the path would
@@ -463,11 +736,11 @@ Spectrum ConnectBDPT(
                 pt.GetInteraction(), sampler.Get2D(), &wi, &pdf, &vis);
             if (pdf > 0 && !lightWeight.IsBlack()) {
                 EndpointInteraction ei(vis.P1(), light.get());
-                sampled =
+                *sampled =
                     Vertex::CreateLight(ei, lightWeight / (pdf * lightPdf), 0);
-                sampled.pdfFwd =
-                    sampled.PdfLightOrigin(scene, pt, lightDistr, lightToIndex);
-                L = pt.beta * pt.f(sampled, TransportMode::Radiance) * sampled.beta;
+                sampled->pdfFwd =
+                    sampled->PdfLightOrigin(scene, pt, lightDistr, lightToIndex);
+                L = pt.beta * pt.f(*sampled, TransportMode::Radiance) * sampled->beta;
                 if (pt.IsOnSurface()) L *= AbsDot(wi, pt.ns());
                 // Only check visibility if the path would carry radiance.
                 if (!L.IsBlack()) L *= vis.Tr(scene, sampler);
@@ -486,6 +759,20 @@ Spectrum ConnectBDPT(
         }
     }
 
+    return L;
+}
+
+Spectrum ConnectBDPT(
+    const Scene &scene, Vertex *lightVertices, Vertex *cameraVertices, int s,
+    int t, const Distribution1D &lightDistr,
+    const std::unordered_map<const Light *, size_t> &lightToIndex,
+    const Camera &camera, Sampler &sampler, Point2f *pRaster,
+    float *misWeightPtr) {
+    ProfilePhase _(Prof::BDPTConnectSubpaths);
+    Vertex sampled;
+    Spectrum L =
+        ConnectSubpaths(scene, lightVertices, cameraVertices, s, t, lightDistr,
+                        lightToIndex, camera, sampler, pRaster, &sampled);
     ++totalPaths;
     if (L.IsBlack()) ++zeroRadiancePaths;
     ReportValue(pathLength, s + t - 2);
@@ -532,8 +819,28 @@ BDPTIntegrator *CreateBDPTIntegrator(const ParamSet &params,
 
     std::string lightStrategy = params.FindOneString("lightsamplestrategy",
                                                      "power");
+    int cacheConnections = params.FindOneInt("lightcacheconnections", 0);
+    if (cacheConnections > 0 && (visualizeStrategies || visualizeWeights)) {
+        Warning(
+            "visualizestrategies/visualizeweights aren't supported with "
+            "the light vertex cache; ignoring \"lightcacheconnections\"");
+        cacheConnections = 0;
+    }
+    int sampleStart = params.FindOneInt("samplestart", 0);
+    int sampleEnd =
+        params.FindOneInt("sampleend", sampler->samplesPerPixel);
+    if (sampleStart < 0 || sampleEnd > sampler->samplesPerPixel ||
+        sampleStart >= sampleEnd) {
+        Error("Sample range [%d, %d) isn't within the sampler's %d samples; "
+              "taking all of them", sampleStart, sampleEnd,
+              (int)sampler->samplesPerPixel);
+        sampleStart = 0;
+        sampleEnd = sampler->samplesPerPixel;
+    }
     return new BDPTIntegrator(sampler, camera, maxDepth, visualizeStrategies,
-                              visualizeWeights, pixelBounds, lightStrategy);
+                              visualizeWeights, pixelBounds, lightStrategy,
+                              cacheConnections, sampleStart, sampleEnd,
+                              GetCheckpointSettings(params));
 }
 
 }  // namespace pbrt
\ No newline at end of file
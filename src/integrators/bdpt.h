@@ -4,6 +4,7 @@
 // integrators/bdpt.h*
 #include <unordered_map>
 #include "camera.h"
+#include "checkpoint.h"
 #include "integrator.h"
 #include "interaction.h"
 #include "light.h"
@@ -95,17 +96,31 @@ class BDPTIntegrator : public Integrator {
                    std::shared_ptr<const Camera> camera, int maxDepth,
                    bool visualizeStrategies, bool visualizeWeights,
                    const Bounds2i &pixelBounds,
-                   const std::string &lightSampleStrategy = "power")
+                   const std::string &lightSampleStrategy = "power",
+                   int cacheConnections = 0, int sampleStart = 0,
+                   int sampleEnd = 0,
+                   const CheckpointSettings &checkpoint = CheckpointSettings())
         : sampler(sampler),
           camera(camera),
           maxDepth(maxDepth),
           visualizeStrategies(visualizeStrategies),
           visualizeWeights(visualizeWeights),
           pixelBounds(pixelBounds),
-          lightSampleStrategy(lightSampleStrategy) {}
+          lightSampleStrategy(lightSampleStrategy),
+          cacheConnections(cacheConnections),
+          sampleStart(sampleStart),
+          sampleEnd(sampleEnd > 0 ? sampleEnd : sampler->samplesPerPixel),
+          checkpoint(checkpoint) {}
     void Render(const Scene &scene);
 
   private:
+    // BDPTIntegrator Private Methods
+    void RenderWithLightVertexCache(const Scene &scene);
+    // Loads the film from the checkpoint when resuming; returns the index
+    // of the next sample to take in each pixel
+    int64_t ResumeFromCheckpoint(int64_t *samplesTaken);
+    void SaveCheckpoint(int64_t nextSample, int64_t samplesTaken);
+
     // BDPTIntegrator Private Data
     std::shared_ptr<Sampler> sampler;
     std::shared_ptr<const Camera> camera;
@@ -114,6 +129,14 @@ class BDPTIntegrator : public Integrator {
     const bool visualizeWeights;
     const Bounds2i pixelBounds;
     const std::string lightSampleStrategy;
+    // If positive, light subpaths are traced once per pass into a shared
+    // cache, and each camera subpath connects to this many vertices drawn
+    // at random from it instead of to a light subpath of its own.
+    const int cacheConnections;
+    // Range of sample indices to take in each pixel. Renders of disjoint
+    // ranges can run independently and their checkpoints be merged.
+    const int sampleStart, sampleEnd;
+    const CheckpointSettings checkpoint;
 };
 
 struct Vertex {
@@ -397,6 +420,16 @@ extern int GenerateLightSubpath(
     float time, const Distribution1D &lightDistr,
     const std::unordered_map<const Light *, size_t> &lightToIndex,
     Vertex *path);
+// Returns the unweighted contribution of the $(s,t)$ connection strategy;
+// _sampled_ receives the vertex sampled on the light or camera by the
+// $s=1$ and $t=1$ strategies.
+Spectrum ConnectSubpaths(
+    const Scene &scene, const Vertex *lightVertices,
+    const Vertex *cameraVertices, int s, int t,
+    const Distribution1D &lightDistr,
+    const std::unordered_map<const Light *, size_t> &lightToIndex,
+    const Camera &camera, Sampler &sampler, Point2f *pRaster,
+    Vertex *sampled);
 Spectrum ConnectBDPT(
     const Scene &scene, Vertex *lightVertices, Vertex *cameraVertices, int s,
     int t, const Distribution1D &lightDistr,
@@ -4,14 +4,121 @@
 #include "paramset.h"
 #include "camera.h"
 #include "film.h"
+#include "parallel.h"
+#include "progressreporter.h"
+#include "rng.h"
+#include "sampling.h"
 #include "stats.h"
 
 namespace pbrt {
 
+STAT_COUNTER("Integrator/Reservoir candidates", nReservoirCandidates);
+STAT_PERCENT("Integrator/Reservoir neighbors rejected", nNeighborsRejected,
+             nNeighbors);
+
+// Reservoir Declarations
+
+// A light sample chosen by weighted reservoir sampling. Samples are
+// identified by the light's index and the 2D sample value passed to
+// Light::Sample_Li(), so a sample chosen at one pixel can be evaluated at
+// another without a change of variables. _pHat_ is the target function at
+// the sample, _M_ the number of candidates seen and _W_ the sample's
+// unbiased contribution weight.
+struct Reservoir {
+    bool Update(int l, const Point2f &u, float w, float p, int m, float r) {
+        wSum += w;
+        M += m;
+        if (w > 0 && r * wSum < w) {
+            lightIndex = l;
+            uLight = u;
+            pHat = p;
+            return true;
+        }
+        return false;
+    }
+    void FinalizeWeight(int Z) {
+        W = (pHat > 0 && Z > 0) ? wSum / (Z * pHat) : 0;
+    }
+
+    int lightIndex = -1;
+    Point2f uLight;
+    float pHat = 0, wSum = 0, W = 0;
+    int M = 0;
+};
+
+// The reservoirs of all pixels, stored as a structure of arrays. Only the
+// finalized state is kept; _wSum_ is only needed while resampling.
+struct ReservoirBuffer {
+    explicit ReservoirBuffer(size_t n)
+        : lightIndex(n, -1), uLight(n), pHat(n, 0.f), W(n, 0.f), M(n, 0) {}
+    Reservoir Load(size_t i) const {
+        Reservoir r;
+        r.lightIndex = lightIndex[i];
+        r.uLight = uLight[i];
+        r.pHat = pHat[i];
+        r.W = W[i];
+        r.M = M[i];
+        return r;
+    }
+    void Store(size_t i, const Reservoir &r) {
+        lightIndex[i] = r.lightIndex;
+        uLight[i] = r.uLight;
+        pHat[i] = r.pHat;
+        W[i] = r.W;
+        M[i] = r.M;
+    }
+
+    std::vector<int> lightIndex;
+    std::vector<Point2f> uLight;
+    std::vector<float> pHat, W;
+    std::vector<int> M;
+};
+
+// The first visible surface of a pixel's camera ray; _bsdf_ is null if
+// the ray escaped or hit a purely specular surface.
+struct PrimaryHit {
+    Interaction it;
+    Normal3f ns;
+    const BSDF *bsdf = nullptr;
+    float depth = 0;
+};
+
+// Returns the unshadowed contribution of the light sample (_l_, _uLight_)
+// at _hit_, divided by the light's sampling density.
+static Spectrum LightSampleContribution(const PrimaryHit &hit,
+                                        const Scene &scene, int l,
+                                        const Point2f &uLight,
+                                        VisibilityTester *vis) {
+    Vector3f wi;
+    float pdf;
+    Spectrum Li = scene.lights[l]->Sample_Li(hit.it, uLight, &wi, &pdf, vis);
+    if (pdf == 0 || Li.IsBlack()) return Spectrum(0.f);
+    Spectrum f = hit.bsdf->f(hit.it.wo, wi,
+                             BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) *
+                 AbsDot(wi, hit.ns);
+    return f * Li / pdf;
+}
+
+// The resampling target function: the luminance of the unshadowed
+// contribution.
+static float TargetFunction(const PrimaryHit &hit, const Scene &scene, int l,
+                            const Point2f &uLight) {
+    if (!hit.bsdf || l < 0) return 0;
+    VisibilityTester vis;
+    return std::max(LightSampleContribution(hit, scene, l, uLight, &vis).y(),
+                    (float)0);
+}
+
 // DirectLightingIntegrator Method Definitions
 void DirectLightingIntegrator::Preprocess(const Scene &scene,
                                           Sampler &sampler) {
-    if (strategy == LightStrategy::UniformSampleAll) {
+    if (strategy == LightStrategy::Reservoir)
+        lightDistribution =
+            scene.GetLightSampleDistribution(lightSampleStrategy);
+
+    // The integrator may be asked to render the same scene repeatedly;
+    // sample arrays only need to be requested from _sampler_ once
+    if (strategy == LightStrategy::UniformSampleAll && nLightSamples.empty()) {
         // Compute number of samples to use for each light
         for (const auto &light : scene.lights)
             nLightSamples.push_back(sampler.RoundCount(light->nSamples));
@@ -28,7 +135,8 @@ void DirectLightingIntegrator::Preprocess(const Scene &scene,
 
 Spectrum DirectLightingIntegrator::Li(const RayDifferential &ray,
                                       const Scene &scene, Sampler &sampler,
-                                      MemoryArena &arena, int depth) const {
+                                      MemoryArena &arena, int depth,
+                                      AOVSample *aov) const {
     ProfilePhase p(Prof::SamplerIntegratorLi);
     Spectrum L(0.f);
     // Find closest ray intersection or return background radiance
@@ -41,7 +149,7 @@ Spectrum DirectLightingIntegrator::Li(const RayDifferential &ray,
     // Compute scattering functions for surface interaction
     isect.ComputeScatteringFunctions(ray, arena);
     if (!isect.bsdf)
-        return Li(isect.SpawnRay(ray.d), scene, sampler, arena, depth);
+        return Li(isect.SpawnRay(ray.d), scene, sampler, arena, depth, aov);
     Vector3f wo = isect.wo;
     // Compute emitted light if ray hit an area light source
     L += isect.Le(wo);
@@ -61,6 +169,250 @@ Spectrum DirectLightingIntegrator::Li(const RayDifferential &ray,
     return L;
 }
 
+void DirectLightingIntegrator::Render(const Scene &scene) {
+    if (strategy == LightStrategy::Reservoir)
+        RenderReservoirs(scene);
+    else
+        SamplerIntegrator::Render(scene);
+}
+
+// Follows _ray_ to the first surface with a BSDF and records it in _hit_.
+// Returns the radiance that does not come from direct lighting at that
+// surface: emission and (recursively) specular reflection and
+// transmission. The BSDF is allocated in _arena_, which must outlive the
+// rendering pass; everything else goes into _scratchArena_.
+Spectrum DirectLightingIntegrator::TracePrimary(
+    RayDifferential ray, const Scene &scene, Sampler &sampler,
+    MemoryArena &arena, MemoryArena &scratchArena, PrimaryHit *hit) const {
+    Point3f pCamera = ray.o;
+    SurfaceInteraction isect;
+    while (true) {
+        if (!scene.Intersect(ray, &isect)) {
+            Spectrum L(0.f);
+            for (const auto &light : scene.lights) L += light->Le(ray);
+            return L;
+        }
+        isect.ComputeScatteringFunctions(ray, arena);
+        if (isect.bsdf) break;
+        ray = isect.SpawnRay(ray.d);
+    }
+    if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0) {
+        hit->it = isect;
+        hit->ns = isect.shading.n;
+        hit->bsdf = isect.bsdf;
+        hit->depth = Distance(pCamera, isect.p);
+    }
+    Spectrum L = isect.Le(isect.wo);
+    if (maxDepth > 1) {
+        L += SpecularReflect(ray, isect, scene, sampler, scratchArena, 0);
+        L += SpecularTransmit(ray, isect, scene, sampler, scratchArena, 0);
+    }
+    return L;
+}
+
+// Renders one sample per pixel per pass. Each pass runs three stages over
+// all pixels: tracing camera rays and resampling _nCandidates_ light
+// samples at each first visible surface, together with the previous
+// pass's reservoir (temporal reuse); combining reservoirs with those of
+// nearby pixels with similar geometry (spatial reuse); and tracing one
+// shadow ray for the chosen sample. The number of candidates each
+// reservoir counts (Z) only includes pixels whose target function is
+// nonzero for the chosen sample, which keeps reuse unbiased without
+// visibility in the target function.
+void DirectLightingIntegrator::RenderReservoirs(const Scene &scene) {
+    Preprocess(scene, *sampler);
+    const int tileSize = 16;
+    Vector2i extent = pixelBounds.Diagonal();
+    Point2i nTiles((extent.x + tileSize - 1) / tileSize,
+                   (extent.y + tileSize - 1) / tileSize);
+    int nPixels = pixelBounds.Area();
+    auto pixelIndex = [&](const Point2i &p) {
+        return (p.y - pixelBounds.pMin.y) * extent.x + (p.x - pixelBounds.pMin.x);
+    };
+    auto tileBounds = [&](const Point2i &tile) {
+        Point2i p0 = pixelBounds.pMin + Vector2i(tile.x, tile.y) * tileSize;
+        Point2i p1(std::min(p0.x + tileSize, pixelBounds.pMax.x),
+                   std::min(p0.y + tileSize, pixelBounds.pMax.y));
+        return Bounds2i(p0, p1);
+    };
+
+    // Allocate the per-pixel state. The primary hits (and the arenas
+    // holding their BSDFs) of the previous pass are kept for temporal
+    // reuse.
+    std::vector<PrimaryHit> hits[2] = {std::vector<PrimaryHit>(nPixels),
+                                       std::vector<PrimaryHit>(nPixels)};
+    std::unique_ptr<MemoryArena[]> perThreadArenas[2] = {
+        std::unique_ptr<MemoryArena[]>(new MemoryArena[MaxThreadIndex()]),
+        std::unique_ptr<MemoryArena[]>(new MemoryArena[MaxThreadIndex()])};
+    std::vector<Spectrum> Lother(nPixels);
+    std::vector<Point2f> pFilm(nPixels);
+    std::vector<float> rayWeight(nPixels), filterWeight(nPixels);
+    ReservoirBuffer temporal(nPixels), spatial(nPixels);
+    // Scratch list of the pixels whose reservoirs spatial reuse combined
+    std::vector<std::vector<int>> neighborSources(MaxThreadIndex());
+    for (std::vector<int> &sources : neighborSources)
+        sources.reserve(nSpatialNeighbors + 1);
+
+    int64_t spp = sampler->samplesPerPixel;
+    ProgressReporter reporter(spp * nTiles.x * nTiles.y, "Rendering");
+    for (int64_t pass = 0; pass < spp && !Cancelled(); ++pass) {
+        int cur = pass & 1, prev = cur ^ 1;
+        for (int i = 0; i < MaxThreadIndex(); ++i)
+            perThreadArenas[cur][i].Reset();
+
+        // Trace camera rays and resample candidates and the previous pass
+        ParallelFor2D([&](Point2i tile) {
+            MemoryArena &arena = perThreadArenas[cur][ThreadIndex];
+            MemoryArena scratchArena;
+            int seed = (pass * nTiles.y + tile.y) * nTiles.x + tile.x;
+            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
+            for (Point2i pixel : tileBounds(tile)) {
+                tileSampler->StartPixel(pixel);
+                tileSampler->SetSampleNumber(pass);
+                int index = pixelIndex(pixel);
+                RNG rng(2 * (uint64_t(pass) * nPixels + index));
+                PrimaryHit &hit = hits[cur][index];
+                hit = PrimaryHit();
+
+                CameraSample cameraSample = tileSampler->GetCameraSample(
+                    pixel, camera->film->GetFilterSampler());
+                RayDifferential ray;
+                rayWeight[index] =
+                    camera->GenerateRayDifferential(cameraSample, &ray);
+                ray.ScaleDifferentials(1 / std::sqrt((float)spp));
+                pFilm[index] = cameraSample.pFilm;
+                filterWeight[index] = cameraSample.filterWeight;
+                Lother[index] = Spectrum(0.f);
+                if (rayWeight[index] > 0)
+                    Lother[index] = TracePrimary(ray, scene, *tileSampler,
+                                                 arena, scratchArena, &hit);
+                scratchArena.Reset();
+
+                Reservoir r;
+                if (hit.bsdf) {
+                    for (int c = 0; c < nCandidates; ++c) {
+                        float lightPdf;
+                        int l = lightDistribution->Sample(
+                            hit.it.p, hit.it.n, tileSampler->Get1D(),
+                            &lightPdf);
+                        Point2f uLight = tileSampler->Get2D();
+                        float pHat =
+                            lightPdf > 0
+                                ? TargetFunction(hit, scene, l, uLight)
+                                : 0;
+                        r.Update(l, uLight, lightPdf > 0 ? pHat / lightPdf : 0,
+                                 pHat, 1, rng.UniformFloat());
+                    }
+                    nReservoirCandidates += nCandidates;
+
+                    // Reuse the previous pass's reservoir, limiting its
+                    // history so that it cannot dominate indefinitely
+                    int Z = r.M;
+                    Reservoir p = spatial.Load(index);
+                    const PrimaryHit &prevHit = hits[prev][index];
+                    if (pass > 0 && prevHit.bsdf && p.lightIndex >= 0) {
+                        int Mp = std::min(p.M, 20 * nCandidates);
+                        float pHat =
+                            TargetFunction(hit, scene, p.lightIndex, p.uLight);
+                        r.Update(p.lightIndex, p.uLight, pHat * p.W * Mp, pHat,
+                                 Mp, rng.UniformFloat());
+                        if (TargetFunction(prevHit, scene, r.lightIndex,
+                                           r.uLight) > 0)
+                            Z += Mp;
+                    }
+                    r.FinalizeWeight(Z);
+                }
+                temporal.Store(index, r);
+            }
+        }, nTiles);
+
+        // Combine reservoirs with those of nearby pixels
+        ParallelFor2D([&](Point2i tile) {
+            std::vector<int> &sources = neighborSources[ThreadIndex];
+            for (Point2i pixel : tileBounds(tile)) {
+                int index = pixelIndex(pixel);
+                const PrimaryHit &hit = hits[cur][index];
+                if (!hit.bsdf) {
+                    spatial.Store(index, Reservoir());
+                    continue;
+                }
+                RNG rng(2 * (uint64_t(pass) * nPixels + index) + 1);
+                Reservoir q = temporal.Load(index), r;
+                r.Update(q.lightIndex, q.uLight, q.pHat * q.W * q.M, q.pHat,
+                         q.M, rng.UniformFloat());
+                sources.assign(1, index);
+                for (int k = 0; k < nSpatialNeighbors; ++k) {
+                    Point2f d = spatialRadius *
+                                ConcentricSampleDisk(Point2f(
+                                    rng.UniformFloat(), rng.UniformFloat()));
+                    Point2i pn(pixel.x + int(std::round(d.x)),
+                               pixel.y + int(std::round(d.y)));
+                    if (pn == pixel || !InsideExclusive(pn, pixelBounds))
+                        continue;
+                    ++nNeighbors;
+                    int ni = pixelIndex(pn);
+                    const PrimaryHit &nh = hits[cur][ni];
+                    if (!nh.bsdf || Dot(nh.ns, hit.ns) < .9f ||
+                        std::abs(nh.depth - hit.depth) > .1f * hit.depth) {
+                        ++nNeighborsRejected;
+                        continue;
+                    }
+                    Reservoir n = temporal.Load(ni);
+                    float pHat =
+                        TargetFunction(hit, scene, n.lightIndex, n.uLight);
+                    r.Update(n.lightIndex, n.uLight, pHat * n.W * n.M, pHat,
+                             n.M, rng.UniformFloat());
+                    sources.push_back(ni);
+                }
+
+                int Z = q.M;
+                for (size_t k = 1; k < sources.size(); ++k)
+                    if (TargetFunction(hits[cur][sources[k]], scene,
+                                       r.lightIndex, r.uLight) > 0)
+                        Z += temporal.M[sources[k]];
+                r.FinalizeWeight(Z);
+                spatial.Store(index, r);
+            }
+        }, nTiles);
+
+        // Shade each pixel with its reservoir's sample
+        ParallelFor2D([&](Point2i tile) {
+            Bounds2i bounds = tileBounds(tile);
+            std::unique_ptr<FilmTile> filmTile =
+                camera->film->GetFilmTile(bounds);
+            for (Point2i pixel : bounds) {
+                int index = pixelIndex(pixel);
+                Spectrum L = Lother[index];
+                const PrimaryHit &hit = hits[cur][index];
+                Reservoir r = spatial.Load(index);
+                if (hit.bsdf && r.lightIndex >= 0 && r.W > 0) {
+                    VisibilityTester vis;
+                    Spectrum F = LightSampleContribution(
+                        hit, scene, r.lightIndex, r.uLight, &vis);
+                    if (!F.IsBlack() && vis.Unoccluded(scene)) L += F * r.W;
+                }
+                if (L.HasNaNs() || std::isinf(L.y())) {
+                    LOG(ERROR) << StringPrintf(
+                        "Invalid radiance value returned for pixel (%d, %d). "
+                        "Setting to black.", pixel.x, pixel.y);
+                    L = Spectrum(0.f);
+                }
+                filmTile->AddPixelSample(pixel, pFilm[index],
+                                         filterWeight[index], L,
+                                         rayWeight[index]);
+            }
+            camera->film->MergeFilmTile(std::move(filmTile));
+            reporter.Update();
+        }, nTiles);
+        if (control) ++control->passesDone;
+    }
+    reporter.Done();
+    if (Cancelled()) LOG(INFO) << "Rendering cancelled";
+    LOG(INFO) << "Rendering finished";
+
+    camera->film->WriteImage();
+}
+
 DirectLightingIntegrator *CreateDirectLightingIntegrator(
     const ParamSet &params, std::shared_ptr<Sampler> sampler,
     std::shared_ptr<const Camera> camera) {
@@ -69,6 +421,8 @@ DirectLightingIntegrator *CreateDirectLightingIntegrator(
     std::string st = params.FindOneString("strategy", "all");
     if (st == "one")
         strategy = LightStrategy::UniformSampleOne;
+    else if (st == "restir")
+        strategy = LightStrategy::Reservoir;
     else if (st == "all")
         strategy = LightStrategy::UniformSampleAll;
     else {
@@ -92,8 +446,15 @@ DirectLightingIntegrator *CreateDirectLightingIntegrator(
                 Error("Degenerate \"pixelbounds\" specified.");
         }
     }
+    int nCandidates = params.FindOneInt("restircandidates", 32);
+    int nSpatialNeighbors = params.FindOneInt("restirneighbors", 4);
+    float spatialRadius = params.FindOneFloat("restirradius", 20);
+    std::string lightStrategy =
+        params.FindOneString("lightsamplestrategy", "power");
     return new DirectLightingIntegrator(strategy, maxDepth, camera, sampler,
-                                        pixelBounds);
+                                        pixelBounds, nCandidates,
+                                        nSpatialNeighbors, spatialRadius,
+                                        lightStrategy);
 }
 
 }  // namespace pbrt
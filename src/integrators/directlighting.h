@@ -5,11 +5,16 @@
 #include "pbrt.h"
 #include "integrator.h"
 #include "scene.h"
+#include "lightdistrib.h"
 
 namespace pbrt {
 
 // LightStrategy Declarations
-enum class LightStrategy { UniformSampleAll, UniformSampleOne };
+// _Reservoir_ resamples light samples at the first visible surface,
+// reusing them across neighboring pixels and rendering passes (ReSTIR).
+enum class LightStrategy { UniformSampleAll, UniformSampleOne, Reservoir };
+
+struct PrimaryHit;
 
 // DirectLightingIntegrator Declarations
 class DirectLightingIntegrator : public SamplerIntegrator {
@@ -18,19 +23,38 @@ class DirectLightingIntegrator : public SamplerIntegrator {
     DirectLightingIntegrator(LightStrategy strategy, int maxDepth,
                              std::shared_ptr<const Camera> camera,
                              std::shared_ptr<Sampler> sampler,
-                             const Bounds2i &pixelBounds)
+                             const Bounds2i &pixelBounds,
+                             int nCandidates = 32, int nSpatialNeighbors = 4,
+                             float spatialRadius = 20,
+                             const std::string &lightSampleStrategy = "power")
         : SamplerIntegrator(camera, sampler, pixelBounds),
           strategy(strategy),
-          maxDepth(maxDepth) {}
+          maxDepth(maxDepth),
+          nCandidates(nCandidates),
+          nSpatialNeighbors(nSpatialNeighbors),
+          spatialRadius(spatialRadius),
+          lightSampleStrategy(lightSampleStrategy) {}
+    void Render(const Scene &scene);
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
-                Sampler &sampler, MemoryArena &arena, int depth) const;
+                Sampler &sampler, MemoryArena &arena, int depth,
+                AOVSample *aov) const;
     void Preprocess(const Scene &scene, Sampler &sampler);
 
   private:
+    // DirectLightingIntegrator Private Methods
+    void RenderReservoirs(const Scene &scene);
+    Spectrum TracePrimary(RayDifferential ray, const Scene &scene,
+                          Sampler &sampler, MemoryArena &arena,
+                          MemoryArena &scratchArena, PrimaryHit *hit) const;
+
     // DirectLightingIntegrator Private Data
     const LightStrategy strategy;
     const int maxDepth;
     std::vector<int> nLightSamples;
+    const int nCandidates, nSpatialNeighbors;
+    const float spatialRadius;
+    const std::string lightSampleStrategy;
+    std::shared_ptr<LightDistribution> lightDistribution;
 };
 
 DirectLightingIntegrator *CreateDirectLightingIntegrator(
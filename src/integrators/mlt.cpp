@@ -0,0 +1,281 @@
+// integrators/mlt.cpp*
+#include "integrators/mlt.h"
+#include "integrators/bdpt.h"
+#include "camera.h"
+#include "film.h"
+#include "paramset.h"
+#include "progressreporter.h"
+#include "sampler.h"
+#include "sampling.h"
+#include "scene.h"
+#include "stats.h"
+
+namespace pbrt {
+
+STAT_PERCENT("Integrator/Acceptance rate", acceptedMutations, totalMutations);
+
+// MLTSampler Constants
+static const int cameraStreamIndex = 0;
+static const int lightStreamIndex = 1;
+static const int connectionStreamIndex = 2;
+static const int nSampleStreams = 3;
+
+// MLTSampler Method Definitions
+float MLTSampler::Get1D() {
+    ProfilePhase _(Prof::GetSample);
+    int index = GetNextIndex();
+    EnsureReady(index);
+    return X[index].value;
+}
+
+Point2f MLTSampler::Get2D() { return {Get1D(), Get1D()}; }
+
+std::unique_ptr<Sampler> MLTSampler::Clone(int seed) {
+    LOG(FATAL) << "MLTSampler::Clone() is not implemented";
+    return nullptr;
+}
+
+void MLTSampler::StartIteration() {
+    currentIteration++;
+    largeStep = rng.UniformFloat() < largeStepProbability;
+}
+
+void MLTSampler::Accept() {
+    if (largeStep) lastLargeStepIteration = currentIteration;
+}
+
+void MLTSampler::EnsureReady(int index) {
+    // Enlarge _MLTSampler::X_ if necessary and get current $\VEC{X}_i$
+    if (index >= (int)X.size()) X.resize(index + 1);
+    PrimarySample &Xi = X[index];
+
+    // Reset $\VEC{X}_i$ if a large step took place in the meantime
+    if (Xi.lastModificationIteration < lastLargeStepIteration) {
+        Xi.value = rng.UniformFloat();
+        Xi.lastModificationIteration = lastLargeStepIteration;
+    }
+
+    // Apply remaining sequence of mutations to _sample_
+    Xi.Backup();
+    if (largeStep) {
+        Xi.value = rng.UniformFloat();
+    } else {
+        int64_t nSmall = currentIteration - Xi.lastModificationIteration;
+        // Apply _nSmall_ small step mutations
+
+        // Sample the standard normal distribution $N(0, 1)$
+        float normalSample = Sqrt2 * ErfInv(2 * rng.UniformFloat() - 1);
+
+        // Compute the effective standard deviation and apply perturbation to
+        // $\VEC{X}_i$
+        float effSigma = sigma * std::sqrt((float)nSmall);
+        Xi.value += normalSample * effSigma;
+        Xi.value -= std::floor(Xi.value);
+    }
+    Xi.lastModificationIteration = currentIteration;
+}
+
+void MLTSampler::Reject() {
+    for (auto &Xi : X)
+        if (Xi.lastModificationIteration == currentIteration) Xi.Restore();
+    --currentIteration;
+}
+
+void MLTSampler::StartStream(int index) {
+    CHECK_LT(index, streamCount);
+    streamIndex = index;
+    sampleIndex = 0;
+}
+
+// MLT Method Definitions
+Spectrum MLTIntegrator::L(const Scene &scene, MemoryArena &arena,
+                          const std::unique_ptr<Distribution1D> &lightDistr,
+                          const std::unordered_map<const Light *, size_t>
+                              &lightToIndex,
+                          MLTSampler &sampler, int depth, Point2f *pRaster) {
+    sampler.StartStream(cameraStreamIndex);
+    // Determine the number of available strategies and pick a specific one
+    int s, t, nStrategies;
+    if (depth == 0) {
+        nStrategies = 1;
+        s = 0;
+        t = 2;
+    } else {
+        nStrategies = depth + 2;
+        s = std::min((int)(sampler.Get1D() * nStrategies), nStrategies - 1);
+        t = nStrategies - s;
+    }
+
+    // Generate a camera subpath with exactly _t_ vertices
+    Vertex *cameraVertices = arena.Alloc<Vertex>(t);
+    Bounds2f sampleBounds = (Bounds2f)camera->film->GetSampleBounds();
+    *pRaster = sampleBounds.Lerp(sampler.Get2D());
+    if (GenerateCameraSubpath(scene, sampler, arena, t, *camera, *pRaster,
+                              cameraVertices) != t)
+        return Spectrum(0.f);
+
+    // Generate a light subpath with exactly _s_ vertices
+    sampler.StartStream(lightStreamIndex);
+    Vertex *lightVertices = arena.Alloc<Vertex>(s);
+    if (GenerateLightSubpath(scene, sampler, arena, s, cameraVertices[0].time(),
+                             *lightDistr, lightToIndex, lightVertices) != s)
+        return Spectrum(0.f);
+
+    // Execute connection strategy and return the radiance estimate
+    sampler.StartStream(connectionStreamIndex);
+    return ConnectBDPT(scene, lightVertices, cameraVertices, s, t, *lightDistr,
+                       lightToIndex, *camera, sampler, pRaster) *
+           nStrategies;
+}
+
+void MLTIntegrator::Render(const Scene &scene) {
+    ProfilePhase p(Prof::IntegratorRender);
+    std::unique_ptr<Distribution1D> lightDistr =
+        ComputeLightPowerDistribution(scene);
+    std::unordered_map<const Light *, size_t> lightToIndex;
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+        lightToIndex[scene.lights[i].get()] = i;
+
+    // Generate bootstrap samples and compute normalization constant $b$
+    int nBootstrapSamples = nBootstrap * (maxDepth + 1);
+    std::vector<float> bootstrapWeights(nBootstrapSamples, 0);
+    if (scene.lights.size() > 0) {
+        ProgressReporter progress(nBootstrap / 256,
+                                  "Generating bootstrap paths");
+        std::vector<MemoryArena> bootstrapThreadArenas(MaxThreadIndex());
+        int chunkSize = Clamp(nBootstrap / 128, 1, 8192);
+        ParallelFor([&](int i) {
+            // Generate _i_th bootstrap sample
+            MemoryArena &arena = bootstrapThreadArenas[ThreadIndex];
+            for (int depth = 0; depth <= maxDepth; ++depth) {
+                int rngIndex = i * (maxDepth + 1) + depth;
+                MLTSampler sampler(mutationsPerPixel, rngIndex, sigma,
+                                   largeStepProbability, nSampleStreams);
+                Point2f pRaster;
+                bootstrapWeights[rngIndex] =
+                    L(scene, arena, lightDistr, lightToIndex, sampler, depth,
+                      &pRaster).y();
+                arena.Reset();
+            }
+            if ((i + 1) % 256 == 0) progress.Update();
+        }, nBootstrap, chunkSize);
+        progress.Done();
+    }
+    Distribution1D bootstrap(&bootstrapWeights[0], nBootstrapSamples);
+    float b = bootstrap.funcInt * (maxDepth + 1);
+
+    // Run _nChains_ Markov chains in parallel. Progressive renders advance
+    // the chains in rounds and resolve the splats after each one, so that
+    // the film shows the image rendered so far.
+    Film &film = *camera->film;
+    int64_t nTotalMutations =
+        (int64_t)mutationsPerPixel * (int64_t)film.GetSampleBounds().Area();
+    if (scene.lights.size() > 0 && b > 0) {
+        const int progressFrequency = 32768;
+        ProgressReporter progress(nTotalMutations / progressFrequency,
+                                  "Rendering");
+        struct Chain {
+            std::unique_ptr<MLTSampler> sampler;
+            RNG rng;
+            int depth;
+            Point2f pCurrent;
+            Spectrum LCurrent;
+            int64_t mutationsDone = 0;
+        };
+        std::vector<Chain> chains(nChains);
+        int nRounds =
+            control && control->progressive ? std::min(mutationsPerPixel, 16)
+                                            : 1;
+        for (int round = 0; round < nRounds && !Cancelled(); ++round) {
+            ParallelFor([&](int i) {
+                int64_t chainStart = i * nTotalMutations / nChains;
+                int64_t nChainMutations =
+                    std::min((i + 1) * nTotalMutations / nChains,
+                             nTotalMutations) -
+                    chainStart;
+                Chain &chain = chains[i];
+                MemoryArena arena;
+                if (!chain.sampler) {
+                    // Select initial state from the set of bootstrap samples
+                    chain.rng.SetSequence(i);
+                    int bootstrapIndex =
+                        bootstrap.SampleDiscrete(chain.rng.UniformFloat());
+                    chain.depth = bootstrapIndex % (maxDepth + 1);
+
+                    // Initialize local variables for selected state
+                    chain.sampler.reset(
+                        new MLTSampler(mutationsPerPixel, bootstrapIndex, sigma,
+                                       largeStepProbability, nSampleStreams));
+                    chain.LCurrent = L(scene, arena, lightDistr, lightToIndex,
+                                       *chain.sampler, chain.depth,
+                                       &chain.pCurrent);
+                }
+                MLTSampler &sampler = *chain.sampler;
+
+                // Run the {i}th Markov chain for this round's mutations
+                int64_t roundEnd = nChainMutations * (round + 1) / nRounds;
+                int64_t j;
+                for (j = chain.mutationsDone; j < roundEnd; ++j) {
+                    if ((j & 1023) == 0 && Cancelled()) break;
+                    sampler.StartIteration();
+                    Point2f pProposed;
+                    Spectrum LProposed =
+                        L(scene, arena, lightDistr, lightToIndex, sampler,
+                          chain.depth, &pProposed);
+                    // Compute acceptance probability for proposed sample
+                    float accept = std::min((float)1,
+                                            LProposed.y() / chain.LCurrent.y());
+
+                    // Splat both current and proposed samples to _film_
+                    if (accept > 0)
+                        film.AddSplat(pProposed,
+                                      LProposed * accept / LProposed.y());
+                    film.AddSplat(chain.pCurrent, chain.LCurrent *
+                                                      (1 - accept) /
+                                                      chain.LCurrent.y());
+
+                    // Accept or reject the proposal
+                    if (chain.rng.UniformFloat() < accept) {
+                        chain.pCurrent = pProposed;
+                        chain.LCurrent = LProposed;
+                        sampler.Accept();
+                        ++acceptedMutations;
+                    } else
+                        sampler.Reject();
+                    ++totalMutations;
+                    if ((chainStart + j) % progressFrequency == 0)
+                        progress.Update();
+                    arena.Reset();
+                }
+                chain.mutationsDone = j;
+            }, nChains);
+            film.ResolveSplats();
+            if (control) {
+                // Only this fraction of the mutations has been splatted
+                control->splatScale =
+                    b / mutationsPerPixel * nRounds / (round + 1);
+                ++control->passesDone;
+            }
+        }
+        progress.Done();
+    }
+    if (Cancelled()) LOG(INFO) << "Rendering cancelled";
+
+    // Store final image computed with MLT
+    camera->film->WriteImage(b / mutationsPerPixel);
+}
+
+MLTIntegrator *CreateMLTIntegrator(const ParamSet &params,
+                                   std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int nBootstrap = params.FindOneInt("bootstrapsamples", 100000);
+    int nChains = params.FindOneInt("chains", 1000);
+    int mutationsPerPixel = params.FindOneInt("mutationsperpixel", 100);
+    float largeStepProbability =
+        params.FindOneFloat("largestepprobability", 0.3f);
+    float sigma = params.FindOneFloat("sigma", .01f);
+    return new MLTIntegrator(camera, maxDepth, nBootstrap, nChains,
+                             mutationsPerPixel, sigma, largeStepProbability);
+}
+
+}  // namespace pbrt
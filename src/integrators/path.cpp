@@ -12,26 +12,95 @@ namespace pbrt {
 
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
 STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_PERCENT("Integrator/Guided path vertices", guidedVertices,
+             totalVertices);
+
+// A vertex at which the path direction was chosen with the guiding
+// distribution available, along with what is needed to recover the
+// radiance that arrived there once the path is complete.
+struct GuidingVertex {
+    DTreeWrapper *dTree;
+    Vector3f wi;
+    float pdf;
+    Spectrum beta, L;
+};
 
 // PathIntegrator Method Definitions
 PathIntegrator::PathIntegrator(int maxDepth,
                                std::shared_ptr<const Camera> camera,
                                std::shared_ptr<Sampler> sampler,
                                const Bounds2i &pixelBounds, float rrThreshold,
-                               const std::string &lightSampleStrategy)
+                               const std::string &lightSampleStrategy,
+                               bool guiding, int guidingSpatialThreshold,
+                               float guidingBSDFFraction, float guidingMaxMB)
     : SamplerIntegrator(camera, sampler, pixelBounds),
       maxDepth(maxDepth),
       rrThreshold(rrThreshold),
-      lightSampleStrategy(lightSampleStrategy) {}
+      lightSampleStrategy(lightSampleStrategy),
+      guiding(guiding),
+      guidingSpatialThreshold(guidingSpatialThreshold),
+      guidingBSDFFraction(guidingBSDFFraction),
+      guidingMaxMB(guidingMaxMB) {}
 
 void PathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
-    lightDistribution =
-        CreateLightSampleDistribution(lightSampleStrategy, scene);
+    lightDistribution = scene.GetLightSampleDistribution(lightSampleStrategy);
+    // Guiding is learned from scratch for every render
+    if (guiding)
+        sdTree.reset(new SDTree(scene.WorldBound(), guidingSpatialThreshold,
+                                size_t(guidingMaxMB * 1024 * 1024)));
+    else
+        sdTree.reset();
+}
+
+// The guiding distribution is trained across rendering passes, so guided
+// renders are always progressive.
+bool PathIntegrator::Progressive() const {
+    return guiding || SamplerIntegrator::Progressive();
+}
+
+void PathIntegrator::PassFinished(const Scene &scene, int pass) {
+    if (sdTree) sdTree->Refine(pass);
+}
+
+// Chooses _wi_ with one-sample MIS between the BSDF and the guiding
+// distribution: _pdf_ is the mixture density, so the usual f / pdf
+// estimator stays unbiased. Until the quadtree has learned something, only
+// the BSDF is sampled.
+Spectrum PathIntegrator::SampleGuided(const SurfaceInteraction &isect,
+                                      const DTreeWrapper &dTree,
+                                      const Vector3f &wo, Vector3f *wi,
+                                      float *pdf, BxDFType *flags,
+                                      Sampler &sampler) const {
+    const BSDF &bsdf = *isect.bsdf;
+    float u = sampler.Get1D();
+    Point2f u2 = sampler.Get2D();
+    if (dTree.sampling.Flux() <= 0)
+        return bsdf.Sample_f(wo, wi, u2, pdf, BSDF_ALL, flags);
+
+    ++guidedVertices;
+    Spectrum f;
+    float bsdfPdf, guidePdf;
+    if (u < guidingBSDFFraction) {
+        f = bsdf.Sample_f(wo, wi, u2, &bsdfPdf, BSDF_ALL, flags);
+        if (f.IsBlack() || bsdfPdf == 0) {
+            *pdf = 0;
+            return f;
+        }
+        guidePdf = dTree.sampling.Pdf(*wi);
+    } else {
+        *wi = dTree.sampling.Sample(u2, &guidePdf);
+        f = bsdf.f(wo, *wi);
+        bsdfPdf = bsdf.Pdf(wo, *wi);
+        *flags = Dot(*wi, isect.n) * Dot(wo, isect.n) > 0 ? BSDF_REFLECTION
+                                                            : BSDF_TRANSMISSION;
+    }
+    *pdf = guidingBSDFFraction * bsdfPdf + (1 - guidingBSDFFraction) * guidePdf;
+    return f;
 }
 
 Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
-                            Sampler &sampler, MemoryArena &arena,
-                            int depth) const {
+                            Sampler &sampler, MemoryArena &arena, int depth,
+                            AOVSample *aov) const {
     ProfilePhase p(Prof::SamplerIntegratorLi);
     Spectrum L(0.f), beta(1.f);
     RayDifferential ray(r);
@@ -45,6 +114,10 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
     // avoid terminating refracted rays that are about to be refracted back
     // out of a medium and thus have their beta value increased.
     float etaScale = 1;
+    // Guided vertices of this path, recorded into the SD-tree at the end
+    GuidingVertex *guidingVertices =
+        sdTree ? arena.Alloc<GuidingVertex>(maxDepth) : nullptr;
+    int nGuidingVertices = 0;
 
     for (bounces = 0;; ++bounces) {
         // Find next path vertex and accumulate contribution
@@ -79,31 +152,43 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
             continue;
         }
 
-        const Distribution1D *distrib = lightDistribution->Lookup(isect.p);
-
         // Sample illumination from lights to find path contribution.
         // (But skip this for perfectly specular BSDFs.)
         if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) >
             0) {
+            if (aov && !aov->hit) RecordAOVs(isect, beta, r.o, aov);
             ++totalPaths;
-            Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena,
-                                                       sampler, false, distrib);
+            Spectrum Ld =
+                beta * UniformSampleOneLight(isect, scene, arena, sampler,
+                                             false, *lightDistribution);
             VLOG(2) << "Sampled direct lighting Ld = " << Ld;
             if (Ld.IsBlack()) ++zeroRadiancePaths;
             CHECK_GE(Ld.y(), 0.f);
             L += Ld;
         }
 
-        // Sample BSDF to get new path direction
+        // Sample BSDF to get new path direction, mixing in the guiding
+        // distribution at vertices without specular components
         Vector3f wo = -ray.d, wi;
         float pdf;
         BxDFType flags;
-        Spectrum f = isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(), &pdf,
-                                          BSDF_ALL, &flags);
+        DTreeWrapper *dTree = nullptr;
+        if (sdTree) {
+            ++totalVertices;
+            if (isect.bsdf->NumComponents(BxDFType(
+                    BSDF_REFLECTION | BSDF_TRANSMISSION | BSDF_SPECULAR)) == 0)
+                dTree = sdTree->Lookup(isect.p);
+        }
+        Spectrum f = dTree ? SampleGuided(isect, *dTree, wo, &wi, &pdf,
+                                          &flags, sampler)
+                           : isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(),
+                                                  &pdf, BSDF_ALL, &flags);
         VLOG(2) << "Sampled BSDF, f = " << f << ", pdf = " << pdf;
         if (f.IsBlack() || pdf == 0.f) break;
         beta *= f * AbsDot(wi, isect.shading.n) / pdf;
         VLOG(2) << "Updated beta = " << beta;
+        if (dTree && nGuidingVertices < maxDepth)
+            guidingVertices[nGuidingVertices++] = {dTree, wi, pdf, beta, L};
         CHECK_GE(beta.y(), 0.f);
         DCHECK(!std::isinf(beta.y()));
         specularBounce = (flags & BSDF_SPECULAR) != 0;
@@ -128,7 +213,7 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
 
             // Account for the direct subsurface scattering component
             L += beta * UniformSampleOneLight(pi, scene, arena, sampler, false,
-                                              lightDistribution->Lookup(pi.p));
+                                              *lightDistribution);
 
             // Account for the indirect subsurface scattering component
             Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(), &pdf,
@@ -150,6 +235,16 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
             DCHECK(!std::isinf(beta.y()));
         }
     }
+
+    // Record the radiance that arrived at each guided vertex: what the path
+    // gathered after it, divided by the throughput up to it
+    for (int i = 0; i < nGuidingVertices; ++i) {
+        const GuidingVertex &v = guidingVertices[i];
+        Spectrum Li = L - v.L;
+        for (int c = 0; c < Spectrum::nSamples; ++c)
+            Li[c] = v.beta[c] > 0 ? Li[c] / v.beta[c] : 0;
+        v.dTree->building.Record(v.wi, Li.y() / v.pdf);
+    }
     ReportValue(pathLength, bounces);
     return L;
 }
@@ -175,8 +270,16 @@ PathIntegrator *CreatePathIntegrator(const ParamSet &params,
     float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
     std::string lightStrategy =
         params.FindOneString("lightsamplestrategy", "spatial");
+    bool guiding = params.FindOneBool("guiding", false);
+    int guidingSpatialThreshold =
+        params.FindOneInt("guidingspatialthreshold", 12000);
+    float guidingBSDFFraction =
+        Clamp(params.FindOneFloat("guidingbsdffraction", 0.5f), 0.05f, 1);
+    float guidingMaxMB = params.FindOneFloat("guidingmaxmb", 64);
     return new PathIntegrator(maxDepth, camera, sampler, pixelBounds,
-                              rrThreshold, lightStrategy);
+                              rrThreshold, lightStrategy, guiding,
+                              guidingSpatialThreshold, guidingBSDFFraction,
+                              guidingMaxMB);
 }
 
 }  // namespace pbrt
@@ -5,6 +5,7 @@
 #include "pbrt.h"
 #include "integrator.h"
 #include "lightdistrib.h"
+#include "sdtree.h"
 
 namespace pbrt {
 
@@ -15,18 +16,35 @@ class PathIntegrator : public SamplerIntegrator {
     PathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
                    std::shared_ptr<Sampler> sampler,
                    const Bounds2i &pixelBounds, float rrThreshold = 1,
-                   const std::string &lightSampleStrategy = "spatial");
+                   const std::string &lightSampleStrategy = "spatial",
+                   bool guiding = false, int guidingSpatialThreshold = 12000,
+                   float guidingBSDFFraction = 0.5f,
+                   float guidingMaxMB = 64);
 
     void Preprocess(const Scene &scene, Sampler &sampler);
+    void PassFinished(const Scene &scene, int pass);
+    bool Progressive() const;
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
-                Sampler &sampler, MemoryArena &arena, int depth) const;
+                Sampler &sampler, MemoryArena &arena, int depth,
+                AOVSample *aov) const;
 
   private:
+    // PathIntegrator Private Methods
+    Spectrum SampleGuided(const SurfaceInteraction &isect,
+                          const DTreeWrapper &dTree, const Vector3f &wo,
+                          Vector3f *wi, float *pdf, BxDFType *flags,
+                          Sampler &sampler) const;
+
     // PathIntegrator Private Data
     const int maxDepth;
     const float rrThreshold;
     const std::string lightSampleStrategy;
-    std::unique_ptr<LightDistribution> lightDistribution;
+    std::shared_ptr<LightDistribution> lightDistribution;
+    const bool guiding;
+    const int guidingSpatialThreshold;
+    const float guidingBSDFFraction;
+    const float guidingMaxMB;
+    std::unique_ptr<SDTree> sdTree;
 };
 
 PathIntegrator *CreatePathIntegrator(const ParamSet &params,
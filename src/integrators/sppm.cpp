@@ -3,6 +3,7 @@
 #include "parallel.h"
 #include "scene.h"
 #include "imageio.h"
+#include "checkpoint.h"
 #include "spectrum.h"
 #include "rng.h"
 #include "paramset.h"
@@ -25,6 +26,7 @@ STAT_INT_DISTRIBUTION(
     gridCellsPerVisiblePoint);
 STAT_MEMORY_COUNTER("Memory/SPPM Pixels", pixelMemoryBytes);
 STAT_FLOAT_DISTRIBUTION("Memory/SPPM BSDF and Grid Memory", memoryArenaMB);
+STAT_MEMORY_COUNTER("Memory/SPPM Grid", gridMemoryBytes);
 
 // SPPM Local Definitions
 struct SPPMPixel {
@@ -51,9 +53,23 @@ struct SPPMPixel {
     Spectrum tau;
 };
 
-struct SPPMPixelListNode {
-    SPPMPixel *pixel;
-    SPPMPixelListNode *next;
+// A visible point's position and search radius, stored contiguously with
+// the other visible points overlapping the same grid cell. Photon lookups
+// scan a cell's entries in order and only touch the pixel itself for
+// photons within range.
+struct SPPMGridEntry {
+    Point3f p;
+    float radius;
+    int pixelIndex;
+};
+
+// A photon intersection waiting to be deposited, used when photons are
+// sorted by grid cell before deposition.
+struct SPPMPhoton {
+    Point3f p;
+    Vector3f wi;
+    Spectrum beta;
+    int cell;
 };
 
 static bool ToGrid(const Point3f &p, const Bounds3f &bounds,
@@ -74,6 +90,90 @@ inline unsigned int hash(const Point3i &p, int hashSize) {
            hashSize;
 }
 
+// Calls _func_ with the hash of each grid cell overlapped by the sphere of
+// radius _radius_ around _p_ and returns the number of cells
+template <typename Func>
+static int ForEachOverlappedCell(const Point3f &p, float radius,
+                                 const Bounds3f &gridBounds,
+                                 const int gridRes[3], int hashSize,
+                                 Func func) {
+    Point3i pMin, pMax;
+    ToGrid(p - Vector3f(radius, radius, radius), gridBounds, gridRes, &pMin);
+    ToGrid(p + Vector3f(radius, radius, radius), gridBounds, gridRes, &pMax);
+    for (int z = pMin.z; z <= pMax.z; ++z)
+        for (int y = pMin.y; y <= pMax.y; ++y)
+            for (int x = pMin.x; x <= pMax.x; ++x)
+                func(hash(Point3i(x, y, z), hashSize));
+    return (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
+           (1 + pMax.z - pMin.z);
+}
+
+// Per-pixel SPPM state saved in checkpoints: the search radius, photon
+// count, direct lighting and flux, in that order. Visible points and
+// photon statistics are reset after every iteration and aren't saved.
+static const int checkpointPixelFloats = 2 + 2 * Spectrum::nSamples;
+
+static void SaveSPPMCheckpoint(const std::string &filename, int iterations,
+                               int photonsPerIteration,
+                               const SPPMPixel *pixels, int nPixels,
+                               const Spectrum *image) {
+    std::unique_ptr<Checkpoint> state(new Checkpoint);
+    std::vector<float> values(checkpointPixelFloats * nPixels);
+    ParallelFor([&](int64_t i) {
+        float *v = &values[checkpointPixelFloats * i];
+        v[0] = pixels[i].radius;
+        v[1] = pixels[i].N;
+        for (int c = 0; c < Spectrum::nSamples; ++c) {
+            v[2 + c] = pixels[i].Ld[c];
+            v[2 + Spectrum::nSamples + c] = pixels[i].tau[c];
+        }
+    }, nPixels, 4096);
+    state->Add("sppm.pixels", values);
+    state->Add("sppm.image", image, nPixels);
+    int64_t progress[2] = {iterations, photonsPerIteration};
+    state->Add("sppm.progress", progress, 2);
+    WriteCheckpointAsync(filename, std::move(state));
+}
+
+// Restores the state saved by SaveSPPMCheckpoint(); returns the number of
+// iterations it had completed, or zero if there's nothing to resume
+static int ResumeSPPMCheckpoint(const std::string &filename,
+                                int photonsPerIteration, SPPMPixel *pixels,
+                                int nPixels, Spectrum *image) {
+    Checkpoint state;
+    if (!state.Read(filename)) {
+        Warning("No checkpoint \"%s\" to resume from; starting over",
+                filename.c_str());
+        return 0;
+    }
+    std::vector<float> values;
+    std::vector<Spectrum> savedImage;
+    std::vector<int64_t> progress;
+    if (!state.Get("sppm.pixels", &values) ||
+        values.size() != size_t(checkpointPixelFloats * nPixels) ||
+        !state.Get("sppm.image", &savedImage) ||
+        savedImage.size() != size_t(nPixels) ||
+        !state.Get("sppm.progress", &progress) || progress.size() != 2 ||
+        progress[1] != photonsPerIteration) {
+        // Photon counts enter the density estimate, so they must match
+        Error("Checkpoint \"%s\" doesn't match this render; starting over",
+              filename.c_str());
+        return 0;
+    }
+    ParallelFor([&](int64_t i) {
+        const float *v = &values[checkpointPixelFloats * i];
+        pixels[i].radius = v[0];
+        pixels[i].N = v[1];
+        for (int c = 0; c < Spectrum::nSamples; ++c) {
+            pixels[i].Ld[c] = v[2 + c];
+            pixels[i].tau[c] = v[2 + Spectrum::nSamples + c];
+        }
+        image[i] = savedImage[i];
+    }, nPixels, 4096);
+    LOG(INFO) << "Resuming SPPM after " << progress[0] << " iterations";
+    return progress[0];
+}
+
 // SPPM Method Definitions
 void SPPMIntegrator::Render(const Scene &scene) {
     ProfilePhase p(Prof::IntegratorRender);
@@ -98,7 +198,19 @@ void SPPMIntegrator::Render(const Scene &scene) {
                    (pixelExtent.y + tileSize - 1) / tileSize);
     ProgressReporter progress(2 * nIterations, "Rendering");
     std::vector<MemoryArena> perThreadArenas(MaxThreadIndex());
-    for (int iter = 0; iter < nIterations; ++iter) {
+    // The radiance estimate after the most recent iteration
+    std::unique_ptr<Spectrum[]> image(new Spectrum[nPixels]);
+    int firstIteration = 0;
+    if (!checkpoint.filename.empty() && checkpoint.resume) {
+        firstIteration = ResumeSPPMCheckpoint(
+            checkpoint.filename, photonsPerIteration, pixels.get(), nPixels,
+            image.get());
+        if (firstIteration > 0) camera->film->SetImage(image.get());
+        progress.Update(2 * std::min(firstIteration, nIterations));
+    }
+    std::chrono::steady_clock::time_point lastCheckpoint =
+        std::chrono::steady_clock::now();
+    for (int iter = firstIteration; iter < nIterations; ++iter) {
         // Generate SPPM visible points
         {
             ProfilePhase _(Prof::SPPMCameraPass);
@@ -208,9 +320,12 @@ void SPPMIntegrator::Render(const Scene &scene) {
         // Create grid of all SPPM visible points
         int gridRes[3];
         Bounds3f gridBounds;
-        // Allocate grid for SPPM visible points
+        // Grid cells are hashed into _hashSize_ buckets; the visible points
+        // of bucket _h_ are _gridEntries[cellStart[h]]_ up to (but not
+        // including) _gridEntries[cellStart[h + 1]]_
         const int hashSize = nPixels;
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
+        std::vector<int> cellStart(hashSize + 1);
+        std::vector<SPPMGridEntry> gridEntries;
         {
             ProfilePhase _(Prof::SPPMGridConstruction);
 
@@ -232,45 +347,70 @@ void SPPMIntegrator::Render(const Scene &scene) {
             for (int i = 0; i < 3; ++i)
                 gridRes[i] = std::max((int)(baseGridRes * diag[i] / maxDiag), 1);
 
-            // Add visible points to SPPM grid
+            // Sort visible points into their grid cells with a counting
+            // sort: count the points overlapping each cell, compute each
+            // cell's starting offset, then scatter the points
+            std::unique_ptr<std::atomic<int>[]> cellCount(
+                new std::atomic<int>[hashSize]);
+            ParallelFor([&](int h) { cellCount[h] = 0; }, hashSize, 4096);
             ParallelFor([&](int pixelIndex) {
-                MemoryArena &arena = perThreadArenas[ThreadIndex];
-                SPPMPixel &pixel = pixels[pixelIndex];
-                if (!pixel.vp.beta.IsBlack()) {
-                    // Add pixel's visible point to applicable grid cells
-                    float radius = pixel.radius;
-                    Point3i pMin, pMax;
-                    ToGrid(pixel.vp.p - Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMin);
-                    ToGrid(pixel.vp.p + Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMax);
-                    for (int z = pMin.z; z <= pMax.z; ++z)
-                        for (int y = pMin.y; y <= pMax.y; ++y)
-                            for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
-                                int h = hash(Point3i(x, y, z), hashSize);
-                                SPPMPixelListNode *node =
-                                    arena.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of
-                                // _grid[h]_'s linked list
-                                node->next = grid[h];
-                                while (grid[h].compare_exchange_weak(
-                                           node->next, node) == false)
-                                    ;
-                            }
-                    ReportValue(gridCellsPerVisiblePoint,
-                                (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
-                                    (1 + pMax.z - pMin.z));
-                }
+                const SPPMPixel &pixel = pixels[pixelIndex];
+                if (pixel.vp.beta.IsBlack()) return;
+                ForEachOverlappedCell(
+                    pixel.vp.p, pixel.radius, gridBounds, gridRes, hashSize,
+                    [&](int h) {
+                        cellCount[h].fetch_add(1, std::memory_order_relaxed);
+                    });
+            }, nPixels, 4096);
+            cellStart[0] = 0;
+            for (int h = 0; h < hashSize; ++h)
+                cellStart[h + 1] = cellStart[h] + cellCount[h];
+            gridEntries.resize(cellStart[hashSize]);
+            gridMemoryBytes =
+                std::max(gridMemoryBytes,
+                         int64_t(gridEntries.size() * sizeof(SPPMGridEntry) +
+                                 cellStart.size() * sizeof(int)));
+            ParallelFor([&](int h) { cellCount[h] = cellStart[h]; }, hashSize,
+                        4096);
+            ParallelFor([&](int pixelIndex) {
+                const SPPMPixel &pixel = pixels[pixelIndex];
+                if (pixel.vp.beta.IsBlack()) return;
+                int nCells = ForEachOverlappedCell(
+                    pixel.vp.p, pixel.radius, gridBounds, gridRes, hashSize,
+                    [&](int h) {
+                        int slot = cellCount[h].fetch_add(
+                            1, std::memory_order_relaxed);
+                        gridEntries[slot] = {pixel.vp.p, pixel.radius,
+                                             pixelIndex};
+                    });
+                ReportValue(gridCellsPerVisiblePoint, nCells);
             }, nPixels, 4096);
         }
 
+        // Adds the contribution of a photon arriving at _p_ from _wi_ to the
+        // visible points in grid bucket _h_
+        auto depositPhoton = [&](int h, const Point3f &p, const Vector3f &wi,
+                                 const Spectrum &beta) {
+            for (int i = cellStart[h]; i < cellStart[h + 1]; ++i) {
+                ++visiblePointsChecked;
+                const SPPMGridEntry &entry = gridEntries[i];
+                if (DistanceSquared(entry.p, p) > entry.radius * entry.radius)
+                    continue;
+                // Update _pixel_ $\Phi$ and $M$ for nearby photon
+                SPPMPixel &pixel = pixels[entry.pixelIndex];
+                Spectrum Phi = beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
+                for (int j = 0; j < Spectrum::nSamples; ++j)
+                    pixel.Phi[j].Add(Phi[j]);
+                ++pixel.M;
+            }
+        };
+
         // Trace photons and accumulate contributions
         {
             ProfilePhase _(Prof::SPPMPhotonPass);
             std::vector<MemoryArena> photonShootArenas(MaxThreadIndex());
+            std::vector<std::vector<SPPMPhoton>> photons(
+                sortPhotons ? MaxThreadIndex() : 0);
             ParallelFor([&](int photonIndex) {
                 MemoryArena &arena = photonShootArenas[ThreadIndex];
                 // Follow photon path for _photonIndex_
@@ -319,26 +459,11 @@ void SPPMIntegrator::Render(const Scene &scene) {
                         if (ToGrid(isect.p, gridBounds, gridRes,
                                    &photonGridIndex)) {
                             int h = hash(photonGridIndex, hashSize);
-                            // Add photon contribution to visible points in
-                            // _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node != nullptr; node = node->next) {
-                                ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
-                                float radius = pixel.radius;
-                                if (DistanceSquared(pixel.vp.p, isect.p) >
-                                    radius * radius)
-                                    continue;
-                                // Update _pixel_ $\Phi$ and $M$ for nearby
-                                // photon
-                                Vector3f wi = -photonRay.d;
-                                Spectrum Phi =
-                                    beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
-                                for (int i = 0; i < Spectrum::nSamples; ++i)
-                                    pixel.Phi[i].Add(Phi[i]);
-                                ++pixel.M;
-                            }
+                            if (sortPhotons)
+                                photons[ThreadIndex].push_back(
+                                    {isect.p, -photonRay.d, beta, h});
+                            else
+                                depositPhoton(h, isect.p, -photonRay.d, beta);
                         }
                     }
                     // Sample new photon ray direction
@@ -377,6 +502,40 @@ void SPPMIntegrator::Render(const Scene &scene) {
                 }
                 arena.Reset();
             }, photonsPerIteration, 8192);
+
+            if (sortPhotons) {
+                // Counting sort the photons by grid bucket, then deposit
+                // each bucket's photons together so that its visible
+                // points stay in cache. As with the visible points, each
+                // thread's photons are counted and scattered in parallel.
+                std::unique_ptr<std::atomic<int>[]> photonCount(
+                    new std::atomic<int>[hashSize]);
+                ParallelFor([&](int h) { photonCount[h] = 0; }, hashSize,
+                            4096);
+                ParallelFor([&](int t) {
+                    for (const SPPMPhoton &photon : photons[t])
+                        photonCount[photon.cell].fetch_add(
+                            1, std::memory_order_relaxed);
+                }, photons.size());
+                std::vector<int> photonStart(hashSize + 1);
+                photonStart[0] = 0;
+                for (int h = 0; h < hashSize; ++h)
+                    photonStart[h + 1] = photonStart[h] + photonCount[h];
+                ParallelFor([&](int h) { photonCount[h] = photonStart[h]; },
+                            hashSize, 4096);
+                std::vector<SPPMPhoton> sorted(photonStart[hashSize]);
+                ParallelFor([&](int t) {
+                    for (const SPPMPhoton &photon : photons[t])
+                        sorted[photonCount[photon.cell].fetch_add(
+                            1, std::memory_order_relaxed)] = photon;
+                    std::vector<SPPMPhoton>().swap(photons[t]);
+                }, photons.size());
+                ParallelFor([&](int h) {
+                    for (int i = photonStart[h]; i < photonStart[h + 1]; ++i)
+                        depositPhoton(h, sorted[i].p, sorted[i].wi,
+                                      sorted[i].beta);
+                }, hashSize, 1024);
+            }
             progress.Update();
             photonPaths += photonsPerIteration;
         }
@@ -409,24 +568,55 @@ void SPPMIntegrator::Render(const Scene &scene) {
             }, nPixels, 4096);
         }
 
-        // Periodically store SPPM image in film and write image
-        if (iter + 1 == nIterations || ((iter + 1) % writeFrequency) == 0) {
-            int x0 = pixelBounds.pMin.x;
-            int x1 = pixelBounds.pMax.x;
-            uint64_t Np = (uint64_t)(iter + 1) * (uint64_t)photonsPerIteration;
-            std::unique_ptr<Spectrum[]> image(new Spectrum[pixelBounds.Area()]);
-            int offset = 0;
-            for (int y = pixelBounds.pMin.y; y < pixelBounds.pMax.y; ++y) {
-                for (int x = x0; x < x1; ++x) {
-                    // Compute radiance _L_ for SPPM pixel _pixel_
-                    const SPPMPixel &pixel =
-                        pixels[(y - pixelBounds.pMin.y) * (x1 - x0) + (x - x0)];
-                    Spectrum L = pixel.Ld / (iter + 1);
-                    L += pixel.tau / (Np * Pi * pixel.radius * pixel.radius);
-                    image[offset++] = L;
-                }
+        // Store this iteration's SPPM radiance estimate in the film and
+        // measure how much it changed since the previous iteration
+        int x0 = pixelBounds.pMin.x;
+        int x1 = pixelBounds.pMax.x;
+        int nRows = pixelBounds.pMax.y - pixelBounds.pMin.y;
+        uint64_t Np = (uint64_t)(iter + 1) * (uint64_t)photonsPerIteration;
+        std::vector<double> rowChange(nRows), rowLuminance(nRows);
+        ParallelFor([&](int64_t row) {
+            double change = 0, luminance = 0;
+            for (int i = row * (x1 - x0); i < (row + 1) * (x1 - x0); ++i) {
+                // Compute radiance _L_ for SPPM pixel _pixel_
+                const SPPMPixel &pixel = pixels[i];
+                Spectrum L = pixel.Ld / (iter + 1);
+                L += pixel.tau / (Np * Pi * pixel.radius * pixel.radius);
+                float y = L.y();
+                change += std::abs(y - image[i].y());
+                luminance += y;
+                image[i] = L;
             }
-            camera->film->SetImage(image.get());
+            rowChange[row] = change;
+            rowLuminance[row] = luminance;
+        }, nRows, 16);
+        double change = 0, luminance = 0;
+        for (int row = 0; row < nRows; ++row) {
+            change += rowChange[row];
+            luminance += rowLuminance[row];
+        }
+        float relativeChange = luminance > 0 ? change / luminance : Infinity;
+        camera->film->SetImage(image.get());
+        if (control) ++control->passesDone;
+
+        // Stop once the estimate has settled or the time budget is spent
+        bool converged = convergenceThreshold > 0 &&
+                         iter + 1 >= minConvergenceIterations &&
+                         relativeChange < convergenceThreshold;
+        bool outOfTime =
+            timeBudget > 0 && progress.ElapsedMS() > 1000 * timeBudget;
+        bool done = iter + 1 == nIterations || converged || outOfTime ||
+                    Cancelled();
+        if (converged)
+            LOG(INFO) << StringPrintf(
+                "SPPM converged after %d iterations (relative change %f)",
+                iter + 1, relativeChange);
+        else if (outOfTime)
+            LOG(INFO) << StringPrintf(
+                "SPPM time budget spent after %d iterations", iter + 1);
+
+        // Periodically write image
+        if (done || ((iter + 1) % writeFrequency) == 0) {
             camera->film->WriteImage();
             // Write SPPM radius image, if requested
             if (getenv("SPPM_RADIUS")) {
@@ -463,11 +653,23 @@ void SPPMIntegrator::Render(const Scene &scene) {
             }
         }
 
+        // Checkpoint the pixels; SPPM's sampler and photon sequences
+        // depend only on the iteration, so a resumed render picks up
+        // exactly where this one left off
+        if ((done && !checkpoint.filename.empty()) ||
+            checkpoint.Due(&lastCheckpoint))
+            SaveSPPMCheckpoint(checkpoint.filename, iter + 1,
+                               photonsPerIteration, pixels.get(), nPixels,
+                               image.get());
+
         // Reset memory arenas
         for (int i = 0; i < perThreadArenas.size(); ++i)
             perThreadArenas[i].Reset();
+        if (done) break;
     }
+    if (firstIteration >= nIterations) camera->film->WriteImage();
     progress.Done();
+    if (Cancelled()) LOG(INFO) << "Rendering cancelled";
 }
 
 Integrator *CreateSPPMIntegrator(const ParamSet &params,
@@ -479,9 +681,15 @@ Integrator *CreateSPPMIntegrator(const ParamSet &params,
     int photonsPerIter = params.FindOneInt("photonsperiteration", -1);
     int writeFreq = params.FindOneInt("imagewritefrequency", 1 << 31);
     float radius = params.FindOneFloat("radius", 1.f);
+    bool sortPhotons = params.FindOneBool("sortphotons", false);
+    float convergenceThreshold =
+        params.FindOneFloat("convergencethreshold", 0.f);
+    float timeBudget = params.FindOneFloat("timebudget", 0.f);
+    CheckpointSettings checkpoint = GetCheckpointSettings(params);
     // if (PbrtOptions.quickRender) nIterations = std::max(1, nIterations / 16);
     return new SPPMIntegrator(camera, nIterations, photonsPerIter, maxDepth,
-                              radius, writeFreq);
+                              radius, writeFreq, sortPhotons,
+                              convergenceThreshold, timeBudget, checkpoint);
 }
 
 }  // namespace pbrt
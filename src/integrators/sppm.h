@@ -6,6 +6,7 @@
 #include "integrator.h"
 #include "camera.h"
 #include "film.h"
+#include "checkpoint.h"
 
 namespace pbrt {
 
@@ -15,7 +16,10 @@ class SPPMIntegrator : public Integrator {
     // SPPMIntegrator Public Methods
     SPPMIntegrator(std::shared_ptr<const Camera> &camera, int nIterations,
                    int photonsPerIteration, int maxDepth,
-                   float initialSearchRadius, int writeFrequency)
+                   float initialSearchRadius, int writeFrequency,
+                   bool sortPhotons = false, float convergenceThreshold = 0,
+                   float timeBudget = 0,
+                   const CheckpointSettings &checkpoint = CheckpointSettings())
         : camera(camera),
           initialSearchRadius(initialSearchRadius),
           nIterations(nIterations),
@@ -23,7 +27,11 @@ class SPPMIntegrator : public Integrator {
           photonsPerIteration(photonsPerIteration > 0
                                   ? photonsPerIteration
                                   : camera->film->croppedPixelBounds.Area()),
-          writeFrequency(writeFrequency) {}
+          writeFrequency(writeFrequency),
+          sortPhotons(sortPhotons),
+          convergenceThreshold(convergenceThreshold),
+          timeBudget(timeBudget),
+          checkpoint(checkpoint) {}
     void Render(const Scene &scene);
 
   private:
@@ -34,6 +42,20 @@ class SPPMIntegrator : public Integrator {
     const int maxDepth;
     const int photonsPerIteration;
     const int writeFrequency;
+    // Whether photon intersections are sorted by grid cell before their
+    // contributions are added to the visible points
+    const bool sortPhotons;
+    // Rendering stops early once the summed change in pixel luminance
+    // from one iteration to the next, relative to the image's total
+    // luminance, falls below _convergenceThreshold_, or after _timeBudget_
+    // seconds; zero disables either test.
+    const float convergenceThreshold;
+    const float timeBudget;
+    static const int minConvergenceIterations = 4;
+    // Checkpoints hold the per-pixel statistics, not the film, and can
+    // only be resumed, not merged: the search radii shrink with each
+    // iteration, so independent renders' estimates don't add up.
+    const CheckpointSettings checkpoint;
 };
 
 Integrator *CreateSPPMIntegrator(const ParamSet &params,
@@ -0,0 +1,396 @@
+// integrators/vcm.cpp*
+#include "integrators/vcm.h"
+#include "film.h"
+#include "paramset.h"
+#include "progressreporter.h"
+#include "sampler.h"
+#include "samplers/random.h"
+#include "stats.h"
+
+namespace pbrt {
+
+STAT_COUNTER("Integrator/VCM light vertices merged", nMerges);
+STAT_INT_DISTRIBUTION("Integrator/VCM light subpath length",
+                      lightSubpathLength);
+
+// VCM Local Definitions
+
+// A stored light subpath vertex that camera subpaths can merge with:
+// vertex _index_ of light subpath _path_.
+struct VCMLightVertex {
+    Point3f p;
+    int path, index;
+};
+
+// Returns whether a photon-style density estimate can be made at _v_
+static bool Mergeable(const Vertex &v) {
+    return v.type == VertexType::Surface && v.IsConnectible();
+}
+
+// A hash grid of light vertices. Cells are as wide as the merge diameter,
+// so a merge query visits at most two cells along each axis; the vertices
+// of each hash bucket are stored contiguously.
+class VCMLightVertexGrid {
+  public:
+    // VCMLightVertexGrid Public Methods
+    void Build(const std::vector<std::vector<VCMLightVertex>> &perThread,
+               float radius);
+    template <typename Func>
+    void ForEachNearby(const Point3f &p, Func func) const;
+
+  private:
+    // VCMLightVertexGrid Private Methods
+    Point3i Cell(const Point3f &p) const {
+        return Point3i(int(std::floor(p.x * invCellSize)),
+                       int(std::floor(p.y * invCellSize)),
+                       int(std::floor(p.z * invCellSize)));
+    }
+    int Hash(const Point3i &c) const {
+        return (unsigned int)((c.x * 73856093) ^ (c.y * 19349663) ^
+                              (c.z * 83492791)) %
+               hashSize;
+    }
+
+    // VCMLightVertexGrid Private Data
+    float radius = 0, invCellSize = 0;
+    int hashSize = 1;
+    std::vector<int> cellStart;
+    std::vector<VCMLightVertex> vertices;
+};
+
+void VCMLightVertexGrid::Build(
+    const std::vector<std::vector<VCMLightVertex>> &perThread, float r) {
+    radius = r;
+    invCellSize = 1 / (2 * r);
+    size_t nVertices = 0;
+    for (const auto &v : perThread) nVertices += v.size();
+    hashSize = std::max<int>(nVertices, 1);
+
+    // Counting sort the vertices by hash bucket
+    cellStart.assign(hashSize + 1, 0);
+    for (const auto &threadVertices : perThread)
+        for (const VCMLightVertex &v : threadVertices)
+            ++cellStart[Hash(Cell(v.p)) + 1];
+    for (int h = 0; h < hashSize; ++h) cellStart[h + 1] += cellStart[h];
+    std::vector<int> cursor(cellStart.begin(), cellStart.end() - 1);
+    vertices.resize(nVertices);
+    for (const auto &threadVertices : perThread)
+        for (const VCMLightVertex &v : threadVertices)
+            vertices[cursor[Hash(Cell(v.p))]++] = v;
+}
+
+template <typename Func>
+void VCMLightVertexGrid::ForEachNearby(const Point3f &p, Func func) const {
+    if (vertices.empty()) return;
+    Point3i c0 = Cell(p - Vector3f(radius, radius, radius));
+    Point3i c1 = Cell(p + Vector3f(radius, radius, radius));
+    // The search box is one cell wide, so it usually overlaps two cells
+    // per axis, but rounding at cell borders can make that three
+    CHECK(c1.x - c0.x <= 2 && c1.y - c0.y <= 2 && c1.z - c0.z <= 2);
+    // Different cells may share a bucket; visit each bucket only once so
+    // that no vertex is reported twice
+    int visited[27], nVisited = 0;
+    for (int z = c0.z; z <= c1.z; ++z)
+        for (int y = c0.y; y <= c1.y; ++y)
+            for (int x = c0.x; x <= c1.x; ++x) {
+                int h = Hash(Point3i(x, y, z));
+                if (std::find(visited, visited + nVisited, h) !=
+                    visited + nVisited)
+                    continue;
+                visited[nVisited++] = h;
+                for (int i = cellStart[h]; i < cellStart[h + 1]; ++i)
+                    if (DistanceSquared(vertices[i].p, p) <= radius * radius)
+                        func(vertices[i]);
+            }
+}
+
+// Computes the balance heuristic weight of connecting the first _s_ light
+// subpath vertices to the first _t_ camera subpath vertices or, if _merge_
+// is true, of merging camera vertex $t-1$ with the light vertex that
+// follows light vertex $s-1$. Merging at a vertex is as likely as the
+// connection that ends there on the camera side times the probability
+// density of the light subpath reaching it and _eta_, the number of light
+// subpaths times the merge area. Unlike MISWeight(), this leaves the
+// subpaths untouched, since light subpaths are shared between threads.
+static float VCMWeight(
+    const Scene &scene, const Vertex *lightVertices,
+    const Vertex *cameraVertices, const Vertex &sampled, int s, int t,
+    bool merge, float eta, const Distribution1D &lightDistr,
+    const std::unordered_map<const Light *, size_t> &lightToIndex) {
+    if (s + t == 2) return 1;
+    auto remap0 = [](float f) -> float { return f != 0 ? f : 1; };
+
+    // Look up connection vertices and their predecessors
+    const Vertex *qs = s > 0 ? (s == 1 && !merge ? &sampled
+                                                 : &lightVertices[s - 1])
+                             : nullptr,
+                 *pt = t == 1 ? &sampled : &cameraVertices[t - 1],
+                 *qsMinus = s > 1 ? &lightVertices[s - 2] : nullptr,
+                 *ptMinus = t > 1 ? &cameraVertices[t - 2] : nullptr;
+
+    // Compute the reverse densities that this strategy changes
+    float ptPdfRev = s > 0 ? qs->Pdf(scene, qsMinus, *pt)
+                           : pt->PdfLightOrigin(scene, *ptMinus, lightDistr,
+                                                lightToIndex);
+    float ptMinusPdfRev = 0, qsPdfRev = 0, qsMinusPdfRev = 0;
+    if (ptMinus)
+        ptMinusPdfRev = s > 0 ? pt->Pdf(scene, qs, *ptMinus)
+                              : pt->PdfLight(scene, *ptMinus);
+    if (qs) qsPdfRev = pt->Pdf(scene, ptMinus, *qs);
+    if (qsMinus) qsMinusPdfRev = qs->Pdf(scene, pt, *qsMinus);
+
+    // Connection vertices are non-degenerate, except for the light vertex
+    // of a merge, which scattered as it was sampled
+    bool qsDelta = merge && qs->delta;
+    auto cameraPdfRev = [&](int i) {
+        return i == t - 1 ? ptPdfRev
+                          : (i == t - 2 ? ptMinusPdfRev
+                                        : cameraVertices[i].pdfRev);
+    };
+    auto cameraDelta = [&](int i) {
+        return i == t - 1 ? false : cameraVertices[i].delta;
+    };
+    auto lightVertex = [&](int i) -> const Vertex & {
+        return i == s - 1 ? *qs : lightVertices[i];
+    };
+    auto lightPdfRev = [&](int i) {
+        return i == s - 1 ? qsPdfRev
+                          : (i == s - 2 ? qsMinusPdfRev
+                                        : lightVertices[i].pdfRev);
+    };
+    auto lightDelta = [&](int i) {
+        return i == s - 1 ? qsDelta : lightVertices[i].delta;
+    };
+
+    // Sum the densities of all strategies relative to the $(s,t)$
+    // connection, starting with that connection itself
+    float sumRi = qsDelta ? 0 : 1;
+
+    // Consider hypothetical connections and merges along the camera subpath
+    float ri = 1;
+    for (int i = t - 1; i > 0; --i) {
+        const Vertex &v = cameraVertices[i];
+        bool lightEndpoint = s == 0 && i == t - 1;
+        if (!lightEndpoint && !cameraDelta(i) && Mergeable(v))
+            sumRi += ri * remap0(cameraPdfRev(i)) * eta;
+        ri *= remap0(cameraPdfRev(i)) / remap0(v.pdfFwd);
+        if (!cameraDelta(i) && !cameraDelta(i - 1)) sumRi += ri;
+    }
+
+    // Consider hypothetical connections and merges along the light subpath
+    ri = 1;
+    for (int i = s - 1; i >= 0; --i) {
+        const Vertex &v = lightVertex(i);
+        if (i > 0 && !lightDelta(i) && Mergeable(v))
+            sumRi += ri * remap0(lightPdfRev(i)) * eta;
+        ri *= remap0(lightPdfRev(i)) / remap0(v.pdfFwd);
+        bool deltaLightvertex =
+            i > 0 ? lightDelta(i - 1) : lightVertex(0).IsDeltaLight();
+        if (!lightDelta(i) && !deltaLightvertex) sumRi += ri;
+    }
+    return (merge ? remap0(ptPdfRev) * eta : 1) / sumRi;
+}
+
+// VCM Method Definitions
+void VCMIntegrator::Render(const Scene &scene) {
+    ProfilePhase p(Prof::IntegratorRender);
+    std::unique_ptr<Distribution1D> lightDistr =
+        ComputeLightPowerDistribution(scene);
+    std::unordered_map<const Light *, size_t> lightToIndex;
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+        lightToIndex[scene.lights[i].get()] = i;
+
+    // Partition the image into tiles
+    Film *film = camera->film;
+    const Bounds2i sampleBounds = film->GetSampleBounds();
+    const Vector2i sampleExtent = sampleBounds.Diagonal();
+    const int tileSize = 16;
+    const int nXTiles = (sampleExtent.x + tileSize - 1) / tileSize;
+    const int nYTiles = (sampleExtent.y + tileSize - 1) / tileSize;
+
+    // Each iteration takes one sample per pixel and traces one light
+    // subpath per pixel in _pixelBounds_
+    const int nIterations = sampler->samplesPerPixel;
+    const int nLightPaths = pixelBounds.Area();
+    const int pixelsPerRow = pixelBounds.pMax.x - pixelBounds.pMin.x;
+    float radius0 = initialRadius;
+    if (radius0 <= 0) {
+        Point3f worldCenter;
+        float worldRadius;
+        scene.WorldBound().BoundingSphere(&worldCenter, &worldRadius);
+        radius0 = 0.003f * worldRadius;
+    }
+
+    ProgressReporter reporter(nIterations, "Rendering");
+    std::vector<MemoryArena> lightArenas(MaxThreadIndex());
+    std::vector<const Vertex *> lightPaths(nLightPaths);
+    std::vector<int> lightPathLengths(nLightPaths);
+    RandomSampler lightSampler(1);
+    int iter = 0;
+    for (; iter < nIterations && !scene.lights.empty() && !Cancelled();
+         ++iter) {
+        float radius =
+            radius0 * std::pow(float(iter + 1), (radiusAlpha - 1) / 2);
+        float eta = nLightPaths * Pi * radius * radius;
+
+        // Trace this iteration's light subpaths and store their vertices
+        VCMLightVertexGrid grid;
+        {
+            const int chunkSize = 1024;
+            const int nChunks = (nLightPaths + chunkSize - 1) / chunkSize;
+            std::vector<std::vector<VCMLightVertex>> mergeVertices(
+                MaxThreadIndex());
+            ParallelFor([&](int64_t chunk) {
+                MemoryArena &arena = lightArenas[ThreadIndex];
+                std::unique_ptr<Sampler> chunkSampler =
+                    lightSampler.Clone(iter * nChunks + chunk);
+                std::vector<Vertex> scratch(maxDepth + 1);
+                int end = std::min<int>((chunk + 1) * chunkSize, nLightPaths);
+                for (int i = chunk * chunkSize; i < end; ++i) {
+                    chunkSampler->StartPixel(Point2i(i, iter));
+                    float time = Lerp(chunkSampler->Get1D(),
+                                      camera->shutterOpen,
+                                      camera->shutterClose);
+                    int nLight = GenerateLightSubpath(
+                        scene, *chunkSampler, arena, maxDepth + 1, time,
+                        *lightDistr, lightToIndex, &scratch[0]);
+                    ReportValue(lightSubpathLength, nLight);
+
+                    // Keep only the vertices the subpath actually reached
+                    Vertex *path = arena.Alloc<Vertex>(nLight, false);
+                    std::copy(scratch.begin(), scratch.begin() + nLight, path);
+                    lightPaths[i] = path;
+                    lightPathLengths[i] = nLight;
+                    for (int j = 1; j < nLight; ++j)
+                        if (Mergeable(path[j]))
+                            mergeVertices[ThreadIndex].push_back(
+                                {path[j].p(), i, j});
+                }
+            }, nChunks, 1);
+            grid.Build(mergeVertices, radius);
+        }
+
+        // Trace camera subpaths and connect and merge them with the light
+        // subpaths
+        ParallelFor2D([&](const Point2i tile) {
+            MemoryArena arena;
+            int seed = (iter * nYTiles + tile.y) * nXTiles + tile.x;
+            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
+            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+            std::unique_ptr<FilmTile> filmTile = film->GetFilmTile(tileBounds);
+            const FilterSampler *filterSampler = film->GetFilterSampler();
+            for (Point2i pPixel : tileBounds) {
+                tileSampler->StartPixel(pPixel);
+                if (!InsideExclusive(pPixel, pixelBounds)) continue;
+                if (!tileSampler->SetSampleNumber(iter)) continue;
+                float filterWeight = 1;
+                Point2f pFilm =
+                    filterSampler
+                        ? filterSampler->SampleFilm(
+                              pPixel, tileSampler->Get2D(), &filterWeight)
+                        : (Point2f)pPixel + tileSampler->Get2D();
+                Vertex *cameraVertices = arena.Alloc<Vertex>(maxDepth + 2);
+                int nCamera =
+                    GenerateCameraSubpath(scene, *tileSampler, arena,
+                                          maxDepth + 2, *camera, pFilm,
+                                          cameraVertices);
+
+                // Execute the connection strategies with this pixel's light
+                // subpath
+                int pathIndex = (pPixel.y - pixelBounds.pMin.y) * pixelsPerRow +
+                                (pPixel.x - pixelBounds.pMin.x);
+                const Vertex *lightVertices = lightPaths[pathIndex];
+                int nLight = lightPathLengths[pathIndex];
+                Spectrum L(0.f);
+                for (int t = 1; t <= nCamera; ++t) {
+                    for (int s = 0; s <= nLight; ++s) {
+                        int depth = t + s - 2;
+                        if ((s == 1 && t == 1) || depth < 0 || depth > maxDepth)
+                            continue;
+                        Point2f pFilmNew = pFilm;
+                        Vertex sampled;
+                        Spectrum Lpath = ConnectSubpaths(
+                            scene, lightVertices, cameraVertices, s, t,
+                            *lightDistr, lightToIndex, *camera, *tileSampler,
+                            &pFilmNew, &sampled);
+                        if (Lpath.IsBlack()) continue;
+                        Lpath *= VCMWeight(scene, lightVertices, cameraVertices,
+                                           sampled, s, t, false, eta,
+                                           *lightDistr, lightToIndex);
+                        if (t != 1)
+                            L += Lpath;
+                        else
+                            film->AddSplat(pFilmNew, Lpath);
+                    }
+                }
+
+                // Merge camera vertices with nearby vertices of all light
+                // subpaths
+                for (int t = 2; t <= nCamera; ++t) {
+                    const Vertex &pt = cameraVertices[t - 1];
+                    if (!Mergeable(pt)) continue;
+                    Spectrum Lmerge(0.f);
+                    grid.ForEachNearby(pt.p(), [&](const VCMLightVertex &lv) {
+                        int s = lv.index;
+                        if (s + t - 2 > maxDepth) return;
+                        const Vertex *path = lightPaths[lv.path];
+                        const Vertex &v = path[s];
+                        Spectrum f = pt.si.bsdf->f(pt.si.wo, v.si.wo);
+                        if (f.IsBlack()) return;
+                        ++nMerges;
+                        Lmerge += f * v.beta *
+                                  VCMWeight(scene, path, cameraVertices, pt, s,
+                                            t, true, eta, *lightDistr,
+                                            lightToIndex);
+                    });
+                    L += pt.beta * Lmerge / eta;
+                }
+                filmTile->AddPixelSample(pPixel, pFilm, filterWeight, L);
+                arena.Reset();
+            }
+            film->MergeFilmTile(std::move(filmTile));
+        }, Point2i(nXTiles, nYTiles));
+
+        // Release this iteration's light subpaths
+        for (MemoryArena &arena : lightArenas) arena.Reset();
+        film->ResolveSplats();
+        reporter.Update();
+        if (control) {
+            control->splatScale = 1.0f / (iter + 1);
+            ++control->passesDone;
+        }
+    }
+    reporter.Done();
+    if (Cancelled()) LOG(INFO) << "Rendering cancelled";
+    film->WriteImage(1.0f / std::max(iter, 1));
+}
+
+VCMIntegrator *CreateVCMIntegrator(const ParamSet &params,
+                                   std::shared_ptr<Sampler> sampler,
+                                   std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    float radius = params.FindOneFloat("radius", 0.f);
+    float radiusAlpha = Clamp(params.FindOneFloat("radiusalpha", 0.75f), 0, 1);
+    int np;
+    const int *pb = params.FindInt("pixelbounds", &np);
+    Bounds2i pixelBounds = camera->film->GetSampleBounds();
+    if (pb) {
+        if (np != 4)
+            Error("Expected four values for \"pixelbounds\" parameter. Got %d.",
+                  np);
+        else {
+            pixelBounds = Intersect(pixelBounds,
+                                    Bounds2i{{pb[0], pb[2]}, {pb[1], pb[3]}});
+            if (pixelBounds.Area() == 0)
+                Error("Degenerate \"pixelbounds\" specified.");
+        }
+    }
+    return new VCMIntegrator(sampler, camera, maxDepth, radius, radiusAlpha,
+                             pixelBounds);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,54 @@
+#ifndef INTEGRATORS_VCM_H
+#define INTEGRATORS_VCM_H
+
+// integrators/vcm.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "integrators/bdpt.h"
+
+namespace pbrt {
+
+// VCM Declarations
+
+// Vertex connection and merging: each iteration traces one light subpath
+// per pixel and stores its vertices, then traces one camera subpath per
+// pixel that is both connected to "its" light subpath, as in BDPT, and
+// merged with nearby vertices of all the stored light subpaths, as in
+// photon mapping. All strategies are combined with the balance heuristic,
+// treating merging as a connection whose last light vertex was found
+// with probability proportional to the merge area.
+class VCMIntegrator : public Integrator {
+  public:
+    // VCMIntegrator Public Methods
+    VCMIntegrator(std::shared_ptr<Sampler> sampler,
+                  std::shared_ptr<const Camera> camera, int maxDepth,
+                  float initialRadius, float radiusAlpha,
+                  const Bounds2i &pixelBounds)
+        : sampler(sampler),
+          camera(camera),
+          maxDepth(maxDepth),
+          initialRadius(initialRadius),
+          radiusAlpha(radiusAlpha),
+          pixelBounds(pixelBounds) {}
+    void Render(const Scene &scene);
+
+  private:
+    // VCMIntegrator Private Data
+    std::shared_ptr<Sampler> sampler;
+    std::shared_ptr<const Camera> camera;
+    const int maxDepth;
+    // Merge radius for the first iteration, in world units; a value of
+    // zero selects a radius relative to the scene's extent. The radius of
+    // iteration $i$ is scaled by $i^{(\alpha - 1)/2}$.
+    const float initialRadius;
+    const float radiusAlpha;
+    const Bounds2i pixelBounds;
+};
+
+VCMIntegrator *CreateVCMIntegrator(const ParamSet &params,
+                                   std::shared_ptr<Sampler> sampler,
+                                   std::shared_ptr<const Camera> camera);
+
+}  // namespace pbrt
+
+#endif  // PBRT_INTEGRATORS_VCM_H
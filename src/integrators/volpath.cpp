@@ -1,6 +1,7 @@
 // integrators/volpath.cpp*
 #include "integrators/volpath.h"
 #include "bssrdf.h"
+#include "film.h"
 #include "camera.h"
 #include "film.h"
 #include "interaction.h"
@@ -16,13 +17,12 @@ STAT_COUNTER("Integrator/Surface interactions", surfaceInteractions);
 
 // VolPathIntegrator Method Definitions
 void VolPathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
-    lightDistribution =
-        CreateLightSampleDistribution(lightSampleStrategy, scene);
+    lightDistribution = scene.GetLightSampleDistribution(lightSampleStrategy);
 }
 
 Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                                Sampler &sampler, MemoryArena &arena,
-                               int depth) const {
+                               int depth, AOVSample *aov) const {
     ProfilePhase p(Prof::SamplerIntegratorLi);
     Spectrum L(0.f), beta(1.f);
     RayDifferential ray(r);
@@ -54,10 +54,8 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
 
             ++volumeInteractions;
             // Handle scattering at point in medium for volumetric path tracer
-            const Distribution1D *lightDistrib =
-                lightDistribution->Lookup(mi.p);
             L += beta * UniformSampleOneLight(mi, scene, arena, sampler, true,
-                                              lightDistrib);
+                                              *lightDistribution);
 
             Vector3f wo = -ray.d, wi;
             mi.phase->Sample_p(wo, &wi, sampler.Get2D());
@@ -88,12 +86,15 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                 continue;
             }
 
+            if (aov && !aov->hit &&
+                isect.bsdf->NumComponents(
+                    BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+                RecordAOVs(isect, beta, r.o, aov);
+
             // Sample illumination from lights to find attenuated path
             // contribution
-            const Distribution1D *lightDistrib =
-                lightDistribution->Lookup(isect.p);
             L += beta * UniformSampleOneLight(isect, scene, arena, sampler,
-                                              true, lightDistrib);
+                                              true, *lightDistribution);
 
             // Sample BSDF to get new path direction
             Vector3f wo = -ray.d, wi;
@@ -129,7 +130,7 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                 // component
                 L += beta *
                      UniformSampleOneLight(pi, scene, arena, sampler, true,
-                                           lightDistribution->Lookup(pi.p));
+                                           *lightDistribution);
 
                 // Account for the indirect subsurface scattering component
                 Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(),
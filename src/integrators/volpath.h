@@ -22,14 +22,15 @@ class VolPathIntegrator : public SamplerIntegrator {
           lightSampleStrategy(lightSampleStrategy) { }
     void Preprocess(const Scene &scene, Sampler &sampler);
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
-                Sampler &sampler, MemoryArena &arena, int depth) const;
+                Sampler &sampler, MemoryArena &arena, int depth,
+                AOVSample *aov) const;
 
   private:
     // VolPathIntegrator Private Data
     const int maxDepth;
     const float rrThreshold;
     const std::string lightSampleStrategy;
-    std::unique_ptr<LightDistribution> lightDistribution;
+    std::shared_ptr<LightDistribution> lightDistribution;
 };
 
 VolPathIntegrator *CreateVolPathIntegrator(
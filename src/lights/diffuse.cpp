@@ -33,6 +33,14 @@ Spectrum DiffuseAreaLight::Power() const {
     return (twoSided ? 2 : 1) * Lemit * area * Pi;
 }
 
+bool DiffuseAreaLight::Bounds(LightBounds *bounds) const {
+    DirectionCone nb = shape->NormalBounds();
+    *bounds = LightBounds(shape->WorldBound(), nb.w,
+                          std::max(Power().y(), (float)0), nb.cosTheta,
+                          std::cos(Pi / 2), twoSided);
+    return true;
+}
+
 Spectrum DiffuseAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
                                      Vector3f *wi, float *pdf,
                                      VisibilityTester *vis) const {
@@ -28,6 +28,7 @@ class DiffuseAreaLight : public AreaLight {
                        float *pdfDir) const;
     void Pdf_Le(const Ray &, const Normal3f &, float *pdfPos,
                 float *pdfDir) const;
+    bool Bounds(LightBounds *bounds) const;
 
   protected:
     // DiffuseAreaLight Protected Data
@@ -20,6 +20,13 @@ Spectrum PointLight::Sample_Li(const Interaction &ref, const Point2f &u,
 
 Spectrum PointLight::Power() const { return 4 * Pi * I; }
 
+bool PointLight::Bounds(LightBounds *bounds) const {
+    *bounds = LightBounds(Bounds3f(pLight), Vector3f(0, 0, 1),
+                          std::max(Power().y(), (float)0), std::cos(Pi),
+                          std::cos(Pi / 2), false);
+    return true;
+}
+
 float PointLight::Pdf_Li(const Interaction &, const Vector3f &) const {
     return 0;
 }
@@ -27,6 +27,7 @@ class PointLight : public Light {
                        float *pdfDir) const;
     void Pdf_Le(const Ray &, const Normal3f &, float *pdfPos,
                 float *pdfDir) const;
+    bool Bounds(LightBounds *bounds) const;
 
   private:
     // PointLight Private Data
@@ -43,6 +43,19 @@ Spectrum SpotLight::Power() const {
     return I * 2 * Pi * (1 - .5f * (cosFalloffStart + cosTotalWidth));
 }
 
+bool SpotLight::Bounds(LightBounds *bounds) const {
+    // The cone covers the full-intensity part of the spot; the falloff
+    // region is the spread around it. As with the point light, _phi_ is
+    // the power the spot would have if it emitted in all directions, since
+    // the cones account for its directionality.
+    Vector3f w = LightToWorld(Vector3f(0, 0, 1));
+    float cosTheta_e = std::cos(std::acos(cosTotalWidth) -
+                                std::acos(cosFalloffStart));
+    *bounds = LightBounds(Bounds3f(pLight), w, std::max(4 * Pi * I.y(), (float)0),
+                          cosFalloffStart, cosTheta_e, false);
+    return true;
+}
+
 float SpotLight::Pdf_Li(const Interaction &, const Vector3f &) const {
     return 0.f;
 }
@@ -24,6 +24,7 @@ class SpotLight : public Light {
                        float *pdfDir) const;
     void Pdf_Le(const Ray &, const Normal3f &, float *pdfPos,
                 float *pdfDir) const;
+    bool Bounds(LightBounds *bounds) const;
 
   private:
     // SpotLight Private Data
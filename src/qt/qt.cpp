@@ -1,4 +1,5 @@
 #include "qt.h"
+#include "pbrt.h"
 
 QSpinBox* createSpinBox(int rangeMin, int rangeMax, int initValue, QString suffix,
                         QVBoxLayout* layout){
@@ -8,4 +9,14 @@ QSpinBox* createSpinBox(int rangeMin, int rangeMax, int initValue, QString suffi
     spinBox->setSuffix(suffix);
     layout->addWidget(spinBox);
     return spinBox;
-}
\ No newline at end of file
+}
+
+QImage createImage(const float *rgb, int width, int height){
+    std::vector<uint8_t> rgb8(3 * width * height);
+    for (int i = 0; i < 3 * width * height; ++i)
+        rgb8[i] = (uint8_t)pbrt::Clamp(255.f * pbrt::GammaCorrect(rgb[i]) + 0.5f,
+                                       0.f, 255.f);
+    // QImage doesn't take ownership of the buffer, so hand back a deep copy
+    return QImage(rgb8.data(), width, height, 3 * width,
+                  QImage::Format_RGB888).copy();
+}
@@ -2,14 +2,21 @@
 #define QT_H
 
 #include <QApplication>
+#include <QCheckBox>
+#include <QImage>
 #include <QLabel>
 #include <QPixmap>
 #include <QPushButton>
 #include <QLayout>
 #include <QSpinBox>
 #include <QStyleFactory>
+#include <QTimer>
 
 QSpinBox* createSpinBox(int rangeMin, int rangeMax, int initValue, QString suffix,
                         QVBoxLayout* layout);
 
-#endif
\ No newline at end of file
+// Converts a linear RGB float buffer (as returned by Film::GetRGB) to a
+// gamma-corrected 8-bit image for display.
+QImage createImage(const float *rgb, int width, int height);
+
+#endif
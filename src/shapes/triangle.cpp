@@ -5,6 +5,7 @@
 #include "paramset.h"
 #include "sampling.h"
 #include "efloat.h"
+#include "parallel.h"
 #include "ext/rply.h"
 #include <array>
 
@@ -57,6 +58,14 @@ TriangleMesh::TriangleMesh(
 
     if (fIndices)
         faceIndices = std::vector<int>(fIndices, fIndices + nTriangles);
+
+    // Every render thread reads the mesh, so spread it across NUMA nodes
+    InterleaveMemory(this->vertexIndices.data(),
+                     this->vertexIndices.size() * sizeof(int));
+    InterleaveMemory(p.get(), nVertices * sizeof(Point3f));
+    InterleaveMemory(uv.get(), nVertices * sizeof(Point2f));
+    InterleaveMemory(n.get(), nVertices * sizeof(Normal3f));
+    InterleaveMemory(s.get(), nVertices * sizeof(Vector3f));
 }
 
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
@@ -547,6 +556,28 @@ float Triangle::Area() const {
     return 0.5 * Cross(p1 - p0, p2 - p0).Length();
 }
 
+DirectionCone Triangle::NormalBounds() const {
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
+    Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
+    // Orient the normal as Intersect() and Sample() do. With per-vertex
+    // normals, the geometric normal follows the interpolated shading
+    // normal, so it is only fixed if all three vertex normals agree.
+    if (mesh->n) {
+        int nNegative = 0;
+        for (int i = 0; i < 3; ++i)
+            if (Dot(n, mesh->n[v[i]]) < 0) ++nNegative;
+        if (nNegative == 3)
+            n = -n;
+        else if (nNegative > 0)
+            return DirectionCone::EntireSphere();
+    } else if (reverseOrientation ^ transformSwapsHandedness)
+        n = -n;
+    return DirectionCone(Vector3f(n), 1);
+}
+
 Interaction Triangle::Sample(const Point2f &u, float *pdf) const {
     Point2f b = UniformSampleTriangle(u);
     // Get triangle vertices in _p0_, _p1_, and _p2_
@@ -55,6 +55,7 @@ class Triangle : public Shape {
     // Returns the solid angle subtended by the triangle w.r.t. the given
     // reference point p.
     float SolidAngle(const Point3f &p, int nSamples = 0) const;
+    DirectionCone NormalBounds() const;
 
   private:
     // Triangle Private Methods